@@ -0,0 +1,230 @@
+#include "vcr.h"
+#include <pthread.h>
+
+// Cache of decompressed chunks of one zarr array.
+// Entries live in a chained hash table and on an LRU list. A miss inserts a
+// placeholder and decodes outside the lock, so other threads keep hitting the
+// cache meanwhile; threads that want the same chunk wait for the placeholder
+// instead of decoding it again. Pinned entries are never evicted, so the budget
+// is exceeded temporarily if the pinned set alone is larger.
+
+typedef struct centry {
+    s32 key[3];
+    s32 refs;
+    bool ready;
+    chunk* data;
+    struct centry* hnext;  // hash chain
+    struct centry* prev;   // LRU list, head = most recent
+    struct centry* next;
+} centry;
+
+struct chunkcache {
+    char path[1024];
+    zarrinfo metadata;
+    s32 grid[3];
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    centry** buckets;
+    u32 num_buckets;
+    centry* head;
+    centry* tail;
+    size_t bytes;
+    size_t budget;
+    u64 hits, misses;
+};
+
+static u32 ckey_hash(s32 z, s32 y, s32 x) {
+    u32 h = 2166136261u;
+    s32 fields[3] = {z, y, x};
+    for (s32 i = 0; i < 3; i++) {
+        h = (h ^ (u32)fields[i]) * 16777619u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static void lru_unlink(chunkcache* cc, centry* e) {
+    if (e->prev) e->prev->next = e->next; else cc->head = e->next;
+    if (e->next) e->next->prev = e->prev; else cc->tail = e->prev;
+    e->prev = e->next = nullptr;
+}
+
+static void lru_push_front(chunkcache* cc, centry* e) {
+    e->prev = nullptr;
+    e->next = cc->head;
+    if (cc->head) cc->head->prev = e;
+    cc->head = e;
+    if (!cc->tail) cc->tail = e;
+}
+
+static centry* entry_find(chunkcache* cc, s32 z, s32 y, s32 x) {
+    centry* e = cc->buckets[ckey_hash(z, y, x) & (cc->num_buckets - 1)];
+    while (e && !(e->key[0] == z && e->key[1] == y && e->key[2] == x)) {
+        e = e->hnext;
+    }
+    return e;
+}
+
+static void entry_remove(chunkcache* cc, centry* e) {
+    centry** link = &cc->buckets[ckey_hash(e->key[0], e->key[1], e->key[2]) & (cc->num_buckets - 1)];
+    while (*link != e) {
+        link = &(*link)->hnext;
+    }
+    *link = e->hnext;
+    lru_unlink(cc, e);
+    cc->bytes -= sizeof(chunk);
+    chunk_free(e->data);
+    free(e);
+}
+
+// Missing chunk files are normal in sparse arrays and read as fill_value
+static chunk* load_chunk(const chunkcache* cc, s32 z, s32 y, s32 x) {
+    char chunk_path[1024];
+    zarr_chunk_path(chunk_path, sizeof(chunk_path), cc->path, cc->metadata, z, y, x);
+    chunk* c = path_exists(chunk_path) ? zarr_read_chunk(chunk_path, cc->metadata) : nullptr;
+    if (!c) {
+        c = chunk_new();
+        memset(c, cc->metadata.fill_value, sizeof(chunk));
+    }
+    return c;
+}
+
+chunkcache* chunkcache_new(const char* path, zarrinfo metadata, size_t budget_bytes) {
+    for (s32 i = 0; i < 3; i++) {
+        if (metadata.chunks[i] != CHUNK_LEN) {
+            LOG_ERROR("chunk cache needs %d^3 chunks, array has %dx%dx%d\n", CHUNK_LEN,
+                      metadata.chunks[0], metadata.chunks[1], metadata.chunks[2]);
+            return nullptr;
+        }
+    }
+
+    chunkcache* cc = calloc(1, sizeof(chunkcache));
+    snprintf(cc->path, sizeof(cc->path), "%s", path);
+    cc->metadata = metadata;
+    for (s32 i = 0; i < 3; i++) {
+        cc->grid[i] = (metadata.shape[i] + CHUNK_LEN - 1) / CHUNK_LEN;
+    }
+    pthread_mutex_init(&cc->lock, nullptr);
+    pthread_cond_init(&cc->loaded, nullptr);
+    cc->budget = budget_bytes;
+    cc->num_buckets = 64;
+    while (cc->num_buckets < budget_bytes / sizeof(chunk)) {
+        cc->num_buckets *= 2;
+    }
+    cc->buckets = calloc(cc->num_buckets, sizeof(centry*));
+    return cc;
+}
+
+void chunkcache_free(chunkcache* cc) {
+    if (cc) {
+        while (cc->head) {
+            entry_remove(cc, cc->head);
+        }
+        pthread_mutex_destroy(&cc->lock);
+        pthread_cond_destroy(&cc->loaded);
+        free(cc->buckets);
+        free(cc);
+    }
+}
+
+const chunk* chunkcache_acquire(chunkcache* cc, s32 cz, s32 cy, s32 cx) {
+    if (cz < 0 || cy < 0 || cx < 0 || cz >= cc->grid[0] || cy >= cc->grid[1] || cx >= cc->grid[2]) {
+        return nullptr;
+    }
+
+    pthread_mutex_lock(&cc->lock);
+    centry* e = entry_find(cc, cz, cy, cx);
+    if (e) {
+        e->refs++;
+        cc->hits++;
+        lru_unlink(cc, e);
+        lru_push_front(cc, e);
+        while (!e->ready) {
+            pthread_cond_wait(&cc->loaded, &cc->lock);
+        }
+        pthread_mutex_unlock(&cc->lock);
+        return e->data;
+    }
+
+    // Make room from the cold end, skipping pinned and in-flight entries
+    centry* victim = cc->tail;
+    while (victim && cc->bytes + sizeof(chunk) > cc->budget) {
+        centry* prev = victim->prev;
+        if (victim->refs == 0 && victim->ready) {
+            entry_remove(cc, victim);
+        }
+        victim = prev;
+    }
+
+    e = calloc(1, sizeof(centry));
+    e->key[0] = cz;
+    e->key[1] = cy;
+    e->key[2] = cx;
+    e->refs = 1;
+    u32 b = ckey_hash(cz, cy, cx) & (cc->num_buckets - 1);
+    e->hnext = cc->buckets[b];
+    cc->buckets[b] = e;
+    lru_push_front(cc, e);
+    cc->bytes += sizeof(chunk);
+    cc->misses++;
+    pthread_mutex_unlock(&cc->lock);
+
+    chunk* data = load_chunk(cc, cz, cy, cx);
+
+    pthread_mutex_lock(&cc->lock);
+    e->data = data;
+    e->ready = true;
+    pthread_cond_broadcast(&cc->loaded);
+    pthread_mutex_unlock(&cc->lock);
+    return data;
+}
+
+void chunkcache_release(chunkcache* cc, s32 cz, s32 cy, s32 cx) {
+    pthread_mutex_lock(&cc->lock);
+    centry* e = entry_find(cc, cz, cy, cx);
+    ASSERT(e && e->refs > 0, "releasing a chunk that is not acquired\n");
+    if (e) e->refs--;
+    pthread_mutex_unlock(&cc->lock);
+}
+
+void chunkcache_grid(const chunkcache* cc, s32 grid[3]) {
+    memcpy(grid, cc->grid, sizeof(cc->grid));
+}
+
+void chunkcache_stats(chunkcache* cc, u64* hits, u64* misses) {
+    pthread_mutex_lock(&cc->lock);
+    *hits = cc->hits;
+    *misses = cc->misses;
+    pthread_mutex_unlock(&cc->lock);
+}
+
+typedef struct box_job {
+    chunkcache* cc;
+    const s32* lo;
+    volume* vol;
+} box_job;
+
+static void acquire_box_fn(void* ctx, s32 i) {
+    box_job* job = ctx;
+    const volume* vol = job->vol;
+    s32 z = i / (vol->y * vol->x), y = i / vol->x % vol->y, x = i % vol->x;
+    vol->refs[i] = chunkcache_acquire(job->cc, job->lo[0] + z, job->lo[1] + y, job->lo[2] + x);
+}
+
+void chunkcache_acquire_box(chunkcache* cc, const s32 lo[3], volume* vol) {
+    // Misses decode outside the lock, so the box loads in parallel on the pool
+    s32 count = vol->z * vol->y * vol->x;
+    vol->chunks = nullptr;
+    vol->refs = malloc(count * sizeof(chunk*));
+    box_job job = {.cc = cc, .lo = lo, .vol = vol};
+    parallel_for(count, acquire_box_fn, &job);
+}
+
+void chunkcache_release_box(chunkcache* cc, const s32 lo[3], volume* vol) {
+    for (s32 i = 0; i < vol->z * vol->y * vol->x; i++) {
+        if (!vol->refs[i]) continue;
+        chunkcache_release(cc, lo[0] + i / (vol->y * vol->x), lo[1] + i / vol->x % vol->y, lo[2] + i % vol->x);
+    }
+    free(vol->refs);
+    vol->refs = nullptr;
+}
@@ -0,0 +1,28 @@
+#include "vcr.h"
+
+// View frustum tests for chunk bounding boxes. The frustum planes come
+// straight out of the clip-from-model matrix.
+
+void frustum_from_matrix(frustum* f, const f32 m[16]) {
+    // Clip space keeps -w <= x, y, z <= w; plane i is row 3 plus or minus row i / 2
+    for (s32 p = 0; p < 6; p++) {
+        s32 row = p / 2;
+        f32 sign = p % 2 ? -1.0f : 1.0f;
+        for (s32 c = 0; c < 4; c++) {
+            f->planes[p][c] = m[c * 4 + 3] + sign * m[c * 4 + row];
+        }
+    }
+}
+
+bool frustum_test_box(const frustum* f, const f32 lo[3], const f32 hi[3]) {
+    for (s32 p = 0; p < 6; p++) {
+        const f32* n = f->planes[p];
+        // The corner farthest along the plane's normal
+        f32 d = n[3];
+        for (s32 i = 0; i < 3; i++) {
+            d += n[i] * (n[i] >= 0.0f ? hi[i] : lo[i]);
+        }
+        if (d < 0.0f) return false;
+    }
+    return true;
+}
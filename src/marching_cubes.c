@@ -346,223 +346,1099 @@ static float vertexInterp(float result[3], float isolevel,
     return mu;
 }
 
-// Generate triangles for a single cube with scale factor
-static int marchCube(float vertices[], float colors[], int* numVertices, 
-                    float x, float y, float z,
-                    float val[8], float isolevel, float scale) {
-    int cubeindex = 0;
+// Two-pass shared-vertex marching cubes.
+// Every lattice edge whose endpoints straddle the threshold gets exactly one
+// vertex, owned by the edge's lower voxel; a voxel owns its +x, +y and +z edges,
+// in that order. A counting pass records per voxel row how many vertices it
+// owns and per cell row how many triangles it produces (from triTable). Prefix
+// sums over the rows give every row its exact output offset, so the emit pass
+// writes into exactly sized buffers and each voxel layer can be emitted
+// independently of the others.
+// Both passes only walk bricks whose [min, max] span contains the threshold.
+// A crossing edge makes every cell around it mixed, so those cells all lie in
+// active bricks and skipping the rest never changes the output.
+// A chunk also meshes the cell layer between itself and its +x, +y and +z
+// neighbours, reading the neighbours' first voxel layer in place as a halo.
+// Gradients take forward differences on the faces, so the vertices two chunks
+// share on their common face come out identical in both meshes and nothing on
+// a chunk's - sides is ever read.
+
+typedef struct mc_job {
+    const u8* halo[27];        // the chunk's level (halo[13]) and its neighbours', see haloIndex
+    const u8* halo_bricks[27]; // their span-space indices, null when not built
+    const u8* voxels;          // halo[13]
+    int n;                     // voxels per side of a chunk at this level
+    int nv[3];                 // voxels read along z, y, x: n, plus the halo layers if that neighbour exists
+    mesh_algorithm algorithm;
+    int layers;                // work items: voxel layers (marching cubes) or cell layers (surface nets)
+    float scale;               // voxel spacing in chunk voxels
+    u8 iso;
+    const u8* num_tris;        // triangles per cube case
+    u32* row_verts;            // vertices of each voxel row (marching cubes) or cell row (surface nets),
+                               // then their offsets
+    u32* row_tris;             // triangles of each cell row (marching cubes) or voxel row (surface nets),
+                               // then their offsets
+    u32 total_vertices, total_triangles;
+    u8 (*layer_range)[2];      // [layers] min and max vertex value emitted by each layer
+    int num_bricks;            // bricks per side
+    u32* brick_masks;          // [num_bricks^2] active bricks along x of brick row (bz, by)
+    mesh* out;
+} mc_job;
+
+// Slot of the neighbour at offset (dz, dy, dx), each in -1..1, in mc_job.halo
+static inline int haloIndex(int dz, int dy, int dx) {
+    return (dz + 1) * 9 + (dy + 1) * 3 + dx + 1;
+}
+
+// Whether voxel (z, y, x) can be read: inside the chunk, or within one voxel
+// of it (two on the + side) in a neighbour that exists
+static bool mcHas(const mc_job* job, int z, int y, int x) {
+    int n = job->n;
+    if (z < -1 || y < -1 || x < -1 || z > n + 1 || y > n + 1 || x > n + 1) return false;
+    return job->halo[haloIndex(z < 0 ? -1 : z >= n, y < 0 ? -1 : y >= n, x < 0 ? -1 : x >= n)] != nullptr;
+}
+
+// Voxel (z, y, x) of the chunk's level; coordinates outside [0, n) read the
+// neighbour on that side, which mcHas says exists
+static inline u8 mcVoxel(const mc_job* job, int z, int y, int x) {
+    int n = job->n;
+    if ((unsigned)z < (unsigned)n && (unsigned)y < (unsigned)n && (unsigned)x < (unsigned)n) {
+        return job->voxels[((size_t)z * n + y) * n + x];
+    }
+    int dz = z < 0 ? -1 : z >= n, dy = y < 0 ? -1 : y >= n, dx = x < 0 ? -1 : x >= n;
+    const u8* v = job->halo[haloIndex(dz, dy, dx)];
+    return v[((size_t)(z - dz * n) * n + (y - dy * n)) * n + (x - dx * n)];
+}
+
+// Inclusive x ranges covered by the set bits of an active-brick mask, adjacent
+// bricks merged. Cell ranges are [b*B, b*B + B - 1]; voxel ranges reach one
+// further to include the corners the brick's cells share with the next brick.
+// The last brick also covers the halo, up to last.
+static int maskSpans(const mc_job* job, u32 mask, int extend, int last, int spans[][2]) {
+    int count = 0;
+    while (mask) {
+        int b = __builtin_ctz(mask);
+        int e = b;
+        while (e + 1 < 32 && (mask >> (e + 1)) & 1) e++;
+        mask &= e + 1 < 32 ? ~0u << (e + 1) : 0;
+        int hi = e == job->num_bricks - 1 ? last : (e + 1) * MESH_BRICK - 1 + extend;
+        spans[count][0] = b * MESH_BRICK;
+        spans[count][1] = hi < last ? hi : last;
+        count++;
+    }
+    return count;
+}
+
+// Active bricks along x of cell row (z, y); halo cells belong to the last brick
+static u32 cellRowMask(const mc_job* job, int z, int y) {
+    int nb = job->num_bricks;
+    int bz = z / MESH_BRICK < nb ? z / MESH_BRICK : nb - 1;
+    int by = y / MESH_BRICK < nb ? y / MESH_BRICK : nb - 1;
+    return job->brick_masks[bz * nb + by];
+}
+
+// Active bricks touching any cell that contains an edge owned by voxel row
+// (z, y): those cells lie in cell layers z - 1..z and cell rows y - 1..y
+static u32 voxelRowMask(const mc_job* job, int z, int y) {
+    int nb = job->num_bricks;
+    int bz0 = (z > 0 ? z - 1 : 0) / MESH_BRICK, bz1 = z / MESH_BRICK;
+    int by0 = (y > 0 ? y - 1 : 0) / MESH_BRICK, by1 = y / MESH_BRICK;
+    if (bz0 >= nb) bz0 = nb - 1;
+    if (bz1 >= nb) bz1 = nb - 1;
+    if (by0 >= nb) by0 = nb - 1;
+    if (by1 >= nb) by1 = nb - 1;
+    u32 mask = 0;
+    for (int bz = bz0; bz <= bz1; bz++) {
+        for (int by = by0; by <= by1; by++) {
+            mask |= job->brick_masks[bz * nb + by];
+        }
+    }
+    return mask;
+}
+
+// Whether brick (bz, by, bx) can contain surface. A brick on the + side of the
+// chunk also owns the halo cells, so its range is widened by the first bricks
+// of the neighbours it reaches into.
+static bool brickActive(const mc_job* job, int bz, int by, int bx) {
+    int nb = job->num_bricks;
+    int b[3] = {bz, by, bx};
+    u8 lo = 255, hi = 0;
+    for (int combo = 0; combo < 8; combo++) {
+        int d[3] = {combo >> 2 & 1, combo >> 1 & 1, combo & 1};
+        bool reaches = true;
+        for (int a = 0; a < 3; a++) {
+            if (d[a] && (b[a] != nb - 1 || job->nv[a] == job->n)) reaches = false;
+        }
+        if (!reaches) continue;
+        const u8* bricks = job->halo_bricks[haloIndex(d[0], d[1], d[2])];
+        if (!bricks) return true;  // no index to consult
+        const u8* r = &bricks[(((size_t)(d[0] ? 0 : bz) * nb + (d[1] ? 0 : by)) * nb + (d[2] ? 0 : bx)) * 2];
+        if (r[0] < lo) lo = r[0];
+        if (r[1] > hi) hi = r[1];
+    }
+    return lo < job->iso && hi >= job->iso;
+}
+
+// Classification works on 16-byte vectors: every compare maps to one SSE2 or
+// NEON instruction, where GCC splits wider vectors without AVX2 into scalar code.
+static inline u8x16 loadU8x16(const u8* p) {
+    u8x16 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static const u8x16 laneIndex = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+// Inside masks (0xff where voxel < iso, else 0) of voxel row (z, y)
+static void classifyRow(const mc_job* job, int z, int y, u8* in) {
+    int n = job->n;
+    int dz = z >= n, dy = y >= n;
+    const u8* src = &job->halo[haloIndex(dz, dy, 0)][((size_t)(z - dz * n) * n + (y - dy * n)) * n];
+    for (int x = 0; x < n; x += 16) {
+        u8x16 r = (u8x16)(loadU8x16(src + x) < job->iso);
+        memcpy(in + x, &r, sizeof(r));
+    }
+    for (int x = n; x < job->nv[2]; x++) {
+        in[x] = mcVoxel(job, z, y, x) < job->iso ? 0xff : 0;
+    }
+}
+
+// Case bytes of the cells of cell row y, from the inside masks of two voxel
+// layers (nv[1] rows of nv[2] voxels each). Returns false when every case is
+// 0 or 255, i.e. no cell of the row meets the surface.
+static bool rowCases(const u8* in, const int nv[3], int y, u8* cases) {
+    int nx = nv[2];
+    const u8* a = &in[(size_t)y * nx];
+    const u8* b = a + nx;
+    const u8* c = a + (size_t)nv[1] * nx;
+    const u8* d = c + nx;
+    int x = 0;
+    bool mixed = false;
+    if (nx - 1 >= 16) {
+        u8x16 any = {0};
+        for (int x0 = 0; x0 < nx - 1; x0 += 16) {
+            // The last vector overlaps the previous one instead of running past the row
+            x = x0 + 16 <= nx - 1 ? x0 : nx - 17;
+            u8x16 cs = (loadU8x16(a + x) & 1) | (loadU8x16(a + x + 1) & 2) |
+                       (loadU8x16(b + x + 1) & 4) | (loadU8x16(b + x) & 8) |
+                       (loadU8x16(c + x) & 16) | (loadU8x16(c + x + 1) & 32) |
+                       (loadU8x16(d + x + 1) & 64) | (loadU8x16(d + x) & 128);
+            memcpy(cases + x, &cs, sizeof(cs));
+            any |= ~((u8x16)(cs == 0) | (u8x16)(cs == 0xff));
+        }
+        u64 lanes[2];
+        memcpy(lanes, &any, sizeof(any));
+        mixed = (lanes[0] | lanes[1]) != 0;
+        x = nx - 1;
+    }
+    for (; x < nx - 1; x++) {
+        u8 cs = (a[x] & 1) | (a[x + 1] & 2) | (b[x + 1] & 4) | (b[x] & 8) |
+                (c[x] & 16) | (c[x + 1] & 32) | (d[x + 1] & 64) | (d[x] & 128);
+        cases[x] = cs;
+        mixed |= cs != 0 && cs != 0xff;
+    }
+    return mixed;
+}
+
+// Crossing edges owned by voxel row (z, y), with in holding layers z and z + 1.
+// Lanes past the end of the row are masked off; in must have 16 bytes of
+// padding after the layers it holds for those loads.
+static u32 rowCrossings(const u8* in, const int nv[3], int z, int y) {
+    int nx = nv[2];
+    const u8* a = &in[(size_t)y * nx];
+    const u8* b = a + nx;
+    const u8* c = a + (size_t)nv[1] * nx;
+    bool ny = y + 1 < nv[1], nz = z + 1 < nv[0];
+    u8x16 acc = {0};
+    for (int x = 0; x < nx; x += 16) {
+        u8x16 voxels = (u8x16)(laneIndex < (u8)(nx - x));         // lanes inside the row
+        u8x16 x_edges = (u8x16)(laneIndex < (u8)(nx - 1 - x));    // lanes with a +x neighbour
+        u8x16 a0 = loadU8x16(a + x);
+        acc += (a0 ^ loadU8x16(a + x + 1)) & x_edges & 1;
+        if (ny) acc += (a0 ^ loadU8x16(b + x)) & voxels & 1;
+        if (nz) acc += (a0 ^ loadU8x16(c + x)) & voxels & 1;
+    }
+    u32 count = 0;
+    for (int i = 0; i < 16; i++) {
+        count += acc[i];
+    }
+    return count;
+}
+
+// Inside masks of layers z and z + 1, classifying only the rows around active
+// bricks; the others are never read. Returns null when no brick touching the
+// layer is active.
+static u8* classifyLayers(const mc_job* job, int z) {
+    const int* nv = job->nv;
+    bool need[CHUNK_LEN + 3] = {0};
+    bool any = false;
+    for (int y = 0; y < nv[1]; y++) {
+        // Rows y and y + 1 hold the +y edges of row y and the corners of cell row y
+        if (voxelRowMask(job, z, y)) {
+            need[y] = need[y + 1] = any = true;
+        }
+    }
+    if (!any) return nullptr;
     
-    // Determine cube configuration
-    if (val[0] < isolevel) cubeindex |= 1;
-    if (val[1] < isolevel) cubeindex |= 2;
-    if (val[2] < isolevel) cubeindex |= 4;
-    if (val[3] < isolevel) cubeindex |= 8;
-    if (val[4] < isolevel) cubeindex |= 16;
-    if (val[5] < isolevel) cubeindex |= 32;
-    if (val[6] < isolevel) cubeindex |= 64;
-    if (val[7] < isolevel) cubeindex |= 128;
+    size_t plane = (size_t)nv[1] * nv[2];
+    u8* in = calloc(2 * plane + 16, 1);
+    for (int y = 0; y < nv[1]; y++) {
+        if (!need[y]) continue;
+        classifyRow(job, z, y, &in[(size_t)y * nv[2]]);
+        if (z + 1 < nv[0]) classifyRow(job, z + 1, y, &in[plane + (size_t)y * nv[2]]);
+    }
+    return in;
+}
+
+static void countLayer(void* ctx, s32 z) {
+    mc_job* job = ctx;
+    const int* nv = job->nv;
+    u8* in = classifyLayers(job, z);
+    if (!in) {
+        // No brick around the layer spans the threshold
+        memset(&job->row_verts[z * nv[1]], 0, nv[1] * sizeof(u32));
+        if (z < nv[0] - 1) memset(&job->row_tris[z * (nv[1] - 1)], 0, (nv[1] - 1) * sizeof(u32));
+        return;
+    }
+    for (int y = 0; y < nv[1]; y++) {
+        job->row_verts[z * nv[1] + y] = voxelRowMask(job, z, y) ? rowCrossings(in, nv, z, y) : 0;
+    }
+    if (z < nv[0] - 1) {
+        u8 cases[CHUNK_LEN + 1];
+        int spans[32][2];
+        for (int y = 0; y < nv[1] - 1; y++) {
+            u32 tris = 0;
+            u32 mask = cellRowMask(job, z, y);
+            if (mask && rowCases(in, nv, y, cases)) {
+                int num_spans = maskSpans(job, mask, 0, nv[2] - 2, spans);
+                for (int s = 0; s < num_spans; s++) {
+                    for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+                        tris += job->num_tris[cases[x]];
+                    }
+                }
+            }
+            job->row_tris[z * (nv[1] - 1) + y] = tris;
+        }
+    }
+    free(in);
+}
+
+// Octahedral encode: project onto |x| + |y| + |z| = 1 and fold the lower
+// hemisphere over the diagonals, see mesh_vertex_normal
+static void octEncode(const float n[3], s8 out[2]) {
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 < 1e-20f) {
+        out[0] = out[1] = 0;  // degenerate; decodes to +z
+        return;
+    }
+    float x = n[0] / l1, y = n[1] / l1;
+    if (n[2] < 0.0f) {
+        float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    out[0] = (s8)lrintf(x * 127.0f);
+    out[1] = (s8)lrintf(y * 127.0f);
+}
+
+// Central-difference gradient of the sampled field at a voxel, reaching into
+// the + side neighbours where they exist and one-sided where they do not. On
+// the planes between chunks (coordinate 0 or n) it is a forward difference,
+// which both chunks sharing the plane take from the same voxels. So a chunk's
+// mesh never reads its - side neighbours, and seam vertices get the same
+// normal from either side.
+static void voxelGradient(const mc_job* job, int z, int y, int x, float g[3]) {
+    int n = job->n;
+    int x0 = x % n == 0 ? x : x - 1, x1 = mcHas(job, z, y, x + 1) ? x + 1 : x;
+    int y0 = y % n == 0 ? y : y - 1, y1 = mcHas(job, z, y + 1, x) ? y + 1 : y;
+    int z0 = z % n == 0 ? z : z - 1, z1 = mcHas(job, z + 1, y, x) ? z + 1 : z;
+    g[0] = (float)(mcVoxel(job, z, y, x1) - mcVoxel(job, z, y, x0)) / (x1 - x0);
+    g[1] = (float)(mcVoxel(job, z, y1, x) - mcVoxel(job, z, y0, x)) / (y1 - y0);
+    g[2] = (float)(mcVoxel(job, z1, y, x) - mcVoxel(job, z0, y, x)) / (z1 - z0);
+}
+
+static void layerSlots(const mc_job* job, int z, s32* xs, s32* ys, s32* zs, bool emit) {
+    const int* nv = job->nv;
+    u8 iso = job->iso;
+    float isolevel = (float)iso;
+    mesh_vertex* vertices = job->out->vertices;
+    u8 lo = 255, hi = 0;
     
-    // Cube is entirely inside or outside
-    if (edgeTable[cubeindex] == 0)
-        return 0;
+    for (int y = 0; y < nv[1]; y++) {
+        size_t row = (size_t)z * nv[1] + y;
+        u32 v = job->row_verts[row];
+        u32 end = row + 1 < (size_t)nv[0] * nv[1] ? job->row_verts[row + 1] : job->total_vertices;
+        if (v == end) continue;  // no edge of this row crosses the surface
+        // Same traversal order as countLayer, so indices match the offsets
+        int spans[32][2];
+        int num_spans = maskSpans(job, voxelRowMask(job, z, y), 1, nv[2] - 1, spans);
+        for (int s = 0; s < num_spans; s++)
+        for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+            u8 a = mcVoxel(job, z, y, x);
+            for (int axis = 0; axis < 3; axis++) {
+                int dx = axis == 0, dy = axis == 1, dz = axis == 2;
+                if (x + dx >= nv[2] || y + dy >= nv[1] || z + dz >= nv[0]) continue;
+                u8 b = mcVoxel(job, z + dz, y + dy, x + dx);
+                if ((a < iso) == (b < iso)) continue;
+                
+                s32* slots = axis == 0 ? xs : axis == 1 ? ys : zs;
+                if (slots) slots[y * nv[2] + x] = (s32)v;
+                if (emit) {
+                    float p1[3] = {0.0f, 0.0f, 0.0f};
+                    float p2[3] = {(float)dx, (float)dy, (float)dz};
+                    float p[3];
+                    float mu = vertexInterp(p, isolevel, p1, p2, (float)a, (float)b);
+                    mesh_vertex* mv = &vertices[v];
+                    *mv = (mesh_vertex){0};
+                    // Whole voxels and the fraction are quantized apart, so a chunk and its
+                    // neighbour round a shared vertex the same way
+                    int step = (int)job->scale << MESH_POS_FRAC;
+                    int voxel[3] = {x, y, z};
+                    for (int i = 0; i < 3; i++) {
+                        mv->pos[i] = (u16)(voxel[i] * step + lrintf(p[i] * step));
+                    }
+                    // The normal is the gradient interpolated along the edge, negated
+                    // to face away from the brighter side like the triangle winding
+                    float g1[3], g2[3], normal[3];
+                    voxelGradient(job, z, y, x, g1);
+                    voxelGradient(job, z + dz, y + dy, x + dx, g2);
+                    for (int i = 0; i < 3; i++) {
+                        normal[i] = -(g1[i] + mu * (g2[i] - g1[i]));
+                    }
+                    octEncode(normal, mv->normal);
+                    // The mean of the edge's endpoint values
+                    mv->value = (u8)((a + b) / 2);
+                    if (mv->value < lo) lo = mv->value;
+                    if (mv->value > hi) hi = mv->value;
+                }
+                v++;
+            }
+        }
+    }
+    if (emit) {
+        job->layer_range[z][0] = lo;
+        job->layer_range[z][1] = hi;
+    }
+}
+
+// Emit the vertices owned by voxel layer z and the triangles of cell layer z.
+// The cell layer's edges sit in voxel layers z and z + 1; only the first is
+// written here, the second belongs to the next layer's work item.
+static void emitLayer(void* ctx, s32 z) {
+    mc_job* job = ctx;
+    const int* nv = job->nv;
+    size_t plane = (size_t)nv[1] * nv[2];
+    s32* slots = malloc(5 * plane * sizeof(s32));
+    s32* xs[2] = {slots, slots + plane};
+    s32* ys[2] = {slots + 2 * plane, slots + 3 * plane};
+    s32* zs = slots + 4 * plane;
     
-    // Find vertices where surface intersects edges
-    float vertlist[12][3];
-    float vertcolors[12];  // Store interpolated color values
-    float p1[3], p2[3];
+    layerSlots(job, z, xs[0], ys[0], zs, true);
+    if (z + 1 < nv[0]) {
+        layerSlots(job, z + 1, xs[1], ys[1], nullptr, false);
+        
+        u32* indices = job->out->indices;
+        u8* in = classifyLayers(job, z);
+        u8 cases[CHUNK_LEN + 1];
+        size_t num_rows = (size_t)(nv[0] - 1) * (nv[1] - 1);
+        for (int y = 0; y < nv[1] - 1; y++) {
+            size_t row = (size_t)z * (nv[1] - 1) + y;
+            u32 t = job->row_tris[row];
+            u32 end = row + 1 < num_rows ? job->row_tris[row + 1] : job->total_triangles;
+            if (t == end) continue;
+            rowCases(in, nv, y, cases);
+            int spans[32][2];
+            int num_spans = maskSpans(job, cellRowMask(job, z, y), 0, nv[2] - 2, spans);
+            for (int s = 0; s < num_spans; s++)
+            for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+                int cubeindex = cases[x];
+                if (job->num_tris[cubeindex] == 0) continue;
+                
+                s32 vertlist[12];
+                for (int i = 0; i < 12; i++) {
+                    if (!(edgeTable[cubeindex] & (1 << i))) continue;
+                    // The edge's lower corner and direction decide its slot
+                    int v1 = edgeConnection[i][0];
+                    int v2 = edgeConnection[i][1];
+                    if (vertexOffset[v1][0] + vertexOffset[v1][1] + vertexOffset[v1][2] >
+                        vertexOffset[v2][0] + vertexOffset[v2][1] + vertexOffset[v2][2]) {
+                        int tmp = v1; v1 = v2; v2 = tmp;
+                    }
+                    int ox = x + (int)vertexOffset[v1][0];
+                    int oy = y + (int)vertexOffset[v1][1];
+                    int layer = (int)vertexOffset[v1][2];
+                    size_t at = (size_t)oy * nv[2] + ox;
+                    if (vertexOffset[v2][0] != vertexOffset[v1][0]) vertlist[i] = xs[layer][at];
+                    else if (vertexOffset[v2][1] != vertexOffset[v1][1]) vertlist[i] = ys[layer][at];
+                    else vertlist[i] = zs[at];
+                }
+                
+                for (int i = 0; triTable[cubeindex][i] != -1; i += 3) {
+                    indices[t * 3 + 0] = (u32)vertlist[triTable[cubeindex][i]];
+                    indices[t * 3 + 1] = (u32)vertlist[triTable[cubeindex][i + 1]];
+                    indices[t * 3 + 2] = (u32)vertlist[triTable[cubeindex][i + 2]];
+                    t++;
+                }
+            }
+        }
+        free(in);
+    }
+    free(slots);
+}
+
+// Naive surface nets.
+// Every cell that meets the surface gets one vertex, at the mean of its edge
+// crossings, and every crossing edge a quad joining the four cells around it.
+// Classification, brick skipping and halo reads are the marching-cubes ones.
+// Cells reach one layer into the + neighbours (two halo voxels), and a chunk
+// owns the edges whose voxel lies in [0, n) along the edge and in [1, n]
+// across it, so the four cells of every quad it emits are its own and each
+// edge belongs to exactly one chunk. The vertices of the cell layer two chunks
+// share are computed from the same eight voxels in both meshes.
+// Rows are swapped relative to marching cubes: row_verts counts cell rows and
+// row_tris voxel rows, both (nv[0] - 1) * (nv[1] - 1) long.
+
+// Vertex of the mixed cell (z, y, x); the normal is the negated gradient of
+// the trilinear field at the vertex, which only depends on the cell's corners
+static void netVertex(const mc_job* job, int z, int y, int x, mesh_vertex* mv) {
+    float c[8];  // corner (dz, dy, dx) at bit 2, 1, 0
+    for (int i = 0; i < 8; i++) {
+        c[i] = mcVoxel(job, z + (i >> 2 & 1), y + (i >> 1 & 1), x + (i & 1));
+    }
+    float iso = job->iso;
+    float f[3] = {0};  // x, y, z within the cell
+    float value = 0.0f;
+    int crossings = 0;
+    for (int i = 0; i < 8; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            int j = i | 1 << axis;
+            if (j == i || (c[i] < iso) == (c[j] < iso)) continue;
+            float mu = (iso - c[i]) / (c[j] - c[i]);
+            for (int k = 0; k < 3; k++) {
+                f[k] += k == axis ? mu : (float)(i >> k & 1);
+            }
+            value += (c[i] + c[j]) / 2;
+            crossings++;
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        f[k] /= crossings;
+    }
     
-    // Compute edge intersections - apply scale to all vertex positions
-    for (int i = 0; i < 12; i++) {
-        if (edgeTable[cubeindex] & (1 << i)) {
-            int v1 = edgeConnection[i][0];
-            int v2 = edgeConnection[i][1];
-            p1[0] = x + vertexOffset[v1][0] * scale;
-            p1[1] = y + vertexOffset[v1][1] * scale;
-            p1[2] = z + vertexOffset[v1][2] * scale;
-            p2[0] = x + vertexOffset[v2][0] * scale;
-            p2[1] = y + vertexOffset[v2][1] * scale;
-            p2[2] = z + vertexOffset[v2][2] * scale;
-            vertexInterp(vertlist[i], isolevel, p1, p2, val[v1], val[v2]);
-            // For coloring, use the average of the two endpoint values
-            // This gives variation across the surface
-            vertcolors[i] = (val[v1] + val[v2]) * 0.5f;
+    float g[3] = {0};
+    for (int i = 0; i < 8; i++) {
+        float w[3];
+        for (int k = 0; k < 3; k++) {
+            w[k] = i >> k & 1 ? f[k] : 1.0f - f[k];
+        }
+        for (int k = 0; k < 3; k++) {
+            // d/dk of the corner's weight: its weight with the k factor replaced by -1 or +1
+            float dw = (i >> k & 1 ? 1.0f : -1.0f) * w[(k + 1) % 3] * w[(k + 2) % 3];
+            g[k] -= dw * c[i];
         }
     }
     
-    // Generate triangles
-    int nTriangles = 0;
-    for (int i = 0; triTable[cubeindex][i] != -1; i += 3) {
-        int idx = *numVertices * 3;
-        
-        // First vertex
-        vertices[idx + 0] = vertlist[triTable[cubeindex][i]][0];
-        vertices[idx + 1] = vertlist[triTable[cubeindex][i]][1];
-        vertices[idx + 2] = vertlist[triTable[cubeindex][i]][2];
-        
-        // Second vertex
-        vertices[idx + 3] = vertlist[triTable[cubeindex][i + 1]][0];
-        vertices[idx + 4] = vertlist[triTable[cubeindex][i + 1]][1];
-        vertices[idx + 5] = vertlist[triTable[cubeindex][i + 1]][2];
-        
-        // Third vertex
-        vertices[idx + 6] = vertlist[triTable[cubeindex][i + 2]][0];
-        vertices[idx + 7] = vertlist[triTable[cubeindex][i + 2]][1];
-        vertices[idx + 8] = vertlist[triTable[cubeindex][i + 2]][2];
-        
-        // Get voxel values as u8 for colormap
-        u8 v1 = (u8)vertcolors[triTable[cubeindex][i]];
-        u8 v2 = (u8)vertcolors[triTable[cubeindex][i + 1]];
-        u8 v3 = (u8)vertcolors[triTable[cubeindex][i + 2]];
-        
-        // Apply viridis colormap
-        rgb col1 = apply_viridis_colormap(v1);
-        rgb col2 = apply_viridis_colormap(v2);
-        rgb col3 = apply_viridis_colormap(v3);
+    *mv = (mesh_vertex){.value = (u8)(value / crossings)};
+    int step = (int)job->scale << MESH_POS_FRAC;
+    int cell[3] = {x, y, z};
+    for (int k = 0; k < 3; k++) {
+        mv->pos[k] = (u16)(cell[k] * step + lrintf(f[k] * step));
+    }
+    octEncode(g, mv->normal);
+}
+
+// Vertex indices of the mixed cells of cell layer z into slots, from the inside
+// masks of layers z and z + 1. The vertices go to the mesh, or with copies set
+// only into copies, indexed like slots.
+static void netSlots(const mc_job* job, int z, const u8* in, s32* slots, mesh_vertex* copies) {
+    const int* nv = job->nv;
+    int nc = nv[2] - 1;
+    u8 lo = 255, hi = 0;
+    u8 cases[CHUNK_LEN + 2];
+    size_t num_rows = (size_t)(nv[0] - 1) * (nv[1] - 1);
+    for (int y = 0; y < nv[1] - 1; y++) {
+        size_t row = (size_t)z * (nv[1] - 1) + y;
+        u32 v = job->row_verts[row];
+        u32 end = row + 1 < num_rows ? job->row_verts[row + 1] : job->total_vertices;
+        if (v == end) continue;
+        rowCases(in, nv, y, cases);
+        int spans[32][2];
+        int num_spans = maskSpans(job, cellRowMask(job, z, y), 0, nv[2] - 2, spans);
+        for (int s = 0; s < num_spans; s++)
+        for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+            if (cases[x] == 0 || cases[x] == 0xff) continue;
+            slots[y * nc + x] = (s32)v;
+            mesh_vertex* mv = copies ? &copies[y * nc + x] : &job->out->vertices[v];
+            netVertex(job, z, y, x, mv);
+            if (mv->value < lo) lo = mv->value;
+            if (mv->value > hi) hi = mv->value;
+            v++;
+        }
+    }
+    if (!copies) {
+        job->layer_range[z][0] = lo;
+        job->layer_range[z][1] = hi;
+    }
+}
+
+// Axes (bit 0 = x, 1 = y, 2 = z) of the crossing edges voxel (z, y, x) owns,
+// from the inside masks of layers z and z + 1
+static int netEdges(const mc_job* job, const u8* in, int z, int y, int x) {
+    const int* nv = job->nv;
+    int p[3] = {x, y, z};
+    int len[3] = {nv[2], nv[1], nv[0]};
+    const u8* a = &in[(size_t)y * nv[2] + x];
+    u8 other[3] = {a[1], a[nv[2]], a[(size_t)nv[1] * nv[2]]};
+    int axes = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        bool owned = p[axis] < job->n && p[axis] + 1 < len[axis];
+        for (int k = 1; k < 3; k++) {
+            int b = (axis + k) % 3;
+            owned &= p[b] >= 1 && p[b] <= len[b] - 2;
+        }
+        if (owned && a[0] != other[axis]) axes |= 1 << axis;
+    }
+    return axes;
+}
+
+static void netCountLayer(mc_job* job, s32 z) {
+    const int* nv = job->nv;
+    size_t rows = nv[1] - 1;
+    u8* in = classifyLayers(job, z);
+    if (!in) {
+        memset(&job->row_verts[z * rows], 0, rows * sizeof(u32));
+        memset(&job->row_tris[z * rows], 0, rows * sizeof(u32));
+        return;
+    }
+    u8 cases[CHUNK_LEN + 2];
+    int spans[32][2];
+    for (int y = 0; y < nv[1] - 1; y++) {
+        u32 verts = 0;
+        u32 mask = cellRowMask(job, z, y);
+        if (mask && rowCases(in, nv, y, cases)) {
+            int num_spans = maskSpans(job, mask, 0, nv[2] - 2, spans);
+            for (int s = 0; s < num_spans; s++) {
+                for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+                    verts += cases[x] != 0 && cases[x] != 0xff;
+                }
+            }
+        }
+        job->row_verts[z * rows + y] = verts;
         
-        // Store colors (convert to 0-1 range)
-        colors[idx + 0] = col1.r / 255.0f; colors[idx + 1] = col1.g / 255.0f; colors[idx + 2] = col1.b / 255.0f;
-        colors[idx + 3] = col2.r / 255.0f; colors[idx + 4] = col2.g / 255.0f; colors[idx + 5] = col2.b / 255.0f;
-        colors[idx + 6] = col3.r / 255.0f; colors[idx + 7] = col3.g / 255.0f; colors[idx + 8] = col3.b / 255.0f;
+        u32 tris = 0;
+        int num_spans = maskSpans(job, voxelRowMask(job, z, y), 1, nv[2] - 2, spans);
+        for (int s = 0; s < num_spans; s++) {
+            for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+                tris += 2 * __builtin_popcount(netEdges(job, in, z, y, x));
+            }
+        }
+        job->row_tris[z * rows + y] = tris;
+    }
+    free(in);
+}
+
+// Emit the vertices of cell layer z and the quads of the edges voxel layer z
+// owns. Those also reach into cell layer z - 1, whose vertices another work
+// item writes, so its slots and positions are recomputed here.
+static void netEmitLayer(mc_job* job, s32 z) {
+    const int* nv = job->nv;
+    int nc = nv[2] - 1;
+    size_t cells = (size_t)(nv[1] - 1) * nc;
+    s32* slots = malloc(2 * cells * sizeof(s32));
+    mesh_vertex* below = malloc(cells * sizeof(mesh_vertex));
+    u8* in = classifyLayers(job, z);
+    if (!in) {
+        // No vertex in this layer: an empty range, which the reduction passes over
+        job->layer_range[z][0] = 255;
+        job->layer_range[z][1] = 0;
+    }
+    if (z > 0 && in) {
+        u8* prev = classifyLayers(job, z - 1);
+        if (prev) netSlots(job, z - 1, prev, slots, below);
+        free(prev);
+    }
+    if (in) {
+        netSlots(job, z, in, slots + cells, nullptr);
         
-        *numVertices += 3;
-        nTriangles++;
+        size_t num_rows = (size_t)(nv[0] - 1) * (nv[1] - 1);
+        for (int y = 0; y < nv[1] - 1; y++) {
+            size_t row = (size_t)z * (nv[1] - 1) + y;
+            u32 t = job->row_tris[row];
+            u32 end = row + 1 < num_rows ? job->row_tris[row + 1] : job->total_triangles;
+            if (t == end) continue;
+            int spans[32][2];
+            int num_spans = maskSpans(job, voxelRowMask(job, z, y), 1, nv[2] - 2, spans);
+            for (int s = 0; s < num_spans; s++)
+            for (int x = spans[s][0]; x <= spans[s][1]; x++) {
+                int axes = netEdges(job, in, z, y, x);
+                bool inside = in[(size_t)y * nv[2] + x] != 0;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (!(axes >> axis & 1)) continue;
+                    // The four cells around the edge, counter-clockwise about +axis
+                    int b = (axis + 1) % 3, c = (axis + 2) % 3;
+                    s32 quad[4];
+                    float p[4][3];
+                    for (int q = 0; q < 4; q++) {
+                        int cell[3] = {x, y, z};
+                        cell[b] -= q == 0 || q == 3;
+                        cell[c] -= q == 0 || q == 1;
+                        size_t at = (size_t)cell[1] * nc + cell[0];
+                        quad[q] = slots[(cell[2] - z + 1) * cells + at];
+                        const mesh_vertex* mv = cell[2] == z ? &job->out->vertices[quad[q]] : &below[at];
+                        for (int k = 0; k < 3; k++) p[q][k] = mv->pos[k];
+                    }
+                    // Split along the shorter diagonal
+                    float d02 = 0.0f, d13 = 0.0f;
+                    for (int k = 0; k < 3; k++) {
+                        d02 += (p[0][k] - p[2][k]) * (p[0][k] - p[2][k]);
+                        d13 += (p[1][k] - p[3][k]) * (p[1][k] - p[3][k]);
+                    }
+                    static const int split[2][6] = {{0, 1, 2, 0, 2, 3}, {0, 1, 3, 1, 2, 3}};
+                    const int* order = split[d13 < d02];
+                    u32* indices = &job->out->indices[t * 3];
+                    for (int i = 0; i < 6; i++) {
+                        // Wind like marching cubes, reversing the triangles when the edge
+                        // starts inside the surface
+                        int k = inside ? order[i - i % 3 + 2 - i % 3] : order[i];
+                        indices[i] = (u32)quad[k];
+                    }
+                    t += 2;
+                }
+            }
+        }
     }
-    
-    return nTriangles;
+    free(in);
+    free(slots);
+    free(below);
 }
 
-mesh generate_mesh_from_chunk(const chunk* volume_data, u8 iso_threshold) {
-    mesh result = {0};
-    
-    if (!volume_data) return result;
-    
-    // First, downsample the volume to 64x64x64
-    const int LOD_SIZE = 64;
-    u8 downsampled[LOD_SIZE][LOD_SIZE][LOD_SIZE];
-    
-    // Simple box filter downsampling (average 2x2x2 blocks)
-    for (int z = 0; z < LOD_SIZE; z++) {
-        for (int y = 0; y < LOD_SIZE; y++) {
-            for (int x = 0; x < LOD_SIZE; x++) {
-                // Sample the 2x2x2 block
-                int sum = 0;
-                for (int dz = 0; dz < 2; dz++) {
-                    for (int dy = 0; dy < 2; dy++) {
-                        for (int dx = 0; dx < 2; dx++) {
-                            sum += (*volume_data)[z*2 + dz][y*2 + dy][x*2 + dx];
+// Exclusive prefix sum in place, returning the total
+static u32 prefixSum(u32* counts, size_t len) {
+    u32 total = 0;
+    for (size_t i = 0; i < len; i++) {
+        u32 c = counts[i];
+        counts[i] = total;
+        total += c;
+    }
+    return total;
+}
+
+// (min, max) over the voxels of each brick, including the corners it shares with
+// the next brick along every axis
+static u8* buildBricks(const u8* voxels, int n) {
+    int nb = n / MESH_BRICK;
+    u8* bricks = malloc((size_t)nb * nb * nb * 2);
+    for (int bz = 0; bz < nb; bz++) {
+        for (int by = 0; by < nb; by++) {
+            for (int bx = 0; bx < nb; bx++) {
+                int z1 = bz * MESH_BRICK + MESH_BRICK < n ? bz * MESH_BRICK + MESH_BRICK : n - 1;
+                int y1 = by * MESH_BRICK + MESH_BRICK < n ? by * MESH_BRICK + MESH_BRICK : n - 1;
+                int x1 = bx * MESH_BRICK + MESH_BRICK < n ? bx * MESH_BRICK + MESH_BRICK : n - 1;
+                u8 lo = 255, hi = 0;
+                for (int z = bz * MESH_BRICK; z <= z1; z++) {
+                    for (int y = by * MESH_BRICK; y <= y1; y++) {
+                        const u8* row = &voxels[((size_t)z * n + y) * n];
+                        for (int x = bx * MESH_BRICK; x <= x1; x++) {
+                            if (row[x] < lo) lo = row[x];
+                            if (row[x] > hi) hi = row[x];
                         }
                     }
                 }
-                downsampled[z][y][x] = sum / 8;  // Average of 8 voxels
+                u8* b = &bricks[(((size_t)bz * nb + by) * nb + bx) * 2];
+                b[0] = lo;
+                b[1] = hi;
             }
         }
     }
-    
-    int max_vertices = LOD_SIZE * LOD_SIZE * LOD_SIZE * 15;
-    float* vertices = malloc(max_vertices * 3 * sizeof(float));
-    float* colors = malloc(max_vertices * 3 * sizeof(float));
-    int num_vertices = 0;
-    
-    float isolevel = (float)iso_threshold;
-    
-    // March through the downsampled volume
-    for (int z = 0; z < LOD_SIZE - 1; z++) {
-        for (int y = 0; y < LOD_SIZE - 1; y++) {
-            for (int x = 0; x < LOD_SIZE - 1; x++) {
-                float val[8];
-                val[0] = (float)downsampled[z][y][x];
-                val[1] = (float)downsampled[z][y][x+1];
-                val[2] = (float)downsampled[z][y+1][x+1];
-                val[3] = (float)downsampled[z][y+1][x];
-                val[4] = (float)downsampled[z+1][y][x];
-                val[5] = (float)downsampled[z+1][y][x+1];
-                val[6] = (float)downsampled[z+1][y+1][x+1];
-                val[7] = (float)downsampled[z+1][y+1][x];
-                
-                // Generate triangles for this cube, but scale coordinates back up by 2
-                marchCube(vertices, colors, &num_vertices, 
-                         (float)x * 2.0f, (float)y * 2.0f, (float)z * 2.0f, val, isolevel, 2.0f);
-                
-                // Check if we're running out of space
-                if (num_vertices > max_vertices - 15) {
-                    LOG_WARN("Marching cubes: vertex buffer full, stopping early\n");
-                    goto done;
+    return bricks;
+}
+
+void chunklods_build(chunklods* lods, const chunk* c) {
+    lods->levels[0] = nullptr;
+    const u8* src = &(*c)[0][0][0];
+    lods->bricks[0] = buildBricks(src, CHUNK_LEN);
+    for (s32 l = 1; l <= MESH_MAX_LOD; l++) {
+        // Each level is a 2x2x2 box filter of the one above it
+        s32 n = CHUNK_LEN >> l;
+        s32 sn = n * 2;
+        u8* dst = malloc((size_t)n * n * n);
+        for (s32 z = 0; z < n; z++) {
+            for (s32 y = 0; y < n; y++) {
+                for (s32 x = 0; x < n; x++) {
+                    const u8* p = &src[((2 * z) * sn + 2 * y) * sn + 2 * x];
+                    s32 sum = p[0] + p[1] + p[sn] + p[sn + 1] +
+                              p[sn * sn] + p[sn * sn + 1] + p[sn * sn + sn] + p[sn * sn + sn + 1];
+                    dst[(z * n + y) * n + x] = (u8)(sum / 8);
                 }
             }
         }
+        lods->levels[l] = dst;
+        lods->bricks[l] = buildBricks(dst, n);
+        src = dst;
+    }
+}
+
+void chunklods_free(chunklods* lods) {
+    if (lods) {
+        for (s32 l = 0; l <= MESH_MAX_LOD; l++) {
+            free(lods->levels[l]);
+            free(lods->bricks[l]);
+            lods->levels[l] = nullptr;
+            lods->bricks[l] = nullptr;
+        }
+    }
+}
+
+// Meshes a batch of chunks at one level of detail and one or more isovalues.
+// The count and emit passes each run as a single parallel_for over (chunk,
+// layer) items, so a few large chunks and many small ones both keep every
+// core busy. An item runs the layer for every isovalue back to back: the
+// layer's voxels come from memory once and are re-read from cache for the
+// other surfaces, and the downsampled levels and halo are shared as well.
+// Every output offset comes from the counts, so the result is identical for
+// any thread count.
+typedef struct mc_batch {
+    const chunk* const* chunks;     // every chunk the batch reads
+    const chunklods* const* lods;   // null or one per chunk, entries may be null
+    const s32* neighbors;           // null or 27 per meshed chunk, indices into chunks or -1, see haloIndex
+    chunklods* scratch;
+    const u8** levels;              // per chunk: its voxels at the meshing level
+    const u8** bricks;              // per chunk: its span-space index at that level, or null
+    s32 lod;
+    mc_job* jobs;                   // count * num_isos: the first count chunks, isovalues innermost
+    int count;
+    int num_isos;
+    int layers;                     // work items per chunk: n + 1, the most layers a job can have
+} mc_batch;
+
+static void prepareChunk(void* ctx, s32 i) {
+    mc_batch* batch = ctx;
+    // Mesh directly on the requested level: the chunk itself at full
+    // resolution, otherwise its pre-downsampled copy
+    const chunklods* lods = batch->lods ? batch->lods[i] : nullptr;
+    batch->levels[i] = &(*batch->chunks[i])[0][0][0];
+    if (batch->lod > 0) {
+        if (!lods || !lods->levels[batch->lod]) {
+            chunklods_build(&batch->scratch[i], batch->chunks[i]);
+            lods = &batch->scratch[i];
+        }
+        batch->levels[i] = lods->levels[batch->lod];
+    }
+    batch->bricks[i] = lods ? lods->bricks[batch->lod] : nullptr;
+}
+
+static void prepareJob(void* ctx, s32 j) {
+    mc_batch* batch = ctx;
+    mc_job* job = &batch->jobs[j];
+    s32 i = j / batch->num_isos;
+    for (int h = 0; h < 27; h++) {
+        s32 c = h == haloIndex(0, 0, 0) ? i : batch->neighbors ? batch->neighbors[i * 27 + h] : -1;
+        job->halo[h] = c >= 0 ? batch->levels[c] : nullptr;
+        job->halo_bricks[h] = c >= 0 ? batch->bricks[c] : nullptr;
     }
+    job->voxels = job->halo[haloIndex(0, 0, 0)];
+    int halo = job->algorithm == MESH_SURFACE_NETS ? 2 : 1;
+    job->nv[0] = job->n + (job->halo[haloIndex(1, 0, 0)] ? halo : 0);
+    job->nv[1] = job->n + (job->halo[haloIndex(0, 1, 0)] ? halo : 0);
+    job->nv[2] = job->n + (job->halo[haloIndex(0, 0, 1)] ? halo : 0);
+    job->layers = job->algorithm == MESH_SURFACE_NETS ? job->nv[0] - 1 : job->nv[0];
     
-done:
-    result.num_triangles = num_vertices / 3;
+    // Query the span-space index
+    int nb = job->num_bricks;
+    for (int bz = 0; bz < nb; bz++) {
+        for (int by = 0; by < nb; by++) {
+            u32 mask = 0;
+            for (int bx = 0; bx < nb; bx++) {
+                if (brickActive(job, bz, by, bx)) mask |= 1u << bx;
+            }
+            job->brick_masks[bz * nb + by] = mask;
+        }
+    }
+}
+
+static void countItem(void* ctx, s32 item) {
+    mc_batch* batch = ctx;
+    s32 z = item % batch->layers;
+    for (int k = 0; k < batch->num_isos; k++) {
+        mc_job* job = &batch->jobs[item / batch->layers * batch->num_isos + k];
+        if (z < job->layers) {
+            if (job->algorithm == MESH_SURFACE_NETS) netCountLayer(job, z);
+            else countLayer(job, z);
+        }
+    }
+}
+
+static void emitItem(void* ctx, s32 item) {
+    mc_batch* batch = ctx;
+    s32 z = item % batch->layers;
+    for (int k = 0; k < batch->num_isos; k++) {
+        mc_job* job = &batch->jobs[item / batch->layers * batch->num_isos + k];
+        if (job->total_triangles > 0 && z < job->layers) {
+            if (job->algorithm == MESH_SURFACE_NETS) netEmitLayer(job, z);
+            else emitLayer(job, z);
+        }
+    }
+}
+
+static void boundsItem(void* ctx, s32 i) {
+    mc_batch* batch = ctx;
+    mesh_bounds(batch->jobs[i].out);
+}
+
+// out holds count * num_isos meshes, out[i * num_isos + k] for chunk i and isos[k]
+static void generateMeshes(const chunk* const* chunks, const chunklods* const* lods, int num_chunks,
+                           const s32* neighbors, int count, const u8* isos, int num_isos, s32 lod,
+                           mesh_algorithm algorithm, mesh* out) {
+    if (lod < 0) lod = 0;
+    if (lod > MESH_MAX_LOD) lod = MESH_MAX_LOD;
+    const int n = CHUNK_LEN >> lod;
     
-    if (num_vertices > 0) {
-        result.vertices = realloc(vertices, num_vertices * 3 * sizeof(float));
-        result.colors = realloc(colors, num_vertices * 3 * sizeof(float));
-    } else {
-        free(vertices);
-        free(colors);
-        result.vertices = NULL;
-        result.colors = NULL;
+    u8 num_tris[256];
+    for (int c = 0; c < 256; c++) {
+        int t = 0;
+        while (triTable[c][t] != -1) t++;
+        num_tris[c] = (u8)(t / 3);
     }
     
-    LOG_INFO("Marching cubes generated %d triangles (%d vertices)\n", 
-             result.num_triangles, num_vertices);
+    mc_batch batch = {
+        .chunks = chunks, .lods = lods, .neighbors = neighbors, .lod = lod, .count = count,
+        .num_isos = num_isos, .layers = n + 1,
+        .scratch = calloc(num_chunks, sizeof(chunklods)),
+        .levels = malloc(num_chunks * sizeof(u8*)),
+        .bricks = malloc(num_chunks * sizeof(u8*)),
+        .jobs = calloc((size_t)count * num_isos, sizeof(mc_job)),
+    };
+    int num_jobs = count * num_isos;
+    for (int i = 0; i < num_jobs; i++) {
+        out[i] = (mesh){.scale = 1.0f / (1 << MESH_POS_FRAC)};
+        batch.jobs[i] = (mc_job){
+            .n = n, .algorithm = algorithm, .scale = (float)(1 << lod), .iso = isos[i % num_isos],
+            .num_tris = num_tris, .out = &out[i],
+            .row_verts = malloc((size_t)(n + 1) * (n + 1) * sizeof(u32)),
+            .row_tris = malloc((size_t)(n + 1) * (n + 1) * sizeof(u32)),
+            .layer_range = malloc((size_t)(n + 1) * sizeof(u8[2])),
+            .num_bricks = n / MESH_BRICK,
+            .brick_masks = malloc((size_t)(n / MESH_BRICK) * (n / MESH_BRICK) * sizeof(u32)),
+        };
+    }
+    parallel_for(num_chunks, prepareChunk, &batch);
+    parallel_for(num_jobs, prepareJob, &batch);
     
-    // Normalize grayscale values to use full colormap range
-    if (result.colors && num_vertices > 0) {
-        // First, we need to extract the grayscale values that were stored
-        // They're currently in RGB triplets but all the same value
-        float* grayscale_values = malloc(num_vertices * sizeof(float));
-        
-        // Extract grayscale values (just take R channel since R=G=B)
-        for (int i = 0; i < num_vertices; i++) {
-            grayscale_values[i] = result.colors[i * 3] * 255.0f;
+    // Count, turn the counts into offsets, then emit into exact buffers
+    parallel_for(count * batch.layers, countItem, &batch);
+    for (int i = 0; i < num_jobs; i++) {
+        mc_job* job = &batch.jobs[i];
+        size_t cell_rows = (size_t)(job->nv[0] - 1) * (job->nv[1] - 1);
+        size_t voxel_rows = (size_t)job->nv[0] * job->nv[1];
+        bool nets = algorithm == MESH_SURFACE_NETS;
+        job->total_vertices = prefixSum(job->row_verts, nets ? cell_rows : voxel_rows);
+        job->total_triangles = prefixSum(job->row_tris, cell_rows);
+        if (job->total_triangles > 0) {
+            out[i].num_vertices = (int)job->total_vertices;
+            out[i].num_triangles = (int)job->total_triangles;
+            out[i].vertices = malloc((size_t)job->total_vertices * sizeof(mesh_vertex));
+            out[i].indices = malloc((size_t)job->total_triangles * 3 * sizeof(u32));
         }
-        
-        // Find min/max
-        float min_val = 255.0f, max_val = 0.0f;
-        for (int i = 0; i < num_vertices; i++) {
-            if (grayscale_values[i] < min_val) min_val = grayscale_values[i];
-            if (grayscale_values[i] > max_val) max_val = grayscale_values[i];
+    }
+    parallel_for(count * batch.layers, emitItem, &batch);
+    for (int i = 0; i < num_jobs; i++) {
+        // Reduce the per-layer value ranges; the renderer maps this range onto the colormap
+        mc_job* job = &batch.jobs[i];
+        out[i].value_min = 255;
+        out[i].value_max = 0;
+        for (int z = 0; z < job->layers && job->total_triangles > 0; z++) {
+            if (job->layer_range[z][0] < out[i].value_min) out[i].value_min = job->layer_range[z][0];
+            if (job->layer_range[z][1] > out[i].value_max) out[i].value_max = job->layer_range[z][1];
         }
-        
-        LOG_INFO("Color range before normalization: min=%.1f, max=%.1f\n", min_val, max_val);
-        
-        // Normalize and apply colormap
-        float range = max_val - min_val;
-        if (range > 0.001f) {
-            for (int i = 0; i < num_vertices; i++) {
-                // Normalize to 0-255
-                float normalized = (grayscale_values[i] - min_val) / range * 255.0f;
-                u8 idx = (u8)fminf(255.0f, fmaxf(0.0f, normalized));
-                
-                // Apply viridis colormap
-                rgb color = apply_viridis_colormap(idx);
-                
-                // Store RGB values
-                result.colors[i * 3 + 0] = color.r / 255.0f;
-                result.colors[i * 3 + 1] = color.g / 255.0f;
-                result.colors[i * 3 + 2] = color.b / 255.0f;
+    }
+    // Bounding boxes, which let the viewer skip chunks outside the view
+    parallel_for(num_jobs, boundsItem, &batch);
+    
+    for (int i = 0; i < num_jobs; i++) {
+        free(batch.jobs[i].row_verts);
+        free(batch.jobs[i].row_tris);
+        free(batch.jobs[i].layer_range);
+        free(batch.jobs[i].brick_masks);
+    }
+    for (int i = 0; i < num_chunks; i++) {
+        chunklods_free(&batch.scratch[i]);
+    }
+    free(batch.jobs);
+    free(batch.scratch);
+    free(batch.levels);
+    free(batch.bricks);
+}
+
+mesh generate_mesh_from_chunk(const chunk* volume_data, u8 iso_threshold, s32 lod, mesh_algorithm algorithm,
+                              const chunklods* lods) {
+    mesh result = {0};
+    if (!volume_data) return result;
+    
+    generateMeshes(&volume_data, lods ? &lods : nullptr, 1, nullptr, 1, &iso_threshold, 1, lod, algorithm, &result);
+    LOG_INFO("Marching cubes generated %d triangles (%d vertices)\n", 
+             result.num_triangles, result.num_vertices);
+    return result;
+}
+
+void generate_selected_chunk_meshes(const volume* vol, const s32* selected, int count, const u8* isos, int num_isos,
+                                    s32 lod, mesh_algorithm algorithm, const chunklods* lods, mesh* meshes) {
+    int total = vol->z * vol->y * vol->x;
+    if (count <= 0 || num_isos <= 0) return;
+    
+    // The selected chunks go first so they are the ones meshed; the rest of vol
+    // follows and is only read as halo
+    s32* slot = malloc(total * sizeof(s32));
+    for (int v = 0; v < total; v++) {
+        slot[v] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        slot[selected[i]] = i;
+    }
+    int next = count;
+    for (int v = 0; v < total; v++) {
+        if (slot[v] < 0) slot[v] = next++;
+    }
+    
+    const chunk** chunks = malloc(total * sizeof(chunk*));
+    const chunklods** chunk_lods = lods ? malloc(total * sizeof(chunklods*)) : nullptr;
+    s32* neighbors = malloc((size_t)count * 27 * sizeof(s32));
+    for (int z = 0; z < vol->z; z++) {
+        for (int y = 0; y < vol->y; y++) {
+            for (int x = 0; x < vol->x; x++) {
+                int v = (z * vol->y + y) * vol->x + x;
+                int i = slot[v];
+                chunks[i] = volume_chunk(vol, z, y, x);
+                if (chunk_lods) chunk_lods[i] = &lods[v];
+                if (i >= count) continue;
+                // Only the chunks on the + sides supply the halo
+                for (int h = 0; h < 27; h++) {
+                    neighbors[i * 27 + h] = -1;
+                }
+                for (int dz = 0; dz <= 1; dz++) {
+                    for (int dy = 0; dy <= 1; dy++) {
+                        for (int dx = 0; dx <= 1; dx++) {
+                            int nz = z + dz, ny = y + dy, nx = x + dx;
+                            bool inside = nz < vol->z && ny < vol->y && nx < vol->x;
+                            neighbors[i * 27 + haloIndex(dz, dy, dx)] = inside ? slot[(nz * vol->y + ny) * vol->x + nx] : -1;
+                        }
+                    }
+                }
             }
         }
-        
-        free(grayscale_values);
     }
+    generateMeshes(chunks, chunk_lods, total, neighbors, count, isos, num_isos, lod, algorithm, meshes);
+    for (int j = 0; j < count * num_isos; j++) {
+        s32 i = selected[j / num_isos];
+        meshes[j].origin[0] = (i % vol->x) * CHUNK_LEN;
+        meshes[j].origin[1] = (i / vol->x) % vol->y * CHUNK_LEN;
+        meshes[j].origin[2] = i / (vol->x * vol->y) * CHUNK_LEN;
+    }
+    free(slot);
+    free(chunks);
+    free(chunk_lods);
+    free(neighbors);
+}
+
+void generate_chunk_meshes_region(const volume* vol, const s32 lo[3], const s32 hi[3], const u8* isos, int num_isos,
+                                  s32 lod, mesh_algorithm algorithm, const chunklods* lods, mesh* meshes) {
+    int count = (hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+    if (count <= 0) return;
+    s32* selected = malloc(count * sizeof(s32));
+    int i = 0;
+    for (int z = lo[0]; z < hi[0]; z++) {
+        for (int y = lo[1]; y < hi[1]; y++) {
+            for (int x = lo[2]; x < hi[2]; x++) {
+                selected[i++] = (z * vol->y + y) * vol->x + x;
+            }
+        }
+    }
+    generate_selected_chunk_meshes(vol, selected, count, isos, num_isos, lod, algorithm, lods, meshes);
+    free(selected);
+}
+
+void generate_chunk_meshes(const volume* vol, u8 iso_threshold, s32 lod, mesh_algorithm algorithm,
+                           const chunklods* lods, mesh* meshes) {
+    const s32 lo[3] = {0, 0, 0};
+    const s32 hi[3] = {vol->z, vol->y, vol->x};
+    generate_chunk_meshes_region(vol, lo, hi, &iso_threshold, 1, lod, algorithm, lods, meshes);
+}
+
+mesh generate_mesh_from_volume(const volume* vol, u8 iso_threshold, s32 lod, mesh_algorithm algorithm,
+                              const chunklods* lods) {
+    int count = vol->z * vol->y * vol->x;
+    mesh* parts = malloc(count * sizeof(mesh));
+    generate_chunk_meshes(vol, iso_threshold, lod, algorithm, lods, parts);
+    
+    // Keep the chunk meshes' precision unless the volume's extent does not fit in u16
+    s64 extent = (s64)CHUNK_LEN << MESH_POS_FRAC;
+    extent *= vol->x > vol->y ? (vol->x > vol->z ? vol->x : vol->z) : (vol->y > vol->z ? vol->y : vol->z);
+    int shift = 0;
+    while ((extent >> shift) > UINT16_MAX) shift++;
     
+    // Concatenate in chunk order, moving each part to its chunk's position
+    mesh result = {.scale = (float)(1 << shift) / (1 << MESH_POS_FRAC), .value_min = 255};
+    for (int i = 0; i < count; i++) {
+        result.num_vertices += parts[i].num_vertices;
+        result.num_triangles += parts[i].num_triangles;
+        mesh_value_range(&parts[i], &result.value_min, &result.value_max);
+    }
+    if (result.num_triangles > 0) {
+        result.vertices = malloc((size_t)result.num_vertices * sizeof(mesh_vertex));
+        result.indices = malloc((size_t)result.num_triangles * 3 * sizeof(u32));
+    }
+    int v0 = 0, t0 = 0;
+    for (int i = 0; i < count; i++) {
+        mesh* m = &parts[i];
+        for (int v = 0; v < m->num_vertices; v++) {
+            mesh_vertex mv = m->vertices[v];
+            for (int k = 0; k < 3; k++) {
+                s64 q = ((s64)m->origin[k] << MESH_POS_FRAC) + mv.pos[k];
+                mv.pos[k] = (u16)((q + (shift ? 1 << (shift - 1) : 0)) >> shift);
+            }
+            result.vertices[v0 + v] = mv;
+        }
+        for (int t = 0; t < m->num_triangles * 3; t++) {
+            result.indices[t0 * 3 + t] = m->indices[t] + (u32)v0;
+        }
+        v0 += m->num_vertices;
+        t0 += m->num_triangles;
+        mesh_free(m);
+    }
+    free(parts);
+    mesh_bounds(&result);
     return result;
 }
 
+void mesh_value_range(const mesh* m, u8* value_min, u8* value_max) {
+    if (m->num_vertices > 0) {
+        if (m->value_min < *value_min) *value_min = m->value_min;
+        if (m->value_max > *value_max) *value_max = m->value_max;
+    }
+}
+
+void mesh_bounds(mesh* m) {
+    u16 lo[3] = {UINT16_MAX, UINT16_MAX, UINT16_MAX}, hi[3] = {0, 0, 0};
+    if (m->num_vertices == 0) lo[0] = lo[1] = lo[2] = 0;
+    for (int v = 0; v < m->num_vertices; v++) {
+        const u16* p = m->vertices[v].pos;
+        for (int k = 0; k < 3; k++) {
+            if (p[k] < lo[k]) lo[k] = p[k];
+            if (p[k] > hi[k]) hi[k] = p[k];
+        }
+    }
+    memcpy(m->pos_min, lo, sizeof(lo));
+    memcpy(m->pos_max, hi, sizeof(hi));
+}
+
 // Free mesh memory
 void mesh_free(mesh* m) {
     if (m) {
-        if (m->vertices) {
-            free(m->vertices);
-            m->vertices = NULL;
-        }
-        if (m->colors) {
-            free(m->colors);
-            m->colors = NULL;
-        }
+        free(m->vertices);
+        m->vertices = NULL;
+        free(m->indices);
+        m->indices = NULL;
+        m->num_vertices = 0;
         m->num_triangles = 0;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,239 @@
+#include "vcr.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// On-disk cache of chunk meshes.
+// One file per key under <dir>/<array id>/. A file is a fixed header, the
+// per-vertex attributes (normal and value, 3 bytes each) at a fixed offset,
+// then the positions and the indices as zigzag LEB128 deltas from the
+// previous value. Vertices come out of the extraction layer by layer and
+// triangles reference recent vertices, so most deltas fit a byte or two.
+// Loading maps the file and decodes straight out of the mapping. Files are
+// written under a temporary name and renamed into place, so a reader never
+// sees a partial mesh.
+
+constexpr u32 MESH_FILE_MAGIC = 0x4d524356;  // "VCRM"
+constexpr u32 MESH_FILE_FORMAT = 1;
+
+typedef struct mesh_file_header {
+    u32 magic;
+    u32 format;
+    u32 num_vertices;
+    u32 num_triangles;
+    f32 scale;
+    u8 value_min, value_max;
+    u8 pad[2];
+    u32 position_bytes;
+    u32 index_bytes;
+} mesh_file_header;
+
+// Keys
+
+u64 meshkey_array(const char* path) {
+    // The array's location and its metadata, so an array rewritten with
+    // another shape or chunking does not match the old meshes
+    u64 h = 14695981039104346037ull;
+    char resolved[4096];
+    const char* name = realpath(path, resolved) ? resolved : path;
+    for (const char* c = name; *c; c++) {
+        h = (h ^ (u8)*c) * 1099511628211ull;
+    }
+    char zarray[4200];
+    snprintf(zarray, sizeof(zarray), "%s/.zarray", name);
+    char* json = read_file(zarray);
+    for (const char* c = json; c && *c; c++) {
+        h = (h ^ (u8)*c) * 1099511628211ull;
+    }
+    free(json);
+    return h;
+}
+
+static void mesh_file_path(char* out, size_t size, const char* dir, const meshkey* key) {
+    snprintf(out, size, "%s/%016llx/%d.%d.%d-a%dv%u-l%d-i%d-h%07x.mesh", dir, (unsigned long long)key->array,
+             key->chunk[0], key->chunk[1], key->chunk[2], key->algorithm, MESH_ENGINE_VERSION, key->lod, key->iso,
+             key->halo);
+}
+
+// Creates every missing directory of path, up to its last '/'
+static void make_parents(const char* path) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char* p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(tmp, 0755);
+            *p = '/';
+        }
+    }
+}
+
+bool meshcache_default_dir(char* out, size_t size) {
+    const char* env = getenv("VCR_MESH_CACHE");
+    if (env) {
+        snprintf(out, size, "%s", env);
+        return env[0] != '\0';  // set but empty turns the cache off
+    }
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdg && xdg[0]) {
+        snprintf(out, size, "%s/vcr/meshes", xdg);
+    } else if (home && home[0]) {
+        snprintf(out, size, "%s/.cache/vcr/meshes", home);
+    } else {
+        out[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+// Coding
+
+static inline u32 zigzag(s32 v) {
+    return ((u32)v << 1) ^ (u32)(v >> 31);
+}
+
+static inline s32 unzigzag(u32 v) {
+    return (s32)(v >> 1) ^ -(s32)(v & 1);
+}
+
+static inline u8* put_varint(u8* p, u32 v) {
+    while (v >= 0x80) {
+        *p++ = (u8)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (u8)v;
+    return p;
+}
+
+static inline bool get_varint(const u8** p, const u8* end, u32* out) {
+    u32 v = 0;
+    for (s32 shift = 0; shift < 35 && *p < end; shift += 7) {
+        u8 b = *(*p)++;
+        v |= (u32)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool meshcache_load(const char* dir, const meshkey* key, mesh* out) {
+    char path[1024];
+    mesh_file_path(path, sizeof(path), dir, key);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(mesh_file_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    const u8* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    mesh_file_header h;
+    memcpy(&h, data, sizeof(h));
+    size_t attr_bytes = (size_t)h.num_vertices * 3;
+    bool ok = h.magic == MESH_FILE_MAGIC && h.format == MESH_FILE_FORMAT &&
+              size == sizeof(h) + attr_bytes + h.position_bytes + h.index_bytes;
+    mesh m = {.scale = h.scale, .value_min = h.value_min, .value_max = h.value_max,
+              .num_vertices = (int)h.num_vertices, .num_triangles = (int)h.num_triangles};
+    if (ok && h.num_triangles > 0) {
+        m.vertices = malloc((size_t)h.num_vertices * sizeof(mesh_vertex));
+        m.indices = malloc((size_t)h.num_triangles * 3 * sizeof(u32));
+        const u8* attr = data + sizeof(h);
+        const u8* p = attr + attr_bytes;
+        const u8* end = p + h.position_bytes;
+        s32 prev[3] = {0, 0, 0};
+        for (u32 v = 0; v < h.num_vertices && ok; v++) {
+            mesh_vertex* mv = &m.vertices[v];
+            for (s32 k = 0; k < 3 && ok; k++) {
+                u32 d = 0;
+                ok = get_varint(&p, end, &d);
+                prev[k] += unzigzag(d);
+                mv->pos[k] = (u16)prev[k];
+            }
+            mv->normal[0] = (s8)attr[v * 3];
+            mv->normal[1] = (s8)attr[v * 3 + 1];
+            mv->value = attr[v * 3 + 2];
+            mv->pad = 0;
+        }
+        end += h.index_bytes;
+        s32 last = 0;
+        for (u32 i = 0; i < h.num_triangles * 3 && ok; i++) {
+            u32 d = 0;
+            ok = get_varint(&p, end, &d);
+            last += unzigzag(d);
+            ok = ok && (u32)last < h.num_vertices;
+            m.indices[i] = (u32)last;
+        }
+        ok = ok && p == end;
+    }
+    if (ok) mesh_bounds(&m);
+    munmap((void*)data, size);
+    if (!ok) {
+        LOG_WARN("ignoring corrupt cached mesh %s\n", path);
+        mesh_free(&m);
+        return false;
+    }
+    *out = m;
+    return true;
+}
+
+err meshcache_store(const char* dir, const meshkey* key, const mesh* m) {
+    char path[1024], tmp[1100];
+    mesh_file_path(path, sizeof(path), dir, key);
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    make_parents(path);
+
+    u32 nv = m->num_triangles > 0 ? (u32)m->num_vertices : 0;
+    u32 nt = m->num_triangles > 0 ? (u32)m->num_triangles : 0;
+    // Worst case: 5 bytes per varint
+    size_t capacity = sizeof(mesh_file_header) + (size_t)nv * (3 + 15) + (size_t)nt * 15;
+    u8* buf = malloc(capacity);
+    u8* attr = buf + sizeof(mesh_file_header);
+    u8* p = attr + (size_t)nv * 3;
+    s32 prev[3] = {0, 0, 0};
+    for (u32 v = 0; v < nv; v++) {
+        const mesh_vertex* mv = &m->vertices[v];
+        for (s32 k = 0; k < 3; k++) {
+            p = put_varint(p, zigzag(mv->pos[k] - prev[k]));
+            prev[k] = mv->pos[k];
+        }
+        attr[v * 3] = (u8)mv->normal[0];
+        attr[v * 3 + 1] = (u8)mv->normal[1];
+        attr[v * 3 + 2] = mv->value;
+    }
+    u8* indices = p;
+    s32 last = 0;
+    for (u32 i = 0; i < nt * 3; i++) {
+        p = put_varint(p, zigzag((s32)m->indices[i] - last));
+        last = (s32)m->indices[i];
+    }
+    mesh_file_header h = {
+        .magic = MESH_FILE_MAGIC, .format = MESH_FILE_FORMAT, .num_vertices = nv, .num_triangles = nt,
+        .scale = m->scale, .value_min = m->value_min, .value_max = m->value_max,
+        .position_bytes = (u32)(indices - attr - (size_t)nv * 3), .index_bytes = (u32)(p - indices),
+    };
+    memcpy(buf, &h, sizeof(h));
+
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp) {
+        free(buf);
+        LOG_WARN("failed to open %s for writing\n", tmp);
+        return FAIL;
+    }
+    size_t len = (size_t)(p - buf);
+    bool ok = fwrite(buf, 1, len, fp) == len;
+    ok = fclose(fp) == 0 && ok;
+    free(buf);
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        LOG_WARN("failed to write %s\n", path);
+        return FAIL;
+    }
+    return OK;
+}
@@ -0,0 +1,280 @@
+#include "vcr.h"
+#include "sokol_gfx.h"
+
+// Chunk meshes on the GPU.
+// A mesh is uploaded once into immutable vertex and index buffers and drawn
+// with its own pipeline: the vertex shader decodes the quantized position and
+// the octahedral normal and lights the vertex, the fragment shader looks the
+// vertex value up in a 256x1 colormap texture. Nothing is streamed per frame
+// but one small uniform block per draw. Under SOKOL_DUMMY_BACKEND the shaders
+// are accepted as they are, so the module runs headless; tests/test_meshgpu.c
+// drives it there.
+
+// 12 bytes per vertex: sokol has no three-component 16-bit format, and Metal
+// wants strides that are multiples of 4. The value rides in the w of the
+// position as value * 257, which USHORT4N turns back into value / 255.
+typedef struct gpu_vertex {
+    u16 pos[4];           // x, y, z, value * 257
+    s8 normal[4];         // octahedral x, y, then padding
+} gpu_vertex;
+
+struct gpumesh {
+    sg_buffer vertices;
+    sg_buffer indices;
+    s32 origin[3];
+    f32 scale;
+    s32 num_triangles;
+};
+
+// One uniform block, vec4-aligned so the GLSL side can take it as an array
+typedef struct mesh_params {
+    f32 mvp[16];
+    f32 origin_scale[4];  // mesh origin relative to the camera's, and voxels per position unit
+    f32 light[4];         // direction the light travels, in model space
+} mesh_params;
+
+struct meshrenderer {
+    sg_shader shader;
+    sg_pipeline pipeline;
+    sg_image colormap;
+    sg_sampler sampler;
+    u8 colors[256][4];
+    mesh_params params;
+    f32 offset[3];
+};
+
+static const char* mesh_vs_msl =
+    "#include <metal_stdlib>\n"
+    "using namespace metal;\n"
+    "struct params { float4x4 mvp; float4 origin_scale; float4 light; };\n"
+    "struct vs_in { float4 pos [[attribute(0)]]; float4 normal [[attribute(1)]]; };\n"
+    "struct vs_out { float4 pos [[position]]; float value; float light; };\n"
+    "vertex vs_out vs_main(vs_in in [[stage_in]], constant params& p [[buffer(0)]]) {\n"
+    "    vs_out out;\n"
+    "    float3 q = p.origin_scale.xyz + in.pos.xyz * 65535.0 * p.origin_scale.w;\n"
+    "    out.pos = p.mvp * float4(q, 1.0);\n"
+    "    float3 n = float3(in.normal.xy, 1.0 - abs(in.normal.x) - abs(in.normal.y));\n"
+    "    float t = max(-n.z, 0.0);\n"
+    "    n.xy += select(float2(t), float2(-t), n.xy >= 0.0);\n"
+    "    n = normalize(n);\n"
+    "    out.light = 0.5 + 0.6 * max(-dot(n, p.light.xyz), 0.0);\n"
+    "    out.value = in.pos.w * 255.0;\n"
+    "    return out;\n"
+    "}\n";
+
+static const char* mesh_fs_msl =
+    "#include <metal_stdlib>\n"
+    "using namespace metal;\n"
+    "struct vs_out { float4 pos [[position]]; float value; float light; };\n"
+    "fragment float4 fs_main(vs_out in [[stage_in]], texture2d<float> lut [[texture(0)]],\n"
+    "                        sampler smp [[sampler(0)]]) {\n"
+    "    float3 c = lut.sample(smp, float2((in.value + 0.5) / 256.0, 0.5)).rgb;\n"
+    "    return float4(c * in.light, 1.0);\n"
+    "}\n";
+
+static const char* mesh_vs_glsl =
+    "#version 410\n"
+    "uniform vec4 params[6];\n"
+    "layout(location = 0) in vec4 a_pos;\n"
+    "layout(location = 1) in vec4 a_normal;\n"
+    "out float v_value;\n"
+    "out float v_light;\n"
+    "void main() {\n"
+    "    mat4 mvp = mat4(params[0], params[1], params[2], params[3]);\n"
+    "    vec3 q = params[4].xyz + a_pos.xyz * 65535.0 * params[4].w;\n"
+    "    gl_Position = mvp * vec4(q, 1.0);\n"
+    "    vec3 n = vec3(a_normal.xy, 1.0 - abs(a_normal.x) - abs(a_normal.y));\n"
+    "    float t = max(-n.z, 0.0);\n"
+    "    n.x += n.x >= 0.0 ? -t : t;\n"
+    "    n.y += n.y >= 0.0 ? -t : t;\n"
+    "    n = normalize(n);\n"
+    "    v_light = 0.5 + 0.6 * max(-dot(n, params[5].xyz), 0.0);\n"
+    "    v_value = a_pos.w * 255.0;\n"
+    "}\n";
+
+static const char* mesh_fs_glsl =
+    "#version 410\n"
+    "uniform sampler2D lut;\n"
+    "in float v_value;\n"
+    "in float v_light;\n"
+    "out vec4 frag_color;\n"
+    "void main() {\n"
+    "    vec3 c = texture(lut, vec2((v_value + 0.5) / 256.0, 0.5)).rgb;\n"
+    "    frag_color = vec4(c * v_light, 1.0);\n"
+    "}\n";
+
+// Meshes
+
+gpumesh* gpumesh_upload(const mesh* m) {
+    if (!m || !m->vertices || m->num_triangles <= 0) return nullptr;
+    gpu_vertex* vertices = malloc((size_t)m->num_vertices * sizeof(gpu_vertex));
+    for (int i = 0; i < m->num_vertices; i++) {
+        const mesh_vertex* v = &m->vertices[i];
+        vertices[i] = (gpu_vertex){
+            .pos = {v->pos[0], v->pos[1], v->pos[2], (u16)(v->value * 257)},
+            .normal = {v->normal[0], v->normal[1], 0, 0},
+        };
+    }
+    gpumesh* g = calloc(1, sizeof(gpumesh));
+    g->vertices = sg_make_buffer(&(sg_buffer_desc){
+        .usage = {.vertex_buffer = true, .immutable = true},
+        .data = {vertices, (size_t)m->num_vertices * sizeof(gpu_vertex)},
+        .label = "chunk-mesh-vertices",
+    });
+    g->indices = sg_make_buffer(&(sg_buffer_desc){
+        .usage = {.index_buffer = true, .immutable = true},
+        .data = {m->indices, (size_t)m->num_triangles * 3 * sizeof(u32)},
+        .label = "chunk-mesh-indices",
+    });
+    free(vertices);
+    memcpy(g->origin, m->origin, sizeof(g->origin));
+    g->scale = m->scale;
+    g->num_triangles = m->num_triangles;
+    return g;
+}
+
+void gpumesh_free(gpumesh* g) {
+    if (g) {
+        sg_destroy_buffer(g->vertices);
+        sg_destroy_buffer(g->indices);
+        free(g);
+    }
+}
+
+// Renderer
+
+meshrenderer* meshrenderer_new(void) {
+    sg_shader_desc desc = {
+        .attrs = {
+            [0].glsl_name = "a_pos",
+            [1].glsl_name = "a_normal",
+        },
+        .uniform_blocks[0] = {
+            .stage = SG_SHADERSTAGE_VERTEX,
+            .size = sizeof(mesh_params),
+            .layout = SG_UNIFORMLAYOUT_STD140,
+            .msl_buffer_n = 0,
+            .glsl_uniforms[0] = {.type = SG_UNIFORMTYPE_FLOAT4, .array_count = 6, .glsl_name = "params"},
+        },
+        .images[0] = {
+            .stage = SG_SHADERSTAGE_FRAGMENT,
+            .image_type = SG_IMAGETYPE_2D,
+            .sample_type = SG_IMAGESAMPLETYPE_FLOAT,
+            .msl_texture_n = 0,
+        },
+        .samplers[0] = {
+            .stage = SG_SHADERSTAGE_FRAGMENT,
+            .sampler_type = SG_SAMPLERTYPE_FILTERING,
+            .msl_sampler_n = 0,
+        },
+        .image_sampler_pairs[0] = {
+            .stage = SG_SHADERSTAGE_FRAGMENT, .image_slot = 0, .sampler_slot = 0, .glsl_name = "lut",
+        },
+        .label = "chunk-mesh-shader",
+    };
+    switch (sg_query_backend()) {
+        case SG_BACKEND_METAL_MACOS:
+        case SG_BACKEND_METAL_IOS:
+        case SG_BACKEND_METAL_SIMULATOR:
+        case SG_BACKEND_DUMMY:
+            desc.vertex_func = (sg_shader_function){.source = mesh_vs_msl, .entry = "vs_main"};
+            desc.fragment_func = (sg_shader_function){.source = mesh_fs_msl, .entry = "fs_main"};
+            break;
+        case SG_BACKEND_GLCORE:
+            desc.vertex_func.source = mesh_vs_glsl;
+            desc.fragment_func.source = mesh_fs_glsl;
+            break;
+        default:
+            LOG_WARN("no chunk mesh shader for this graphics backend\n");
+            return nullptr;
+    }
+
+    meshrenderer* r = calloc(1, sizeof(meshrenderer));
+    r->shader = sg_make_shader(&desc);
+    r->pipeline = sg_make_pipeline(&(sg_pipeline_desc){
+        .shader = r->shader,
+        .layout = {
+            .buffers[0].stride = sizeof(gpu_vertex),
+            .attrs = {
+                [0] = {.offset = offsetof(gpu_vertex, pos), .format = SG_VERTEXFORMAT_USHORT4N},
+                [1] = {.offset = offsetof(gpu_vertex, normal), .format = SG_VERTEXFORMAT_BYTE4N},
+            },
+        },
+        .index_type = SG_INDEXTYPE_UINT32,
+        .cull_mode = SG_CULLMODE_NONE,  // both sides of the surface are visible
+        .depth = {
+            .pixel_format = SG_PIXELFORMAT_DEPTH,
+            .write_enabled = true,
+            .compare = SG_COMPAREFUNC_LESS_EQUAL,
+        },
+        .colors[0].pixel_format = SG_PIXELFORMAT_RGBA8,
+        .sample_count = 1,
+        .label = "chunk-mesh-pipeline",
+    });
+    r->colormap = sg_make_image(&(sg_image_desc){
+        .usage.dynamic_update = true,
+        .width = 256,
+        .height = 1,
+        .pixel_format = SG_PIXELFORMAT_RGBA8,
+        .label = "chunk-mesh-colormap",
+    });
+    r->sampler = sg_make_sampler(&(sg_sampler_desc){
+        .min_filter = SG_FILTER_LINEAR,
+        .mag_filter = SG_FILTER_LINEAR,
+        .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+        .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+    });
+    return r;
+}
+
+void meshrenderer_free(meshrenderer* r) {
+    if (r) {
+        sg_destroy_pipeline(r->pipeline);
+        sg_destroy_shader(r->shader);
+        sg_destroy_image(r->colormap);
+        sg_destroy_sampler(r->sampler);
+        free(r);
+    }
+}
+
+bool meshrenderer_colormap(meshrenderer* r, const u8 rgb[256][3]) {
+    u8 colors[256][4];
+    for (int i = 0; i < 256; i++) {
+        colors[i][0] = rgb[i][0];
+        colors[i][1] = rgb[i][1];
+        colors[i][2] = rgb[i][2];
+        colors[i][3] = 255;
+    }
+    // A dynamic image takes one update per frame; the table only changes with the meshes' value range
+    if (memcmp(colors, r->colors, sizeof(colors)) == 0) return false;
+    memcpy(r->colors, colors, sizeof(colors));
+    sg_update_image(r->colormap, &(sg_image_data){.subimage[0][0] = {r->colors, sizeof(r->colors)}});
+    return true;
+}
+
+void meshrenderer_begin(meshrenderer* r, const f32 mvp[16], const f32 offset[3], const f32 light_dir[3]) {
+    memcpy(r->params.mvp, mvp, sizeof(r->params.mvp));
+    memcpy(r->offset, offset, sizeof(r->offset));
+    r->params.light[0] = light_dir[0];
+    r->params.light[1] = light_dir[1];
+    r->params.light[2] = light_dir[2];
+    r->params.light[3] = 0.0f;
+    sg_apply_pipeline(r->pipeline);
+}
+
+s32 meshrenderer_draw(meshrenderer* r, const gpumesh* g) {
+    if (!g) return 0;
+    for (int k = 0; k < 3; k++) {
+        r->params.origin_scale[k] = g->origin[k] - r->offset[k];
+    }
+    r->params.origin_scale[3] = g->scale;
+    sg_apply_bindings(&(sg_bindings){
+        .vertex_buffers[0] = g->vertices,
+        .index_buffer = g->indices,
+        .images[0] = r->colormap,
+        .samplers[0] = r->sampler,
+    });
+    sg_apply_uniforms(0, &(sg_range){&r->params, sizeof(r->params)});
+    sg_draw(0, g->num_triangles * 3, 1);
+    return g->num_triangles;
+}
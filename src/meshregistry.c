@@ -0,0 +1,136 @@
+#include "vcr.h"
+
+// Chunk meshes by chunk coordinate.
+// Entries are packed in one array so drawing walks them linearly; a chained
+// hash table of indices into that array finds a chunk's entry. Removal moves
+// the last entry into the hole and fixes up the chain that pointed at it.
+
+struct meshregistry {
+    meshentry* entries;
+    s32* hnext;            // per entry: next index in its hash chain, -1 ends it
+    s32 count;
+    s32 capacity;
+    s32* buckets;          // first index of each chain, -1 when empty
+    u32 num_buckets;       // power of two
+};
+
+static u32 chunk_hash(s32 z, s32 y, s32 x) {
+    u32 h = 2166136261u;
+    s32 fields[3] = {z, y, x};
+    for (s32 i = 0; i < 3; i++) {
+        h = (h ^ (u32)fields[i]) * 16777619u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static u32 entry_bucket(const meshregistry* r, const meshentry* e) {
+    return chunk_hash(e->chunk[0], e->chunk[1], e->chunk[2]) & (r->num_buckets - 1);
+}
+
+static void rehash(meshregistry* r, u32 num_buckets) {
+    free(r->buckets);
+    r->num_buckets = num_buckets;
+    r->buckets = malloc(num_buckets * sizeof(s32));
+    for (u32 b = 0; b < num_buckets; b++) {
+        r->buckets[b] = -1;
+    }
+    for (s32 i = 0; i < r->count; i++) {
+        u32 b = entry_bucket(r, &r->entries[i]);
+        r->hnext[i] = r->buckets[b];
+        r->buckets[b] = i;
+    }
+}
+
+// The link that holds index i in its chain
+static s32* chain_link(meshregistry* r, s32 i) {
+    s32* link = &r->buckets[entry_bucket(r, &r->entries[i])];
+    while (*link != i) {
+        link = &r->hnext[*link];
+    }
+    return link;
+}
+
+void meshentry_clear(meshentry* e) {
+    for (s32 k = 0; k < e->num_surfaces; k++) {
+        meshlods_free(&e->lods[k]);
+        for (s32 l = 0; l < MESH_DETAIL_LEVELS; l++) {
+            gpumesh_free(e->gpu[k][l]);
+            e->gpu[k][l] = nullptr;
+        }
+    }
+    e->num_surfaces = 0;
+}
+
+meshregistry* meshregistry_new(void) {
+    meshregistry* r = calloc(1, sizeof(meshregistry));
+    rehash(r, 64);
+    return r;
+}
+
+void meshregistry_free(meshregistry* r) {
+    if (r) {
+        for (s32 i = 0; i < r->count; i++) {
+            meshentry_clear(&r->entries[i]);
+        }
+        free(r->entries);
+        free(r->hnext);
+        free(r->buckets);
+        free(r);
+    }
+}
+
+meshentry* meshregistry_find(meshregistry* r, s32 cz, s32 cy, s32 cx) {
+    s32 i = r->buckets[chunk_hash(cz, cy, cx) & (r->num_buckets - 1)];
+    while (i >= 0) {
+        const s32* c = r->entries[i].chunk;
+        if (c[0] == cz && c[1] == cy && c[2] == cx) return &r->entries[i];
+        i = r->hnext[i];
+    }
+    return nullptr;
+}
+
+meshentry* meshregistry_insert(meshregistry* r, s32 cz, s32 cy, s32 cx) {
+    meshentry* e = meshregistry_find(r, cz, cy, cx);
+    if (e) return e;
+    if (r->count == r->capacity) {
+        r->capacity = r->capacity ? r->capacity * 2 : 64;
+        r->entries = realloc(r->entries, r->capacity * sizeof(meshentry));
+        r->hnext = realloc(r->hnext, r->capacity * sizeof(s32));
+    }
+    s32 i = r->count++;
+    e = &r->entries[i];
+    *e = (meshentry){.chunk = {cz, cy, cx}};
+    if ((u32)r->count > r->num_buckets) {
+        rehash(r, r->num_buckets * 2);
+    } else {
+        u32 b = entry_bucket(r, e);
+        r->hnext[i] = r->buckets[b];
+        r->buckets[b] = i;
+    }
+    return e;
+}
+
+void meshregistry_remove(meshregistry* r, s32 cz, s32 cy, s32 cx) {
+    meshentry* e = meshregistry_find(r, cz, cy, cx);
+    if (!e) return;
+    s32 i = (s32)(e - r->entries);
+    *chain_link(r, i) = r->hnext[i];
+    meshentry_clear(e);
+    s32 last = --r->count;
+    if (i != last) {
+        // Move the last entry into the hole
+        s32* link = chain_link(r, last);
+        *link = i;
+        r->entries[i] = r->entries[last];
+        r->hnext[i] = r->hnext[last];
+    }
+}
+
+s32 meshregistry_count(const meshregistry* r) {
+    return r->count;
+}
+
+meshentry* meshregistry_entries(meshregistry* r) {
+    return r->entries;
+}
@@ -0,0 +1,303 @@
+#include "vcr.h"
+#include <stdatomic.h>
+
+// Direct volume rendering on the CPU.
+// One ray per pixel, sampled with trilinear interpolation at a fixed spacing
+// and composited front to back; a ray stops once it is nearly opaque. Bricks
+// whose whole value range maps to zero opacity are stepped over in one go,
+// which is where most of the time goes in a scroll volume: air and the space
+// between wraps. The image is cut into RAY_TILE^2 tiles handed to
+// parallel_for, whose work stealing evens out tiles that hit more material.
+
+constexpr f32 RAY_OPAQUE = 0.99f;  // accumulated opacity at which a ray stops
+
+// Transfer function
+
+void transferfn_ramp(transferfn* tf, u8 lo, u8 hi, f32 max_opacity) {
+    for (s32 v = 0; v < 256; v++) {
+        f32 t = hi > lo ? (f32)(v - lo) / (hi - lo) : (v >= lo ? 1.0f : 0.0f);
+        t = fminf(fmaxf(t, 0.0f), 1.0f);
+        rgb c = apply_viridis_colormap((u8)lrintf(t * 255.0f));
+        tf->rgba[v][0] = c.r / 255.0f;
+        tf->rgba[v][1] = c.g / 255.0f;
+        tf->rgba[v][2] = c.b / 255.0f;
+        tf->rgba[v][3] = v <= lo ? 0.0f : t * max_opacity;
+    }
+}
+
+// Brick ranges
+
+typedef struct bricks_job {
+    const volume* vol;
+    raybricks* rb;
+} bricks_job;
+
+static inline u8 voxel(const volume* vol, s32 z, s32 y, s32 x) {
+    return (*volume_chunk(vol, z / CHUNK_LEN, y / CHUNK_LEN, x / CHUNK_LEN))[z % CHUNK_LEN][y % CHUNK_LEN][x % CHUNK_LEN];
+}
+
+// One z layer of bricks
+static void brick_layer_fn(void* ctx, s32 bz) {
+    bricks_job* job = ctx;
+    const volume* vol = job->vol;
+    raybricks* rb = job->rb;
+    s32 extent[3] = {vol->z * CHUNK_LEN, vol->y * CHUNK_LEN, vol->x * CHUNK_LEN};
+    s32 z0 = bz * RAY_BRICK, z1 = z0 + RAY_BRICK < extent[0] ? z0 + RAY_BRICK : extent[0] - 1;
+    for (s32 by = 0; by < rb->dims[1]; by++) {
+        s32 y0 = by * RAY_BRICK, y1 = y0 + RAY_BRICK < extent[1] ? y0 + RAY_BRICK : extent[1] - 1;
+        for (s32 bx = 0; bx < rb->dims[2]; bx++) {
+            s32 x0 = bx * RAY_BRICK, x1 = x0 + RAY_BRICK < extent[2] ? x0 + RAY_BRICK : extent[2] - 1;
+            u8 lo = 255, hi = 0;
+            for (s32 z = z0; z <= z1; z++) {
+                for (s32 y = y0; y <= y1; y++) {
+                    // The brick's last voxel may sit in the next chunk, so the row is split there
+                    const u8* row = (*volume_chunk(vol, z / CHUNK_LEN, y / CHUNK_LEN, x0 / CHUNK_LEN))[z % CHUNK_LEN][y % CHUNK_LEN];
+                    for (s32 x = x0; x < x1; x++) {
+                        u8 v = row[x % CHUNK_LEN];
+                        if (v < lo) lo = v;
+                        if (v > hi) hi = v;
+                    }
+                    u8 v = voxel(vol, z, y, x1);
+                    if (v < lo) lo = v;
+                    if (v > hi) hi = v;
+                }
+            }
+            u8* r = &rb->range[(((size_t)bz * rb->dims[1] + by) * rb->dims[2] + bx) * 2];
+            r[0] = lo;
+            r[1] = hi;
+        }
+    }
+}
+
+void raybricks_build(raybricks* rb, const volume* vol) {
+    rb->dims[0] = vol->z * (CHUNK_LEN / RAY_BRICK);
+    rb->dims[1] = vol->y * (CHUNK_LEN / RAY_BRICK);
+    rb->dims[2] = vol->x * (CHUNK_LEN / RAY_BRICK);
+    rb->range = malloc((size_t)rb->dims[0] * rb->dims[1] * rb->dims[2] * 2);
+    bricks_job job = {.vol = vol, .rb = rb};
+    parallel_for(rb->dims[0], brick_layer_fn, &job);
+}
+
+void raybricks_free(raybricks* rb) {
+    free(rb->range);
+    *rb = (raybricks){0};
+}
+
+// Camera
+
+void raycamera_from_view(raycamera* cam, const f32 view[16], f32 fovy) {
+    // The rows of the rotation are the camera axes; the eye is -R^T t
+    for (s32 i = 0; i < 3; i++) {
+        cam->right[i] = view[i * 4];
+        cam->up[i] = view[i * 4 + 1];
+        cam->forward[i] = -view[i * 4 + 2];
+    }
+    for (s32 i = 0; i < 3; i++) {
+        cam->eye[i] = -(view[i * 4] * view[12] + view[i * 4 + 1] * view[13] + view[i * 4 + 2] * view[14]);
+    }
+    cam->tan_half_fov = tanf(fovy / 2.0f);
+}
+
+void raycamera_lookat(raycamera* cam, const f32 eye[3], const f32 center[3], const f32 up[3], f32 fovy) {
+    f32 f[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+    f32 fl = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    f32 r[3] = {f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0]};
+    f32 rl = sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    for (s32 i = 0; i < 3; i++) {
+        cam->eye[i] = eye[i];
+        cam->forward[i] = f[i] / fl;
+        cam->right[i] = r[i] / rl;
+    }
+    cam->up[0] = cam->right[1] * cam->forward[2] - cam->right[2] * cam->forward[1];
+    cam->up[1] = cam->right[2] * cam->forward[0] - cam->right[0] * cam->forward[2];
+    cam->up[2] = cam->right[0] * cam->forward[1] - cam->right[1] * cam->forward[0];
+    cam->tan_half_fov = tanf(fovy / 2.0f);
+}
+
+// Rendering
+
+typedef struct raycast_job {
+    const volume* vol;
+    const raybricks* rb;
+    const raycamera* cam;
+    f32 step;
+    f32 color[256][3];       // premultiplied by the opacity of one step
+    f32 alpha[256];          // opacity of one step
+    u16 visible[257];        // visible[v] = how many values below v have any opacity
+    f32 background[3];
+    s32 h, w, tiles_x;
+    u8* rgba;
+    _Atomic s64 samples;
+    _Atomic s64 skipped;
+    _Atomic s64 terminated;
+} raycast_job;
+
+static bool brick_empty(const raycast_job* job, const u8* range) {
+    return job->visible[range[1] + 1] == job->visible[range[0]];
+}
+
+// Trilinear sample at (x, y, z) voxels, inside [0, extent - 1] on every axis
+static f32 sample(const volume* vol, const s32 extent[3], f32 x, f32 y, f32 z) {
+    s32 ix = (s32)x, iy = (s32)y, iz = (s32)z;
+    if (ix > extent[2] - 2) ix = extent[2] - 2;
+    if (iy > extent[1] - 2) iy = extent[1] - 2;
+    if (iz > extent[0] - 2) iz = extent[0] - 2;
+    f32 fx = x - ix, fy = y - iy, fz = z - iz;
+    s32 lx = ix % CHUNK_LEN, ly = iy % CHUNK_LEN, lz = iz % CHUNK_LEN;
+    f32 c[2][2][2];
+    if (lx < CHUNK_LEN - 1 && ly < CHUNK_LEN - 1 && lz < CHUNK_LEN - 1) {
+        // The whole footprint is in one chunk
+        const chunk* ch = volume_chunk(vol, iz / CHUNK_LEN, iy / CHUNK_LEN, ix / CHUNK_LEN);
+        for (s32 dz = 0; dz < 2; dz++) {
+            for (s32 dy = 0; dy < 2; dy++) {
+                c[dz][dy][0] = (*ch)[lz + dz][ly + dy][lx];
+                c[dz][dy][1] = (*ch)[lz + dz][ly + dy][lx + 1];
+            }
+        }
+    } else {
+        for (s32 dz = 0; dz < 2; dz++) {
+            for (s32 dy = 0; dy < 2; dy++) {
+                c[dz][dy][0] = voxel(vol, iz + dz, iy + dy, ix);
+                c[dz][dy][1] = voxel(vol, iz + dz, iy + dy, ix + 1);
+            }
+        }
+    }
+    f32 c00 = c[0][0][0] + fx * (c[0][0][1] - c[0][0][0]);
+    f32 c01 = c[0][1][0] + fx * (c[0][1][1] - c[0][1][0]);
+    f32 c10 = c[1][0][0] + fx * (c[1][0][1] - c[1][0][0]);
+    f32 c11 = c[1][1][0] + fx * (c[1][1][1] - c[1][1][0]);
+    f32 c0 = c00 + fy * (c01 - c00);
+    f32 c1 = c10 + fy * (c11 - c10);
+    return c0 + fz * (c1 - c0);
+}
+
+// Composite one ray; returns premultiplied colour in out[0..2] and opacity in out[3]
+static void cast_ray(raycast_job* job, const f32 origin[3], const f32 dir[3], f32 out[4], s64* samples, s64* skipped,
+                     bool* terminated) {
+    const volume* vol = job->vol;
+    const raybricks* rb = job->rb;
+    s32 extent[3] = {vol->z * CHUNK_LEN, vol->y * CHUNK_LEN, vol->x * CHUNK_LEN};
+    f32 hi[3] = {(f32)extent[2] - 1, (f32)extent[1] - 1, (f32)extent[0] - 1};
+    f32 inv[3];
+    f32 t0 = 0.0f, t1 = FLT_MAX;
+    for (s32 a = 0; a < 3; a++) {
+        inv[a] = 1.0f / dir[a];  // +-inf for an axis-parallel ray, which the slab test handles
+        f32 ta = (0.0f - origin[a]) * inv[a], tb = (hi[a] - origin[a]) * inv[a];
+        t0 = fmaxf(t0, fminf(ta, tb));
+        t1 = fminf(t1, fmaxf(ta, tb));
+    }
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    *terminated = false;
+    if (t0 > t1) return;
+
+    f32 step = job->step;
+    for (f32 t = t0; t <= t1;) {
+        f32 p[3] = {origin[0] + t * dir[0], origin[1] + t * dir[1], origin[2] + t * dir[2]};
+        for (s32 a = 0; a < 3; a++) {
+            p[a] = fminf(fmaxf(p[a], 0.0f), hi[a]);
+        }
+        s32 b[3] = {(s32)p[0] / RAY_BRICK, (s32)p[1] / RAY_BRICK, (s32)p[2] / RAY_BRICK};
+        if (b[0] >= rb->dims[2]) b[0] = rb->dims[2] - 1;
+        if (b[1] >= rb->dims[1]) b[1] = rb->dims[1] - 1;
+        if (b[2] >= rb->dims[0]) b[2] = rb->dims[0] - 1;
+        const u8* range = &rb->range[(((size_t)b[2] * rb->dims[1] + b[1]) * rb->dims[2] + b[0]) * 2];
+        if (brick_empty(job, range)) {
+            // Jump to the first sample past the brick, staying on the ray's sample lattice
+            f32 exit = FLT_MAX;
+            for (s32 a = 0; a < 3; a++) {
+                if (dir[a] == 0.0f) continue;
+                f32 face = (f32)(dir[a] > 0.0f ? (b[a] + 1) * RAY_BRICK : b[a] * RAY_BRICK);
+                exit = fminf(exit, (face - origin[a]) * inv[a]);
+            }
+            f32 next = t0 + ceilf((exit - t0) / step) * step;
+            t = next > t ? next : t + step;
+            (*skipped)++;
+            continue;
+        }
+
+        f32 v = sample(vol, extent, p[0], p[1], p[2]);
+        s32 vi = (s32)(v + 0.5f);
+        (*samples)++;
+        f32 a = job->alpha[vi];
+        if (a > 0.0f) {
+            f32 weight = 1.0f - out[3];
+            out[0] += weight * job->color[vi][0];
+            out[1] += weight * job->color[vi][1];
+            out[2] += weight * job->color[vi][2];
+            out[3] += weight * a;
+            if (out[3] >= RAY_OPAQUE) {
+                *terminated = true;
+                return;
+            }
+        }
+        t += step;
+    }
+}
+
+static void render_tile_fn(void* ctx, s32 tile) {
+    raycast_job* job = ctx;
+    const raycamera* cam = job->cam;
+    s32 r0 = tile / job->tiles_x * RAY_TILE, c0 = tile % job->tiles_x * RAY_TILE;
+    s32 r1 = r0 + RAY_TILE < job->h ? r0 + RAY_TILE : job->h;
+    s32 c1 = c0 + RAY_TILE < job->w ? c0 + RAY_TILE : job->w;
+    f32 aspect = (f32)job->w / job->h;
+    s64 samples = 0, skipped = 0, terminated = 0;
+    for (s32 r = r0; r < r1; r++) {
+        f32 sy = (1.0f - 2.0f * (r + 0.5f) / job->h) * cam->tan_half_fov;
+        for (s32 c = c0; c < c1; c++) {
+            f32 sx = (2.0f * (c + 0.5f) / job->w - 1.0f) * cam->tan_half_fov * aspect;
+            f32 dir[3];
+            f32 len = 0.0f;
+            for (s32 a = 0; a < 3; a++) {
+                dir[a] = cam->forward[a] + sx * cam->right[a] + sy * cam->up[a];
+                len += dir[a] * dir[a];
+            }
+            len = sqrtf(len);
+            for (s32 a = 0; a < 3; a++) {
+                dir[a] /= len;
+            }
+            f32 acc[4];
+            bool stopped;
+            cast_ray(job, cam->eye, dir, acc, &samples, &skipped, &stopped);
+            terminated += stopped;
+            u8* px = &job->rgba[((size_t)r * job->w + c) * 4];
+            for (s32 k = 0; k < 3; k++) {
+                f32 v = acc[k] + (1.0f - acc[3]) * job->background[k];
+                px[k] = (u8)lrintf(fminf(fmaxf(v, 0.0f), 1.0f) * 255.0f);
+            }
+            px[3] = 255;
+        }
+    }
+    atomic_fetch_add_explicit(&job->samples, samples, memory_order_relaxed);
+    atomic_fetch_add_explicit(&job->skipped, skipped, memory_order_relaxed);
+    atomic_fetch_add_explicit(&job->terminated, terminated, memory_order_relaxed);
+}
+
+void raycast_render(const volume* vol, const raybricks* rb, const transferfn* tf, const raycamera* cam, f32 step,
+                    const u8 background[3], s32 h, s32 w, u8* rgba, raycast_stats* stats) {
+    raycast_job* job = calloc(1, sizeof(raycast_job));
+    *job = (raycast_job){
+        .vol = vol, .rb = rb, .cam = cam, .step = step, .h = h, .w = w,
+        .tiles_x = (w + RAY_TILE - 1) / RAY_TILE, .rgba = rgba,
+    };
+    // Opacities are per voxel of material; correct them for the sample spacing
+    for (s32 v = 0; v < 256; v++) {
+        f32 a = 1.0f - powf(1.0f - fminf(tf->rgba[v][3], 1.0f), step);
+        job->alpha[v] = a;
+        for (s32 k = 0; k < 3; k++) {
+            job->color[v][k] = tf->rgba[v][k] * a;
+        }
+        job->visible[v + 1] = job->visible[v] + (a > 0.0f);
+    }
+    for (s32 k = 0; k < 3; k++) {
+        job->background[k] = background[k] / 255.0f;
+    }
+    s32 tiles = job->tiles_x * ((h + RAY_TILE - 1) / RAY_TILE);
+    parallel_for(tiles, render_tile_fn, job);
+    if (stats) {
+        stats->samples = atomic_load(&job->samples);
+        stats->skipped_bricks = atomic_load(&job->skipped);
+        stats->terminated_rays = atomic_load(&job->terminated);
+    }
+    free(job);
+}
@@ -0,0 +1,332 @@
+#include "vcr.h"
+
+// Quadric-error mesh simplification (Garland & Heckbert).
+// Every vertex carries the area-weighted sum of the planes of its triangles,
+// so the error of moving it is the mean squared distance to those planes.
+// Edges collapse onto one of their endpoints, cheapest first, which keeps the
+// surviving vertices' quantized positions, normals and values exact. Each pass
+// collapses an independent set of edges (no vertex or ring changes twice) and
+// passes repeat until the triangle target or the error bound is reached.
+// Vertices on open or non-manifold edges never move: in a chunk mesh those are
+// the seam vertices on the chunk faces, so simplified neighbours still meet.
+
+typedef struct quadric {
+    f64 q[10];  // xx xy xz xd yy yz yd zz zd dd of the plane sum
+    f64 w;      // total area
+} quadric;
+
+typedef struct collapse {
+    f32 cost;
+    u32 from, to;
+} collapse;
+
+typedef struct simplifier {
+    f32 (*pos)[3];     // vertex positions in voxels from the mesh origin
+    quadric* quadrics;
+    bool* locked;
+    bool* dirty;       // touched by a collapse during the current pass
+    u32* tris;         // 3 per triangle; dead triangles have tris[0] == UINT32_MAX
+    s32 num_tris;
+    u32* first;        // vertex -> triangles, CSR over the triangles of the current pass
+    u32* adj;
+} simplifier;
+
+static void triangle_normal(const f32 a[3], const f32 b[3], const f32 c[3], f64 n[3]) {
+    f64 e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    f64 e1[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+    n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+    n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+static void quadric_add_triangle(quadric* q, const f32 a[3], const f32 b[3], const f32 c[3]) {
+    f64 n[3];
+    triangle_normal(a, b, c, n);
+    f64 len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len <= 0.0) return;
+    f64 area = len * 0.5;
+    n[0] /= len;
+    n[1] /= len;
+    n[2] /= len;
+    f64 d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+    f64 p[4] = {n[0], n[1], n[2], d};
+    s32 k = 0;
+    for (s32 i = 0; i < 4; i++) {
+        for (s32 j = i; j < 4; j++) {
+            q->q[k++] += area * p[i] * p[j];
+        }
+    }
+    q->w += area;
+}
+
+static void quadric_merge(quadric* dst, const quadric* src) {
+    for (s32 k = 0; k < 10; k++) {
+        dst->q[k] += src->q[k];
+    }
+    dst->w += src->w;
+}
+
+// Mean squared distance from p to the planes summed in a and b
+static f64 quadric_error(const quadric* a, const quadric* b, const f32 p[3]) {
+    f64 q[10];
+    for (s32 k = 0; k < 10; k++) {
+        q[k] = a->q[k] + b->q[k];
+    }
+    f64 w = a->w + b->w;
+    if (w <= 0.0) return 0.0;
+    f64 x = p[0], y = p[1], z = p[2];
+    f64 e = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+          + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+          + q[7] * z * z + 2 * q[8] * z + q[9];
+    return fmax(e, 0.0) / w;
+}
+
+static int collapse_cmp(const void* a, const void* b) {
+    f32 ca = ((const collapse*)a)->cost, cb = ((const collapse*)b)->cost;
+    return (ca > cb) - (ca < cb);
+}
+
+static int u64_cmp(const void* a, const void* b) {
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorted (lo << 32 | hi) keys of every triangle edge, one per triangle side
+static u64* triangle_edges(const u32* tris, s32 num_tris) {
+    u64* edges = malloc((size_t)num_tris * 3 * sizeof(u64));
+    for (s32 t = 0; t < num_tris; t++) {
+        for (s32 k = 0; k < 3; k++) {
+            u64 a = tris[t * 3 + k], b = tris[t * 3 + (k + 1) % 3];
+            edges[t * 3 + k] = a < b ? a << 32 | b : b << 32 | a;
+        }
+    }
+    qsort(edges, (size_t)num_tris * 3, sizeof(u64), u64_cmp);
+    return edges;
+}
+
+static void build_adjacency(simplifier* s, s32 num_vertices) {
+    memset(s->first, 0, (size_t)(num_vertices + 1) * sizeof(u32));
+    for (s32 i = 0; i < s->num_tris * 3; i++) {
+        s->first[s->tris[i] + 1]++;
+    }
+    for (s32 v = 0; v < num_vertices; v++) {
+        s->first[v + 1] += s->first[v];
+    }
+    for (s32 t = 0; t < s->num_tris; t++) {
+        for (s32 k = 0; k < 3; k++) {
+            s->adj[s->first[s->tris[t * 3 + k]]++] = (u32)t;
+        }
+    }
+    // The fill loop advanced every start to the next vertex's start
+    for (s32 v = num_vertices; v > 0; v--) {
+        s->first[v] = s->first[v - 1];
+    }
+    s->first[0] = 0;
+}
+
+static bool triangle_has(const u32* t, u32 v) {
+    return t[0] == v || t[1] == v || t[2] == v;
+}
+
+// Whether moving vertex from onto its neighbour to keeps the surface a
+// manifold and turns none of the surviving triangles over
+static bool collapse_valid(const simplifier* s, u32 from, u32 to) {
+    // Link condition: an interior edge may share exactly its two opposite vertices
+    s32 shared = 0;
+    for (u32 i = s->first[from]; i < s->first[from + 1]; i++) {
+        const u32* t = &s->tris[s->adj[i] * 3];
+        for (s32 k = 0; k < 3; k++) {
+            u32 u = t[k];
+            if (u == from || u == to) continue;
+            // Count each neighbour once: skip it if an earlier triangle had it
+            bool seen = false;
+            for (u32 j = s->first[from]; j < i && !seen; j++) {
+                seen = triangle_has(&s->tris[s->adj[j] * 3], u);
+            }
+            if (seen) continue;
+            bool adjacent = false;
+            for (u32 j = s->first[to]; j < s->first[to + 1] && !adjacent; j++) {
+                adjacent = triangle_has(&s->tris[s->adj[j] * 3], u);
+            }
+            shared += adjacent;
+            // A new edge between two locked vertices would be a chord across the seam, which
+            // the neighbouring chunk's mesh could grow as well
+            if (!adjacent && s->locked[u] && s->locked[to]) return false;
+        }
+    }
+    if (shared != 2) return false;
+
+    for (u32 i = s->first[from]; i < s->first[from + 1]; i++) {
+        const u32* t = &s->tris[s->adj[i] * 3];
+        if (triangle_has(t, to)) continue;
+        f32 moved[3][3];
+        for (s32 k = 0; k < 3; k++) {
+            memcpy(moved[k], s->pos[t[k] == from ? to : t[k]], sizeof(moved[k]));
+        }
+        f64 before[3], after[3];
+        triangle_normal(s->pos[t[0]], s->pos[t[1]], s->pos[t[2]], before);
+        triangle_normal(moved[0], moved[1], moved[2], after);
+        // Triangles that already have no area (vertices on a voxel corner) have no side to flip to
+        f64 dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+        f64 area = before[0] * before[0] + before[1] * before[1] + before[2] * before[2];
+        if (area > 0.0 && dot <= 0.0) return false;
+    }
+    return true;
+}
+
+static void apply_collapse(simplifier* s, u32 from, u32 to) {
+    for (u32 i = s->first[from]; i < s->first[from + 1]; i++) {
+        u32* t = &s->tris[s->adj[i] * 3];
+        if (t[0] == UINT32_MAX) continue;
+        s->dirty[t[0]] = s->dirty[t[1]] = s->dirty[t[2]] = true;
+        if (triangle_has(t, to)) {
+            t[0] = UINT32_MAX;
+            continue;
+        }
+        for (s32 k = 0; k < 3; k++) {
+            if (t[k] == from) t[k] = to;
+        }
+    }
+    quadric_merge(&s->quadrics[to], &s->quadrics[from]);
+}
+
+mesh mesh_simplify(const mesh* m, s32 target_triangles, f32 max_error, f32* error) {
+    mesh result = {.origin = {m->origin[0], m->origin[1], m->origin[2]}, .scale = m->scale};
+    f64 max_cost = 0.0;
+    if (error) *error = 0.0f;
+    if (m->num_triangles <= 0) return result;
+
+    s32 nv = m->num_vertices;
+    simplifier s = {
+        .pos = malloc((size_t)nv * sizeof(f32[3])),
+        .quadrics = calloc(nv, sizeof(quadric)),
+        .locked = calloc(nv, sizeof(bool)),
+        .dirty = malloc((size_t)nv * sizeof(bool)),
+        .tris = malloc((size_t)m->num_triangles * 3 * sizeof(u32)),
+        .num_tris = m->num_triangles,
+        .first = malloc((size_t)(nv + 1) * sizeof(u32)),
+        .adj = malloc((size_t)m->num_triangles * 3 * sizeof(u32)),
+    };
+    memcpy(s.tris, m->indices, (size_t)m->num_triangles * 3 * sizeof(u32));
+    for (s32 v = 0; v < nv; v++) {
+        for (s32 k = 0; k < 3; k++) {
+            s.pos[v][k] = m->vertices[v].pos[k] * m->scale;
+        }
+    }
+    for (s32 t = 0; t < s.num_tris; t++) {
+        const u32* tri = &s.tris[t * 3];
+        for (s32 k = 0; k < 3; k++) {
+            quadric_add_triangle(&s.quadrics[tri[k]], s.pos[tri[0]], s.pos[tri[1]], s.pos[tri[2]]);
+        }
+    }
+
+    // Lock the ends of every edge not shared by exactly two triangles
+    u64* edges = triangle_edges(s.tris, s.num_tris);
+    for (s32 i = 0, ne = s.num_tris * 3; i < ne;) {
+        s32 j = i;
+        while (j < ne && edges[j] == edges[i]) j++;
+        if (j - i != 2) {
+            s.locked[edges[i] >> 32] = true;
+            s.locked[edges[i] & UINT32_MAX] = true;
+        }
+        i = j;
+    }
+    free(edges);
+
+    f64 limit = (f64)max_error * max_error;
+    collapse* candidates = malloc((size_t)s.num_tris * 3 * sizeof(collapse));
+    while (target_triangles <= 0 || s.num_tris > target_triangles) {
+        build_adjacency(&s, nv);
+
+        // Cheapest direction of every unique edge that may collapse
+        edges = triangle_edges(s.tris, s.num_tris);
+        s32 count = 0;
+        for (s32 i = 0; i < s.num_tris * 3; i++) {
+            if (i > 0 && edges[i] == edges[i - 1]) continue;
+            u32 a = (u32)(edges[i] >> 32), b = (u32)(edges[i] & UINT32_MAX);
+            f64 ab = s.locked[a] ? INFINITY : quadric_error(&s.quadrics[a], &s.quadrics[b], s.pos[b]);
+            f64 ba = s.locked[b] ? INFINITY : quadric_error(&s.quadrics[a], &s.quadrics[b], s.pos[a]);
+            f64 cost = fmin(ab, ba);
+            if (cost > limit || isinf(cost)) continue;
+            candidates[count++] = ab <= ba ? (collapse){(f32)cost, a, b} : (collapse){(f32)cost, b, a};
+        }
+        free(edges);
+        qsort(candidates, count, sizeof(collapse), collapse_cmp);
+
+        memset(s.dirty, 0, (size_t)nv * sizeof(bool));
+        s32 remaining = s.num_tris, collapsed = 0;
+        for (s32 i = 0; i < count; i++) {
+            if (target_triangles > 0 && remaining <= target_triangles) break;
+            const collapse* c = &candidates[i];
+            if (s.dirty[c->from] || s.dirty[c->to] || !collapse_valid(&s, c->from, c->to)) continue;
+            apply_collapse(&s, c->from, c->to);
+            remaining -= 2;
+            collapsed++;
+            if (c->cost > max_cost) max_cost = c->cost;
+        }
+
+        s32 live = 0;
+        for (s32 t = 0; t < s.num_tris; t++) {
+            if (s.tris[t * 3] == UINT32_MAX) continue;
+            memmove(&s.tris[live * 3], &s.tris[t * 3], 3 * sizeof(u32));
+            live++;
+        }
+        s.num_tris = live;
+        if (collapsed == 0) break;
+    }
+    free(candidates);
+
+    // Keep the vertices still referenced, in their original order
+    u32* remap = s.first;
+    memset(remap, 0xff, (size_t)nv * sizeof(u32));
+    for (s32 i = 0; i < s.num_tris * 3; i++) {
+        remap[s.tris[i]] = 0;
+    }
+    result.value_min = 255;
+    for (s32 v = 0; v < nv; v++) {
+        if (remap[v] == UINT32_MAX) continue;
+        remap[v] = (u32)result.num_vertices++;
+        u8 value = m->vertices[v].value;
+        if (value < result.value_min) result.value_min = value;
+        if (value > result.value_max) result.value_max = value;
+    }
+    result.num_triangles = s.num_tris;
+    result.vertices = malloc((size_t)result.num_vertices * sizeof(mesh_vertex));
+    result.indices = malloc((size_t)result.num_triangles * 3 * sizeof(u32));
+    for (s32 v = 0; v < nv; v++) {
+        if (remap[v] != UINT32_MAX) result.vertices[remap[v]] = m->vertices[v];
+    }
+    for (s32 i = 0; i < s.num_tris * 3; i++) {
+        result.indices[i] = remap[s.tris[i]];
+    }
+
+    free(s.pos);
+    free(s.quadrics);
+    free(s.locked);
+    free(s.dirty);
+    free(s.tris);
+    free(s.first);
+    free(s.adj);
+    if (error) *error = (f32)sqrt(max_cost);
+    mesh_bounds(&result);
+    return result;
+}
+
+void meshlods_build(meshlods* lods, mesh m, f32 cell) {
+    *lods = (meshlods){.levels[0] = m};
+    // Each level aims for a quarter of the triangles of the one before, within
+    // an error bound that doubles per level
+    for (s32 k = 1; k < MESH_DETAIL_LEVELS; k++) {
+        const mesh* prev = &lods->levels[k - 1];
+        f32 e;
+        lods->levels[k] = mesh_simplify(prev, prev->num_triangles / 4 > 0 ? prev->num_triangles / 4 : 1,
+                                        cell * 0.5f * (f32)(1 << (k - 1)), &e);
+        lods->error[k] = lods->error[k - 1] + e;
+    }
+}
+
+void meshlods_free(meshlods* lods) {
+    for (s32 k = 0; k < MESH_DETAIL_LEVELS; k++) {
+        mesh_free(&lods->levels[k]);
+    }
+}
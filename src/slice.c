@@ -0,0 +1,527 @@
+#include "vcr.h"
+
+// Oblique reslicing.
+// The plane is cut into pieces, one per chunk it passes through. Each chunk is
+// looked up once per slice and then sampled for every output pixel whose
+// sample point falls inside it, so reads stay within one 2 MiB chunk at a time
+// instead of hopping between chunks pixel by pixel.
+
+constexpr s32 RESLICE_BAND = 32;  // rows per work item
+
+typedef struct reslice_piece {
+    const chunk* data;
+    s32 origin[3];   // voxel position of the chunk
+    s32 r0, r1;      // rows touched by this piece
+    s32* spans;      // [r1 - r0][2] conservative column range per row
+} reslice_piece;
+
+typedef struct reslice_item {
+    s32 piece;
+    s32 r0, r1;
+} reslice_item;
+
+typedef struct reslice_job {
+    const volume* vol;
+    const plane* p;
+    interp mode;
+    f32 origin[3];   // plane origin, shifted by +0.5 for nearest sampling
+    s32 w;
+    u8* out;
+    reslice_piece* pieces;
+    reslice_item* items;
+} reslice_job;
+
+// Sample at an already biased position anywhere in the volume. Used for the
+// few pixels whose footprint crosses a chunk boundary.
+static u8 sample_global(const volume* vol, f32 z, f32 y, f32 x, interp mode) {
+    s32 extent[3] = {vol->z * CHUNK_LEN, vol->y * CHUNK_LEN, vol->x * CHUNK_LEN};
+    s32 iz = (s32)floorf(z), iy = (s32)floorf(y), ix = (s32)floorf(x);
+    if (iz < 0 || iy < 0 || ix < 0 || iz >= extent[0] || iy >= extent[1] || ix >= extent[2]) {
+        return 0;
+    }
+
+#define VOXEL(zz, yy, xx) \
+    ((*volume_chunk(vol, (zz) / CHUNK_LEN, (yy) / CHUNK_LEN, (xx) / CHUNK_LEN)) \
+        [(zz) % CHUNK_LEN][(yy) % CHUNK_LEN][(xx) % CHUNK_LEN])
+
+    if (mode == INTERP_NEAREST) {
+        return VOXEL(iz, iy, ix);
+    }
+
+    f32 fz = z - iz, fy = y - iy, fx = x - ix;
+    s32 jz = iz + 1 < extent[0] ? iz + 1 : iz;
+    s32 jy = iy + 1 < extent[1] ? iy + 1 : iy;
+    s32 jx = ix + 1 < extent[2] ? ix + 1 : ix;
+
+    f32 c00 = VOXEL(iz, iy, ix) + fx * (VOXEL(iz, iy, jx) - VOXEL(iz, iy, ix));
+    f32 c01 = VOXEL(iz, jy, ix) + fx * (VOXEL(iz, jy, jx) - VOXEL(iz, jy, ix));
+    f32 c10 = VOXEL(jz, iy, ix) + fx * (VOXEL(jz, iy, jx) - VOXEL(jz, iy, ix));
+    f32 c11 = VOXEL(jz, jy, ix) + fx * (VOXEL(jz, jy, jx) - VOXEL(jz, jy, ix));
+#undef VOXEL
+
+    f32 c0 = c00 + fy * (c01 - c00);
+    f32 c1 = c10 + fy * (c11 - c10);
+    return (u8)(c0 + fz * (c1 - c0) + 0.5f);
+}
+
+// Truncate, then add the comparison mask (-1 per lane) where truncation rounded up.
+// A macro rather than a function so no 32-byte vector crosses a call boundary.
+#define FLOOR_S32X8(v) \
+    (__builtin_convertvector((v), s32x8) + \
+     ((v) < __builtin_convertvector(__builtin_convertvector((v), s32x8), f32x8)))
+
+static void reslice_row(const reslice_job* job, const reslice_piece* pc, s32 r, s32 c0, s32 c1) {
+    const f32* u = job->p->u;
+    const f32* v = job->p->v;
+    f32 bz = job->origin[0] + (f32)r * v[0];
+    f32 by = job->origin[1] + (f32)r * v[1];
+    f32 bx = job->origin[2] + (f32)r * v[2];
+    s32 hi = job->mode == INTERP_NEAREST ? CHUNK_LEN : CHUNK_LEN - 1;
+    u8* out = job->out + (s64)r * job->w;
+    const s32x8 lane = {0, 1, 2, 3, 4, 5, 6, 7};
+
+    // The tail runs through the same vector arithmetic with its extra lanes
+    // masked off, so every pixel's position is computed by one expression and
+    // ownership between neighbouring pieces is exact.
+    for (s32 c = c0; c < c1; c += 8) {
+        s32x8 col = lane + c;
+        f32x8 cf = __builtin_convertvector(col, f32x8);
+        f32x8 pz = bz + cf * u[0];
+        f32x8 py = by + cf * u[1];
+        f32x8 px = bx + cf * u[2];
+        s32x8 lz = FLOOR_S32X8(pz) - pc->origin[0];
+        s32x8 ly = FLOOR_S32X8(py) - pc->origin[1];
+        s32x8 lx = FLOOR_S32X8(px) - pc->origin[2];
+
+        s32x8 owned = (col < c1) & (lz >= 0) & (lz < CHUNK_LEN) & (ly >= 0) & (ly < CHUNK_LEN) &
+                      (lx >= 0) & (lx < CHUNK_LEN);
+        s32x8 fast = owned & (lz < hi) & (ly < hi) & (lx < hi);
+
+        if (job->mode == INTERP_NEAREST) {
+            for (s32 i = 0; i < 8; i++) {
+                if (fast[i]) out[c + i] = (*pc->data)[lz[i]][ly[i]][lx[i]];
+            }
+            continue;
+        }
+
+        f32x8 fz = pz - __builtin_convertvector(lz + pc->origin[0], f32x8);
+        f32x8 fy = py - __builtin_convertvector(ly + pc->origin[1], f32x8);
+        f32x8 fx = px - __builtin_convertvector(lx + pc->origin[2], f32x8);
+        f32x8 v000 = {0}, v001 = {0}, v010 = {0}, v011 = {0};
+        f32x8 v100 = {0}, v101 = {0}, v110 = {0}, v111 = {0};
+        for (s32 i = 0; i < 8; i++) {
+            if (!fast[i]) continue;
+            const u8* p0 = &(*pc->data)[lz[i]][ly[i]][lx[i]];
+            const u8* p1 = p0 + CHUNK_LEN * CHUNK_LEN;
+            v000[i] = p0[0];
+            v001[i] = p0[1];
+            v010[i] = p0[CHUNK_LEN];
+            v011[i] = p0[CHUNK_LEN + 1];
+            v100[i] = p1[0];
+            v101[i] = p1[1];
+            v110[i] = p1[CHUNK_LEN];
+            v111[i] = p1[CHUNK_LEN + 1];
+        }
+        f32x8 c00 = v000 + fx * (v001 - v000);
+        f32x8 c01 = v010 + fx * (v011 - v010);
+        f32x8 c10 = v100 + fx * (v101 - v100);
+        f32x8 c11 = v110 + fx * (v111 - v110);
+        f32x8 s0 = c00 + fy * (c01 - c00);
+        f32x8 s1 = c10 + fy * (c11 - c10);
+        s32x8 res = __builtin_convertvector(s0 + fz * (s1 - s0) + 0.5f, s32x8);
+
+        for (s32 i = 0; i < 8; i++) {
+            if (fast[i]) {
+                out[c + i] = (u8)res[i];
+            } else if (owned[i]) {
+                out[c + i] = sample_global(job->vol, pz[i], py[i], px[i], job->mode);
+            }
+        }
+    }
+}
+
+static void reslice_item_fn(void* ctx, s32 i) {
+    const reslice_job* job = ctx;
+    const reslice_item* it = &job->items[i];
+    const reslice_piece* pc = &job->pieces[it->piece];
+    for (s32 r = it->r0; r < it->r1; r++) {
+        const s32* span = &pc->spans[(r - pc->r0) * 2];
+        if (span[0] < span[1]) {
+            reslice_row(job, pc, r, span[0], span[1]);
+        }
+    }
+}
+
+// Columns c of row r with lo <= base + c*step < hi, widened by a pixel on each
+// side; the kernel decides exact ownership per pixel.
+static void span_clip(f32 base, f32 step, f32 lo, f32 hi, f64* c0, f64* c1) {
+    if (fabsf(step) < 1e-12f) {
+        if (base < lo - 1.0f || base >= hi + 1.0f) *c1 = *c0;
+        return;
+    }
+    f64 a = (lo - base) / (f64)step;
+    f64 b = (hi - base) / (f64)step;
+    if (a > b) { f64 t = a; a = b; b = t; }
+    if (a - 1.0 > *c0) *c0 = a - 1.0;
+    if (b + 1.0 < *c1) *c1 = b + 1.0;
+}
+
+err reslice_plane(const volume* vol, const plane* p, s32 h, s32 w, interp mode, u8* out) {
+    if (!vol || !p || !out || h <= 0 || w <= 0) {
+        return FAIL;
+    }
+    memset(out, 0, (size_t)h * w);
+
+    reslice_job job = {
+        .vol = vol,
+        .p = p,
+        .mode = mode,
+        .w = w,
+        .out = out,
+    };
+    f32 bias = mode == INTERP_NEAREST ? 0.5f : 0.0f;
+    for (s32 a = 0; a < 3; a++) {
+        job.origin[a] = p->origin[a] + bias;
+    }
+
+    // chunk range covered by the plane's corners
+    s32 lo[3], hi[3];
+    s32 dims[3] = {vol->z, vol->y, vol->x};
+    for (s32 a = 0; a < 3; a++) {
+        f32 corners[4] = {
+            job.origin[a],
+            job.origin[a] + (w - 1) * p->u[a],
+            job.origin[a] + (h - 1) * p->v[a],
+            job.origin[a] + (w - 1) * p->u[a] + (h - 1) * p->v[a],
+        };
+        f32 mn = corners[0], mx = corners[0];
+        for (s32 i = 1; i < 4; i++) {
+            mn = fminf(mn, corners[i]);
+            mx = fmaxf(mx, corners[i]);
+        }
+        lo[a] = (s32)floorf((mn - 1.0f) / CHUNK_LEN);
+        hi[a] = (s32)floorf((mx + 1.0f) / CHUNK_LEN) + 1;
+        if (lo[a] < 0) lo[a] = 0;
+        if (hi[a] > dims[a]) hi[a] = dims[a];
+        if (lo[a] >= hi[a]) return OK;
+    }
+
+    s32 max_pieces = (hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+    job.pieces = calloc(max_pieces, sizeof(reslice_piece));
+    s32* spans = malloc(sizeof(s32) * 2 * h);
+    s32 num_pieces = 0, num_items = 0;
+
+    for (s32 cz = lo[0]; cz < hi[0]; cz++) {
+        for (s32 cy = lo[1]; cy < hi[1]; cy++) {
+            for (s32 cx = lo[2]; cx < hi[2]; cx++) {
+                s32 origin[3] = {cz * CHUNK_LEN, cy * CHUNK_LEN, cx * CHUNK_LEN};
+                s32 r0 = h, r1 = 0;
+                for (s32 r = 0; r < h; r++) {
+                    f64 c0 = 0, c1 = w;
+                    for (s32 a = 0; a < 3 && c0 < c1; a++) {
+                        f32 base = job.origin[a] + (f32)r * p->v[a];
+                        span_clip(base, p->u[a], (f32)origin[a], (f32)(origin[a] + CHUNK_LEN), &c0, &c1);
+                    }
+                    spans[r * 2 + 0] = (s32)ceil(c0);
+                    spans[r * 2 + 1] = c1 > c0 ? (s32)ceil(c1) : (s32)ceil(c0);
+                    if (spans[r * 2 + 1] > w) spans[r * 2 + 1] = w;
+                    if (spans[r * 2 + 0] < spans[r * 2 + 1]) {
+                        if (r < r0) r0 = r;
+                        r1 = r + 1;
+                    }
+                }
+                if (r0 >= r1) continue;
+
+                reslice_piece* pc = &job.pieces[num_pieces++];
+                pc->data = volume_chunk(vol, cz, cy, cx);
+                memcpy(pc->origin, origin, sizeof(origin));
+                pc->r0 = r0;
+                pc->r1 = r1;
+                pc->spans = malloc(sizeof(s32) * 2 * (r1 - r0));
+                memcpy(pc->spans, &spans[r0 * 2], sizeof(s32) * 2 * (r1 - r0));
+                num_items += (r1 - r0 + RESLICE_BAND - 1) / RESLICE_BAND;
+            }
+        }
+    }
+    free(spans);
+
+    job.items = malloc(sizeof(reslice_item) * (num_items ? num_items : 1));
+    s32 n = 0;
+    for (s32 i = 0; i < num_pieces; i++) {
+        for (s32 r = job.pieces[i].r0; r < job.pieces[i].r1; r += RESLICE_BAND) {
+            s32 end = r + RESLICE_BAND;
+            job.items[n++] = (reslice_item){
+                .piece = i,
+                .r0 = r,
+                .r1 = end < job.pieces[i].r1 ? end : job.pieces[i].r1,
+            };
+        }
+    }
+
+    parallel_for(num_items, reslice_item_fn, &job);
+
+    for (s32 i = 0; i < num_pieces; i++) {
+        free(job.pieces[i].spans);
+    }
+    free(job.pieces);
+    free(job.items);
+    return OK;
+}
+
+const s32 view_axes[3][2] = {
+    {1, 2}, // XY view: rows Y, columns X
+    {0, 2}, // XZ view: rows Z, columns X
+    {0, 1}, // YZ view: rows Z, columns Y
+};
+
+void window_level_lut(u8 level, u16 window, u8 lut[256]) {
+    // level - window/2 maps to black and the window's last value to white,
+    // so level 128 / window 256 is the identity
+    f32 lo = level - window / 2.0f;
+    f32 range = window > 1 ? window - 1 : 1;
+    for (s32 i = 0; i < 256; i++) {
+        f32 g = (i - lo) * 255.0f / range;
+        lut[i] = (u8)fminf(255.0f, fmaxf(0.0f, g + 0.5f));
+    }
+}
+
+static s32 floor_div(s32 a, s32 b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Chunks (global coords, hi exclusive) whose voxels a tile samples
+void slice_tile_footprint(const tilekey* key, s32 deps_lo[3], s32 deps_hi[3]) {
+    s32 span = TILE_LEN << key->lod;
+    s32 row_axis = view_axes[key->axis][0];
+    s32 col_axis = view_axes[key->axis][1];
+    deps_lo[key->axis] = floor_div(key->plane, CHUNK_LEN);
+    deps_hi[key->axis] = deps_lo[key->axis] + 1;
+    deps_lo[row_axis] = floor_div(key->ty * span, CHUNK_LEN);
+    deps_hi[row_axis] = floor_div((key->ty + 1) * span - 1, CHUNK_LEN) + 1;
+    deps_lo[col_axis] = floor_div(key->tx * span, CHUNK_LEN);
+    deps_hi[col_axis] = floor_div((key->tx + 1) * span - 1, CHUNK_LEN) + 1;
+}
+
+// Tile pixel (i, j) is the voxel at the top-left of its 2^lod block, mapped
+// through the window/level table.
+void slice_render_tile(const volume* vol, const s32 vol_origin[3], const tilekey* key, const u8 lut[256], u8* out) {
+    s32 step = 1 << key->lod;
+    s32 span = TILE_LEN * step;
+    s32 row_axis = view_axes[key->axis][0];
+    s32 col_axis = view_axes[key->axis][1];
+
+    plane p = {0};
+    p.origin[key->axis] = (f32)(key->plane - vol_origin[key->axis]);
+    p.origin[row_axis] = (f32)(key->ty * span - vol_origin[row_axis]);
+    p.origin[col_axis] = (f32)(key->tx * span - vol_origin[col_axis]);
+    p.v[row_axis] = (f32)step;
+    p.u[col_axis] = (f32)step;
+
+    reslice_plane(vol, &p, TILE_LEN, TILE_LEN, INTERP_NEAREST, out);
+    for (s32 i = 0; i < TILE_LEN * TILE_LEN; i++) {
+        out[i] = lut[out[i]];
+    }
+}
+
+// Slab projections.
+// The slab's planes are kept in a ring buffer next to the running result. When
+// the slab slides by one plane the entering plane overwrites the leaving one's
+// slot: the mean adjusts its running sum, max/min fold the entering value in
+// and only rescan the ring for pixels whose extreme was the value that left.
+
+typedef struct slab_job {
+    slabproj* sp;
+    const u8* leaving;   // nullptr for a full rebuild
+    const u8* entering;
+} slab_job;
+
+// unaligned 32-byte load; a macro for the same -Wpsabi reason as FLOOR_S32X8
+#define LOAD_U8X32(dst, p) memcpy(&(dst), (p), sizeof(u8x32))
+
+static u8 slab_rescan(const slabproj* sp, s64 idx) {
+    size_t plane = (size_t)sp->h * sp->w;
+    u8 r = sp->ring[idx];
+    for (s32 k = 1; k < sp->thickness; k++) {
+        u8 v = sp->ring[k * plane + idx];
+        r = sp->reducer == SLAB_MAX ? (v > r ? v : r) : (v < r ? v : r);
+    }
+    return r;
+}
+
+static void slab_row_fn(void* ctx, s32 row) {
+    const slab_job* job = ctx;
+    slabproj* sp = job->sp;
+    size_t plane = (size_t)sp->h * sp->w;
+    s64 base = (s64)row * sp->w;
+    u8* res = sp->result + base;
+    u32* sum = sp->sum + base;
+    s32 x = 0;
+
+    if (sp->reducer == SLAB_MEAN) {
+        // running sums are kept even on a rebuild so the next slide is incremental
+        if (!job->leaving) {
+            memset(sum, 0, sizeof(u32) * sp->w);
+            for (s32 k = 0; k < sp->thickness; k++) {
+                const u8* src = sp->ring + k * plane + base;
+                for (x = 0; x + 8 <= sp->w; x += 8) {
+                    u8x8 v;
+                    memcpy(&v, src + x, sizeof(v));
+                    u32x8 acc;
+                    memcpy(&acc, sum + x, sizeof(acc));
+                    acc += __builtin_convertvector(v, u32x8);
+                    memcpy(sum + x, &acc, sizeof(acc));
+                }
+                for (; x < sp->w; x++) sum[x] += src[x];
+            }
+        } else {
+            const u8* in = job->entering + base;
+            const u8* out = job->leaving + base;
+            for (x = 0; x + 8 <= sp->w; x += 8) {
+                u8x8 vi, vo;
+                memcpy(&vi, in + x, sizeof(vi));
+                memcpy(&vo, out + x, sizeof(vo));
+                u32x8 acc;
+                memcpy(&acc, sum + x, sizeof(acc));
+                acc += __builtin_convertvector(vi, u32x8) - __builtin_convertvector(vo, u32x8);
+                memcpy(sum + x, &acc, sizeof(acc));
+            }
+            for (; x < sp->w; x++) sum[x] += (u32)in[x] - out[x];
+        }
+        // divide by the constant thickness via a 16.16 reciprocal
+        u32 recip = (65536u + sp->thickness - 1) / sp->thickness;
+        for (x = 0; x < sp->w; x++) {
+            res[x] = (u8)((sum[x] * recip) >> 16);
+        }
+        return;
+    }
+
+    bool is_max = sp->reducer == SLAB_MAX;
+    if (!job->leaving) {
+        memcpy(res, sp->ring + base, sp->w);
+        for (s32 k = 1; k < sp->thickness; k++) {
+            const u8* src = sp->ring + k * plane + base;
+            for (x = 0; x + 32 <= sp->w; x += 32) {
+                u8x32 a, b;
+                LOAD_U8X32(a, res + x);
+                LOAD_U8X32(b, src + x);
+                u8x32 m = (u8x32)(is_max ? b > a : b < a);
+                u8x32 r = (b & m) | (a & ~m);
+                memcpy(res + x, &r, sizeof(r));
+            }
+            for (; x < sp->w; x++) {
+                res[x] = is_max ? (src[x] > res[x] ? src[x] : res[x]) : (src[x] < res[x] ? src[x] : res[x]);
+            }
+        }
+        return;
+    }
+
+    // Fold in the entering plane; a pixel whose extreme just left the slab and
+    // was not replaced by an equal-or-better entering value is rescanned.
+    const u8* in = job->entering + base;
+    const u8* out = job->leaving + base;
+    for (x = 0; x + 32 <= sp->w; x += 32) {
+        u8x32 a, vi, vo;
+        LOAD_U8X32(a, res + x);
+        LOAD_U8X32(vi, in + x);
+        LOAD_U8X32(vo, out + x);
+        u8x32 better = (u8x32)(is_max ? vi >= a : vi <= a);
+        u8x32 stale = (u8x32)(vo == a) & ~better;
+        u8x32 r = (vi & better) | (a & ~better);
+        memcpy(res + x, &r, sizeof(r));
+        u64 any = 0;
+        for (s32 i = 0; i < 32; i += 8) {
+            u64 part;
+            memcpy(&part, (const u8*)&stale + i, sizeof(part));
+            any |= part;
+        }
+        if (any) {
+            for (s32 i = 0; i < 32; i++) {
+                if (stale[i]) res[x + i] = slab_rescan(sp, base + x + i);
+            }
+        }
+    }
+    for (; x < sp->w; x++) {
+        bool better = is_max ? in[x] >= res[x] : in[x] <= res[x];
+        if (better) {
+            res[x] = in[x];
+        } else if (out[x] == res[x]) {
+            res[x] = slab_rescan(sp, base + x);
+        }
+    }
+}
+
+static void slab_extract(const volume* vol, const slabproj* sp, s32 p, u8* out) {
+    plane pl = {0};
+    pl.origin[sp->axis] = (f32)p;
+    pl.origin[view_axes[sp->axis][0]] = sp->row0;
+    pl.origin[view_axes[sp->axis][1]] = sp->col0;
+    pl.v[view_axes[sp->axis][0]] = sp->step;
+    pl.u[view_axes[sp->axis][1]] = sp->step;
+    reslice_plane(vol, &pl, sp->h, sp->w, INTERP_NEAREST, out);
+}
+
+// Projection of the `thickness` planes around `center` along `axis`, for a view
+// whose pixel (r, c) sits at (row0 + r*step, col0 + c*step). The slab is
+// clamped to the volume. Returns h*w pixels owned by sp.
+const u8* slabproj_update(slabproj* sp, const volume* vol, s32 axis, s32 center, s32 thickness, slab_reducer reducer,
+                          s32 h, s32 w, f32 row0, f32 col0, f32 step) {
+    s32 extent = (axis == 0 ? vol->z : axis == 1 ? vol->y : vol->x) * CHUNK_LEN;
+    if (thickness > extent) thickness = extent;
+    if (thickness < 1) thickness = 1;
+    s32 first = center - thickness / 2;
+    if (first > extent - thickness) first = extent - thickness;
+    if (first < 0) first = 0;
+
+    bool same = sp->valid && sp->axis == axis && sp->h == h && sp->w == w && sp->row0 == row0 &&
+                sp->col0 == col0 && sp->step == step && sp->thickness == thickness && sp->reducer == reducer;
+    size_t plane = (size_t)h * w;
+
+    if (same && first == sp->first) {
+        return sp->result;
+    }
+
+    if (!same || abs(first - sp->first) >= thickness) {
+        slabproj_free(sp);
+        *sp = (slabproj){
+            .axis = axis, .h = h, .w = w,
+            .row0 = row0, .col0 = col0, .step = step,
+            .thickness = thickness, .reducer = reducer,
+            .first = first, .valid = true,
+            .ring = malloc(plane * thickness),
+            .sum = reducer == SLAB_MEAN ? malloc(sizeof(u32) * plane) : nullptr,
+            .result = malloc(plane),
+        };
+        for (s32 k = 0; k < thickness; k++) {
+            s32 p = first + k;
+            slab_extract(vol, sp, p, sp->ring + (size_t)(p % thickness) * plane);
+        }
+        slab_job job = {sp, nullptr, nullptr};
+        parallel_for(h, slab_row_fn, &job);
+        return sp->result;
+    }
+
+    // Slide one plane at a time
+    u8* leaving = malloc(plane);
+    while (sp->first != first) {
+        bool forward = first > sp->first;
+        s32 enter = forward ? sp->first + thickness : sp->first - 1;
+        u8* slot = sp->ring + (size_t)(((enter % thickness) + thickness) % thickness) * plane;
+        memcpy(leaving, slot, plane);
+        slab_extract(vol, sp, enter, slot);
+
+        slab_job job = {sp, leaving, slot};
+        parallel_for(h, slab_row_fn, &job);
+        sp->first += forward ? 1 : -1;
+    }
+    free(leaving);
+    return sp->result;
+}
+
+void slabproj_free(slabproj* sp) {
+    if (sp) {
+        free(sp->ring);
+        free(sp->sum);
+        free(sp->result);
+        *sp = (slabproj){0};
+    }
+}
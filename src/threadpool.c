@@ -0,0 +1,146 @@
+#include "vcr.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// Persistent worker pool behind parallel_for.
+// Every call splits [0, count) into one contiguous range per participant (the
+// workers plus the calling thread). A participant drains its own range front to
+// back and then steals from the other ranges, so neighbouring items (rows,
+// slabs, tiles) stay on one core until the load becomes uneven.
+
+typedef struct workrange {
+    _Atomic s32 next;
+    s32 end;
+    char pad[64 - 2 * sizeof(s32)];  // keep each counter on its own cache line
+} workrange;
+
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t submit;  // one job at a time
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t* threads;
+    s32 num_threads;         // workers, not counting the caller
+
+    void (*fn)(void* ctx, s32 i);
+    void* ctx;
+    workrange* ranges;
+    s32 num_ranges;
+    u64 generation;
+    s32 busy;
+} pool = {
+    .once = PTHREAD_ONCE_INIT,
+    .submit = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+// Set on worker threads and on the caller while it runs a job; nested
+// parallel_for calls then run inline instead of deadlocking on the pool.
+static _Thread_local bool in_parallel;
+
+static void drain(s32 participant) {
+    for (s32 k = 0; k < pool.num_ranges; k++) {
+        workrange* r = &pool.ranges[(participant + k) % pool.num_ranges];
+        for (;;) {
+            s32 i = atomic_fetch_add_explicit(&r->next, 1, memory_order_relaxed);
+            if (i >= r->end) break;
+            pool.fn(pool.ctx, i);
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    s32 participant = (s32)(intptr_t)arg;
+    u64 seen = 0;
+    in_parallel = true;
+
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        while (pool.generation == seen) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        drain(participant);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return nullptr;
+}
+
+static void pool_init(void) {
+    s32 n = (s32)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* env = getenv("VCR_THREADS");
+    if (env && atoi(env) > 0) {
+        n = atoi(env);
+    }
+    if (n < 1) n = 1;
+
+    pool.num_threads = n - 1;
+    pool.ranges = calloc(n, sizeof(workrange));
+    pool.threads = calloc(n, sizeof(pthread_t));
+    for (s32 i = 0; i < pool.num_threads; i++) {
+        if (pthread_create(&pool.threads[i], nullptr, worker_main, (void*)(intptr_t)i) != 0) {
+            LOG_WARN("failed to start worker thread %d, continuing with %d\n", i, i);
+            pool.num_threads = i;
+            break;
+        }
+        pthread_detach(pool.threads[i]);
+    }
+}
+
+s32 parallel_thread_count(void) {
+    pthread_once(&pool.once, pool_init);
+    return pool.num_threads + 1;
+}
+
+void parallel_for(s32 count, void (*fn)(void* ctx, s32 i), void* ctx) {
+    if (count <= 0) return;
+    pthread_once(&pool.once, pool_init);
+
+    if (count == 1 || pool.num_threads == 0 || in_parallel) {
+        for (s32 i = 0; i < count; i++) {
+            fn(ctx, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool.submit);
+
+    s32 participants = pool.num_threads + 1;
+    s32 num_ranges = count < participants ? count : participants;
+    for (s32 r = 0; r < num_ranges; r++) {
+        atomic_store_explicit(&pool.ranges[r].next, (s32)((s64)count * r / num_ranges), memory_order_relaxed);
+        pool.ranges[r].end = (s32)((s64)count * (r + 1) / num_ranges);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.num_ranges = num_ranges;
+    pool.busy = pool.num_threads;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    in_parallel = true;
+    drain(pool.num_threads);
+    in_parallel = false;
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.submit);
+}
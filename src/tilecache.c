@@ -0,0 +1,156 @@
+#include "vcr.h"
+
+// Cache of rendered axis-aligned slice tiles.
+// Tiles live in a chained hash table and on an LRU list. Each tile remembers
+// the range of chunks its footprint covers so a reloaded or evicted chunk
+// only drops the tiles that were sampled from it.
+
+typedef struct tile {
+    tilekey key;
+    s32 deps_lo[3], deps_hi[3];  // chunk coords (z, y, x) of the footprint, hi exclusive
+    u64 stamp;                   // frame the tile was last touched
+    struct tile* hnext;          // hash chain
+    struct tile* prev;           // LRU list, head = most recent
+    struct tile* next;
+    u8 pixels[TILE_LEN * TILE_LEN];
+} tile;
+
+struct tilecache {
+    tile** buckets;
+    u32 num_buckets;
+    tile* head;
+    tile* tail;
+    size_t bytes;
+    size_t budget;
+    s32 count;
+    u64 stamp;
+};
+
+static u32 tilekey_hash(const tilekey* k) {
+    u32 h = 2166136261u;
+    s32 fields[7] = {k->axis, k->plane, k->tx, k->ty, k->lod, k->level, k->window};
+    for (s32 i = 0; i < 7; i++) {
+        h = (h ^ (u32)fields[i]) * 16777619u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+static bool tilekey_equal(const tilekey* a, const tilekey* b) {
+    return a->axis == b->axis && a->plane == b->plane && a->tx == b->tx && a->ty == b->ty &&
+           a->lod == b->lod && a->level == b->level && a->window == b->window;
+}
+
+static void lru_unlink(tilecache* tc, tile* t) {
+    if (t->prev) t->prev->next = t->next; else tc->head = t->next;
+    if (t->next) t->next->prev = t->prev; else tc->tail = t->prev;
+    t->prev = t->next = nullptr;
+}
+
+static void lru_push_front(tilecache* tc, tile* t) {
+    t->prev = nullptr;
+    t->next = tc->head;
+    if (tc->head) tc->head->prev = t;
+    tc->head = t;
+    if (!tc->tail) tc->tail = t;
+}
+
+static void tile_remove(tilecache* tc, tile* t) {
+    tile** link = &tc->buckets[tilekey_hash(&t->key) & (tc->num_buckets - 1)];
+    while (*link != t) {
+        link = &(*link)->hnext;
+    }
+    *link = t->hnext;
+    lru_unlink(tc, t);
+    tc->bytes -= sizeof(tile);
+    tc->count--;
+    free(t);
+}
+
+tilecache* tilecache_new(size_t budget_bytes) {
+    tilecache* tc = calloc(1, sizeof(tilecache));
+    tc->budget = budget_bytes;
+    // power of two, roughly one bucket per tile that fits the budget
+    tc->num_buckets = 64;
+    while (tc->num_buckets < budget_bytes / sizeof(tile)) {
+        tc->num_buckets *= 2;
+    }
+    tc->buckets = calloc(tc->num_buckets, sizeof(tile*));
+    return tc;
+}
+
+void tilecache_clear(tilecache* tc) {
+    while (tc->head) {
+        tile_remove(tc, tc->head);
+    }
+}
+
+void tilecache_free(tilecache* tc) {
+    if (tc) {
+        tilecache_clear(tc);
+        free(tc->buckets);
+        free(tc);
+    }
+}
+
+void tilecache_begin_frame(tilecache* tc) {
+    tc->stamp++;
+}
+
+const u8* tilecache_get(tilecache* tc, const tilekey* key) {
+    tile* t = tc->buckets[tilekey_hash(key) & (tc->num_buckets - 1)];
+    while (t && !tilekey_equal(&t->key, key)) {
+        t = t->hnext;
+    }
+    if (!t) return nullptr;
+    t->stamp = tc->stamp;
+    lru_unlink(tc, t);
+    lru_push_front(tc, t);
+    return t->pixels;
+}
+
+u8* tilecache_put(tilecache* tc, const tilekey* key, const s32 deps_lo[3], const s32 deps_hi[3]) {
+    // Evict least recently used tiles, but never one touched this frame: those
+    // pointers may still be in use by the caller. The budget is exceeded
+    // temporarily if the visible set alone is larger.
+    while (tc->tail && tc->bytes + sizeof(tile) > tc->budget && tc->tail->stamp != tc->stamp) {
+        tile_remove(tc, tc->tail);
+    }
+
+    tile* t = malloc(sizeof(tile));
+    t->key = *key;
+    memcpy(t->deps_lo, deps_lo, sizeof(t->deps_lo));
+    memcpy(t->deps_hi, deps_hi, sizeof(t->deps_hi));
+    t->stamp = tc->stamp;
+
+    u32 b = tilekey_hash(key) & (tc->num_buckets - 1);
+    t->hnext = tc->buckets[b];
+    tc->buckets[b] = t;
+    lru_push_front(tc, t);
+    tc->bytes += sizeof(tile);
+    tc->count++;
+    return t->pixels;
+}
+
+s32 tilecache_invalidate_chunk(tilecache* tc, s32 cz, s32 cy, s32 cx) {
+    s32 c[3] = {cz, cy, cx};
+    s32 dropped = 0;
+    tile* t = tc->head;
+    while (t) {
+        tile* next = t->next;
+        bool hit = true;
+        for (s32 a = 0; a < 3; a++) {
+            hit = hit && c[a] >= t->deps_lo[a] && c[a] < t->deps_hi[a];
+        }
+        if (hit) {
+            tile_remove(tc, t);
+            dropped++;
+        }
+        t = next;
+    }
+    return dropped;
+}
+
+size_t tilecache_bytes(const tilecache* tc) {
+    return tc->bytes;
+}
@@ -95,4 +95,122 @@ char* read_file(const char* filepath) {
 
   fclose(file);
   return content;
-}
\ No newline at end of file
+}
+
+f64 now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// PNG
+
+static void crc_init(u32 table[256]) {
+  for (u32 n = 0; n < 256; n++) {
+    u32 c = n;
+    for (s32 k = 0; k < 8; k++) {
+      c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    table[n] = c;
+  }
+}
+
+static u32 crc_update(const u32 table[256], u32 crc, const u8* p, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static void put_be32(u8* p, u32 v) {
+  p[0] = (u8)(v >> 24);
+  p[1] = (u8)(v >> 16);
+  p[2] = (u8)(v >> 8);
+  p[3] = (u8)v;
+}
+
+static void write_png_chunk(FILE* fp, const u32 crc_table[256], const char type[4], const u8* data, u32 len) {
+  u8 hdr[8];
+  put_be32(hdr, len);
+  memcpy(hdr + 4, type, 4);
+  u32 crc = crc_update(crc_table, 0xffffffffu, (const u8*)type, 4);
+  crc = crc_update(crc_table, crc, data, len) ^ 0xffffffffu;
+  u8 tail[4];
+  put_be32(tail, crc);
+  fwrite(hdr, 1, 8, fp);
+  fwrite(data, 1, len, fp);
+  fwrite(tail, 1, 4, fp);
+}
+
+// Stored (uncompressed) deflate blocks: the images are meant to be consumed by
+// other tools, and compressing them would cost more than rendering them.
+err write_png(const char* path, const u8* pixels, s32 h, s32 w, s32 channels) {
+  static const u8 color_types[5] = {0, 0, 0, 2, 6};
+  if (channels != 1 && channels != 3 && channels != 4) {
+    LOG_ERROR("unsupported channel count %d\n", channels);
+    return FAIL;
+  }
+  FILE* fp = fopen(path, "wb");
+  if (!fp) {
+    LOG_ERROR("failed to open %s for writing\n", path);
+    return FAIL;
+  }
+
+  // Per call, so frames can be written from several threads
+  u32 crc_table[256];
+  crc_init(crc_table);
+
+  static const u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  fwrite(signature, 1, 8, fp);
+
+  u8 ihdr[13] = {0};
+  put_be32(ihdr, (u32)w);
+  put_be32(ihdr + 4, (u32)h);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = color_types[channels];
+  write_png_chunk(fp, crc_table, "IHDR", ihdr, sizeof(ihdr));
+
+  // zlib stream: header, stored blocks of filter byte 0 + row, adler32
+  size_t row_len = (size_t)w * channels;
+  size_t raw_len = (size_t)h * (row_len + 1);
+  size_t num_blocks = (raw_len + 65534) / 65535;
+  size_t idat_len = 2 + raw_len + 5 * num_blocks + 4;
+  u8* idat = malloc(idat_len);
+  u8* dst = idat;
+  *dst++ = 0x78;
+  *dst++ = 0x01;
+
+  u32 s1 = 1, s2 = 0;
+  size_t block_left = 0;
+  size_t remaining = raw_len;
+  for (s32 r = 0; r < h; r++) {
+    for (s64 c = -1; c < (s64)row_len; c++) {
+      if (block_left == 0) {
+        block_left = remaining < 65535 ? remaining : 65535;
+        remaining -= block_left;
+        *dst++ = remaining == 0 ? 1 : 0;
+        *dst++ = (u8)block_left;
+        *dst++ = (u8)(block_left >> 8);
+        *dst++ = (u8)~block_left;
+        *dst++ = (u8)(~block_left >> 8);
+      }
+      u8 b = c < 0 ? 0 : pixels[(size_t)r * row_len + c];
+      *dst++ = b;
+      block_left--;
+      s1 += b;
+      if (s1 >= 65521) s1 -= 65521;
+      s2 += s1;
+      if (s2 >= 65521) s2 -= 65521;
+    }
+  }
+  put_be32(dst, (s2 << 16) | s1);
+  dst += 4;
+
+  write_png_chunk(fp, crc_table, "IDAT", idat, (u32)(dst - idat));
+  write_png_chunk(fp, crc_table, "IEND", nullptr, 0);
+  free(idat);
+
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok ? OK : FAIL;
+}
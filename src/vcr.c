@@ -6,6 +6,7 @@
 #include "sokol_gfx.h"
 #include "sokol_log.h"
 #include "sokol_glue.h"
+#include "sokol_time.h"
 
 // Nuklear configuration and headers
 #define NK_INCLUDE_FIXED_TYPES
@@ -20,6 +21,30 @@
 #include "sokol_nuklear.h"
 #include "sokol_gl.h"
 
+constexpr int RENDER_3D_SIZE = 512;  // pixels per side of the 3D view's render target
+constexpr int RAYCAST_3D_SIZE = 256; // pixels per side of the 3D view when volume rendering on the CPU
+
+// What the 3D view's last render depends on. The render target keeps its
+// pixels between frames, so the 3D pass only runs when one of these changed
+typedef enum {
+    VIEW3D_CAMERA = 1 << 0,     // rotation
+    VIEW3D_MESHES = 1 << 1,     // the mesh set, or the value range their colormap spans
+    VIEW3D_SLICES = 1 << 2,     // crosshair, and with it the slice planes
+    VIEW3D_THRESHOLD = 1 << 3,  // isovalues
+    VIEW3D_TRANSFER = 1 << 4,   // volume rendering switched, or its transfer function
+    VIEW3D_ALL = 0x1f,
+} view3d_dirty;
+
+// Where frame time goes, summed over about a second and then published
+typedef struct frame_stats {
+    u64 window_start;         // stm_now() when the current window opened
+    double cpu_ms;            // time inside frame() this window
+    int frames, renders_3d, uploads;
+    // Last complete window
+    double avg_cpu_ms;        // per frame
+    double fps;
+    int last_renders_3d, last_uploads;
+} frame_stats;
 
 // Application state
 typedef struct {
@@ -41,20 +66,74 @@ typedef struct {
     snk_image_t snk_imgs[3];
     bool slice_images_created[3];
     
+    // Zoom and pan of each slice view
+    float view_zoom[3];        // screen pixels per voxel, 0 = fit to panel
+    float view_center[3][2];   // voxel coordinates (row, column) at the panel centre
+    int view_size[3][2];       // rendered pixels (height, width), follows the panel
+    
+    // Rendered slice tiles, keyed by plane, tile, lod and window/level
+    tilecache* tiles;
+    u8 level;                  // window/level centre
+    u16 window;                // window/level width
+    s32 volume_origin[3];      // chunk coordinates of the loaded volume / chunk
+    s32 chunk_origin[3];
+    
+    // Thick-slab projection of each view: 0 = off, otherwise slab_reducer + 1
+    int slab_mode[3];
+    int slab_thickness[3];
+    slabproj slabs[3];
+    
     // Which view is currently active for keyboard navigation
     int active_view; // 0=XY, 1=XZ, 2=YZ
     
+    // Oblique slice through the crosshair, rotated by yaw/pitch in degrees
+    float oblique_yaw, oblique_pitch;
+    bool oblique_trilinear;
+    sg_image oblique_image;
+    snk_image_t snk_oblique;
+    bool oblique_created;
+    
     // 3D rendering state
     sgl_context sgl_ctx_3d;
     sgl_pipeline sgl_pip_3d;
     sgl_pipeline sgl_pip_transparent;  // Pipeline for transparent objects
+    meshrenderer* mesh_renderer;       // retained chunk meshes; null falls back to streaming them through sokol-gl
+    const gpumesh** mesh_draws;        // picked by render_3d_view, drawn in the 3D pass
+    int num_mesh_draws, mesh_draws_capacity;
+    f32 view_mvp[16];
+    f32 view_offset[3];
+    f32 light_dir[3];
     
     // Mesh data from marching cubes
-    mesh* chunk_meshes;  // Array of meshes, one per chunk in volume
-    int num_chunk_meshes;
-    mesh current_mesh;  // Keep for single chunk mode
+    meshregistry* chunk_meshes;  // per chunk of the volume: its mesh and simplified levels, origins in global voxels
+    chunkcache* halo_cache;      // chunks past the volume's + faces, read for the seam cells of its edge chunks
+    mesh current_meshes[MESH_MAX_ISOS];  // Keep for single chunk mode, one per isovalue
+    int num_current_meshes;
+    gpumesh* current_gpu[MESH_MAX_ISOS];
     float rotation_x, rotation_y;
     u8 iso_threshold;  // Threshold for isosurface
+    bool second_surface;        // also extract a surface at second_iso_threshold, in the same pass
+    u8 second_iso_threshold;
+    int mesh_lod;      // voxel spacing 2^mesh_lod, 0 = full resolution
+    mesh_algorithm mesh_algorithm;
+    u8 mesh_value_min, mesh_value_max;  // vertex value range over all meshes, for the colormap
+    chunklods* chunk_lods;  // downsampled levels per loaded chunk, built once at load
+    int num_chunk_lods;
+    int triangles_drawn;    // by the last 3D frame, after picking a level per chunk
+    int chunks_drawn, chunks_outside;  // by the last 3D frame, of the registry's chunks
+    char mesh_cache_dir[512];  // on-disk chunk mesh cache, empty when off
+    
+    // Direct volume rendering in place of the meshes
+    bool volume_rendering;
+    raybricks ray_bricks;      // of the loaded volume / chunk, built on first use; range is null until then
+    u8 tf_lo, tf_hi;           // transfer function ramp
+    float tf_opacity;
+    raycast_stats ray_stats;   // of the last raycast
+    double raycast_ms;
+    sg_image raycast_image;
+    snk_image_t snk_raycast;
+    bool raycast_created;
+    u64 array_id;              // meshkey_array of the loaded array
     
     // Render target for 3D view
     sg_image render_target_3d;
@@ -62,159 +141,660 @@ typedef struct {
     sg_attachments attachments_3d;
     snk_image_t snk_render_target_3d;
     bool render_3d_created;
+    u32 dirty_3d;              // view3d_dirty bits since the last 3D pass
+    
+    frame_stats stats;
 } app_state_t;
 
 static app_state_t app_state;
 
 
-// Helper to get voxel value from either chunk or volume
-static u8 get_voxel_value(int z, int y, int x) {
-    if (app_state.loaded_volume) {
-        // Get from volume
-        int chunk_z = z / CHUNK_LEN;
-        int chunk_y = y / CHUNK_LEN;
-        int chunk_x = x / CHUNK_LEN;
-        
-        if (chunk_z >= app_state.loaded_volume->z || 
-            chunk_y >= app_state.loaded_volume->y || 
-            chunk_x >= app_state.loaded_volume->x ||
-            chunk_z < 0 || chunk_y < 0 || chunk_x < 0) {
-            return 0;
+// Replace a view's texture with new RGBA pixels
+static void upload_view_image(sg_image* img, snk_image_t* snk, bool* created, const u8* rgba_data, int w, int h) {
+    // Destroy existing image if any
+    if (*created) {
+        snk_destroy_image(*snk);
+        sg_destroy_image(*img);
+    }
+    
+    // Create new image
+    app_state.stats.uploads++;
+    *img = sg_make_image(&(sg_image_desc){
+        .width = w,
+        .height = h,
+        .pixel_format = SG_PIXELFORMAT_RGBA8,
+        .data.subimage[0][0] = {
+            .ptr = rgba_data,
+            .size = (size_t)w * h * 4
         }
-        
-        int local_z = z % CHUNK_LEN;
-        int local_y = y % CHUNK_LEN;
-        int local_x = x % CHUNK_LEN;
-        
-        int chunk_idx = chunk_z * app_state.loaded_volume->y * app_state.loaded_volume->x + 
-                       chunk_y * app_state.loaded_volume->x + chunk_x;
-        return app_state.loaded_volume->chunks[chunk_idx][local_z][local_y][local_x];
-    } else if (app_state.loaded_chunk) {
-        // Get from single chunk
-        if (z >= 0 && z < CHUNK_LEN && y >= 0 && y < CHUNK_LEN && x >= 0 && x < CHUNK_LEN) {
-            return (*app_state.loaded_chunk)[z][y][x];
+    });
+    
+    // Create sokol-nuklear image wrapper
+    *snk = snk_make_image(&(snk_image_desc_t){
+        .image = *img,
+        // sampler is optional, will use default
+    });
+    
+    *created = true;
+}
+
+// The loaded volume, or the single loaded chunk wrapped as a 1x1x1 volume in *single.
+// origin (optional) receives the global voxel position of its first chunk.
+static const volume* current_volume(volume* single, s32 origin[3]) {
+    const s32* chunk_origin = app_state.volume_origin;
+    const volume* vol = app_state.loaded_volume;
+    if (!vol && app_state.loaded_chunk) {
+        *single = (volume){1, 1, 1, app_state.loaded_chunk, nullptr};
+        chunk_origin = app_state.chunk_origin;
+        vol = single;
+    }
+    if (vol && origin) {
+        for (int i = 0; i < 3; i++) {
+            origin[i] = chunk_origin[i] * CHUNK_LEN;
         }
     }
-    return 0;
+    return vol;
 }
 
-// Create or update a specific slice texture
-static void update_slice_texture(int view_idx) {
-    if (!app_state.loaded_chunk && !app_state.loaded_volume) return;
+// Drop cached slice tiles that were sampled from the given chunks (chunk_origin
+// in global chunk coordinates). Called for chunks that are about to be freed and
+// again for freshly read ones.
+static void invalidate_tiles(const volume* vol, const s32 chunk_origin[3]) {
+    if (!vol || !app_state.tiles) return;
     
-    // Determine texture size based on volume or chunk
-    int tex_size = CHUNK_LEN;
-    if (app_state.loaded_volume) {
-        // For volume, create texture large enough for all chunks
-        switch (view_idx) {
-            case 0: // XY view
-                tex_size = fmax(app_state.loaded_volume->y * CHUNK_LEN, 
-                               app_state.loaded_volume->x * CHUNK_LEN);
-                break;
-            case 1: // XZ view
-                tex_size = fmax(app_state.loaded_volume->z * CHUNK_LEN,
-                               app_state.loaded_volume->x * CHUNK_LEN);
-                break;
-            case 2: // YZ view
-                tex_size = fmax(app_state.loaded_volume->z * CHUNK_LEN,
-                               app_state.loaded_volume->y * CHUNK_LEN);
-                break;
+    s32 dropped = 0;
+    for (s32 z = 0; z < vol->z; z++) {
+        for (s32 y = 0; y < vol->y; y++) {
+            for (s32 x = 0; x < vol->x; x++) {
+                dropped += tilecache_invalidate_chunk(app_state.tiles, chunk_origin[0] + z,
+                                                      chunk_origin[1] + y, chunk_origin[2] + x);
+            }
+        }
+    }
+    if (dropped > 0) {
+        LOG_INFO("Invalidated %d cached slice tiles\n", dropped);
+    }
+}
+
+// Fit the whole volume extent into a view and centre it
+static void reset_slice_view(int view_idx) {
+    slabproj_free(&app_state.slabs[view_idx]); // sampled from the old data
+    app_state.view_zoom[view_idx] = 0.0f; // fitted to the panel on the next draw
+    for (int i = 0; i < 2; i++) {
+        int axis = view_axes[view_idx][i];
+        int extent = CHUNK_LEN;
+        if (app_state.loaded_volume) {
+            extent *= axis == 0 ? app_state.loaded_volume->z : axis == 1 ? app_state.loaded_volume->y : app_state.loaded_volume->x;
         }
+        app_state.view_center[view_idx][i] = extent / 2.0f;
     }
+}
+
+typedef struct tile_job {
+    const volume* vol;
+    const s32* origin;
+    const u8* lut;
+    tilekey* keys;
+    u8** pixels;
+} tile_job;
+
+static void render_tile_fn(void* ctx, s32 i) {
+    tile_job* job = ctx;
+    slice_render_tile(job->vol, job->origin, &job->keys[i], job->lut, job->pixels[i]);
+}
+
+// Render the visible part of a slice view at the panel's pixel resolution.
+// The plane is assembled from cached tiles at the level of detail matching the
+// zoom (one tile pixel covers 2^lod voxels, at most one screen pixel), so going
+// back to a recently viewed plane only costs the composite and texture upload.
+// Missing tiles are rendered in parallel and added to the cache.
+static void update_slice_texture(int view_idx) {
+    volume single;
+    s32 origin[3];
+    const volume* vol = current_volume(&single, origin);
+    int h = app_state.view_size[view_idx][0];
+    int w = app_state.view_size[view_idx][1];
+    if (!vol || h <= 0 || w <= 0 || app_state.view_zoom[view_idx] <= 0.0f) return;
     
-    // Create RGBA data
-    u8* rgba_data = calloc(tex_size * tex_size * 4, 1);
+    int row_axis = view_axes[view_idx][0];
+    int col_axis = view_axes[view_idx][1];
+    int dims[3] = {vol->z * CHUNK_LEN, vol->y * CHUNK_LEN, vol->x * CHUNK_LEN};
+    float step = 1.0f / app_state.view_zoom[view_idx]; // voxels per pixel
     
-    // Extract the appropriate slice based on view type
-    for (int i = 0; i < tex_size; i++) {
-        for (int j = 0; j < tex_size; j++) {
-            u8 gray = 0;
-            int z_coord = 0, y_coord = 0, x_coord = 0;
-            
-            switch (view_idx) {
-                case 0: // XY view (constant Z)
-                    z_coord = app_state.current_slice[0];
-                    y_coord = i;
-                    x_coord = j;
-                    break;
-                case 1: // XZ view (constant Y)
-                    z_coord = i;
-                    y_coord = app_state.current_slice[1];
-                    x_coord = j;
-                    break;
-                case 2: // YZ view (constant X)
-                    z_coord = i;
-                    y_coord = j;
-                    x_coord = app_state.current_slice[2];
-                    break;
+    int lod = 0;
+    while (lod < 8 && (float)(2 << lod) <= step) lod++;
+    int span = TILE_LEN << lod;
+    
+    // Global voxel coordinate, tile and texel of every screen column and row; -1 outside the volume
+    int* map = malloc(sizeof(int) * 2 * (w + h));
+    int* col_tile = map;
+    int* col_texel = map + w;
+    int* row_tile = map + 2 * w;
+    int* row_texel = map + 2 * w + h;
+    float first[2] = {
+        app_state.view_center[view_idx][0] - (h / 2) * step,
+        app_state.view_center[view_idx][1] - (w / 2) * step,
+    };
+    int tile_lo[2] = {INT32_MAX, INT32_MAX}, tile_hi[2] = {INT32_MIN, INT32_MIN};
+    for (int k = 0; k < 2; k++) {
+        int n = k == 0 ? h : w;
+        int axis = view_axes[view_idx][k];
+        int* tiles = k == 0 ? row_tile : col_tile;
+        int* texels = k == 0 ? row_texel : col_texel;
+        for (int i = 0; i < n; i++) {
+            int local = (int)floorf(first[k] + i * step);
+            if (local < 0 || local >= dims[axis]) {
+                tiles[i] = texels[i] = -1;
+                continue;
             }
-            
-            // Get voxel value
-            gray = get_voxel_value(z_coord, y_coord, x_coord);
-            
-            int idx = i * tex_size + j;
-            
-            // Add crosshairs to show current position
-            bool is_crosshair = false;
-            switch (view_idx) {
-                case 0: // XY view - show Y and X position
-                    is_crosshair = (i == app_state.current_slice[1] || j == app_state.current_slice[2]);
-                    break;
-                case 1: // XZ view - show Z and X position  
-                    is_crosshair = (i == app_state.current_slice[0] || j == app_state.current_slice[2]);
-                    break;
-                case 2: // YZ view - show Z and Y position
-                    is_crosshair = (i == app_state.current_slice[0] || j == app_state.current_slice[1]);
-                    break;
+            int global = local + origin[axis];
+            tiles[i] = global / span;
+            texels[i] = (global - tiles[i] * span) >> lod;
+            if (tiles[i] < tile_lo[k]) tile_lo[k] = tiles[i];
+            if (tiles[i] > tile_hi[k]) tile_hi[k] = tiles[i];
+        }
+    }
+    
+    u8* rgba_data = calloc((size_t)w * h * 4, 1);
+    if (app_state.slab_mode[view_idx] > 0) {
+        // Projections depend on thickness and reducer and slide incrementally
+        // with the slice, so they bypass the tile cache. The -0.5 matches the
+        // floor() sampling of the tile path to reslice's nearest rounding.
+        const u8* proj = slabproj_update(&app_state.slabs[view_idx], vol, view_idx,
+                                         app_state.current_slice[view_idx], app_state.slab_thickness[view_idx],
+                                         (slab_reducer)(app_state.slab_mode[view_idx] - 1),
+                                         h, w, first[0] - 0.5f, first[1] - 0.5f, step);
+        u8 lut[256];
+        window_level_lut(app_state.level, app_state.window, lut);
+        for (int i = 0; i < h; i++) {
+            u8* dst = &rgba_data[(size_t)i * w * 4];
+            for (int j = 0; j < w; j++) {
+                if (row_tile[i] >= 0 && col_tile[j] >= 0) {
+                    u8 g = lut[proj[(size_t)i * w + j]];
+                    dst[j * 4 + 0] = g;
+                    dst[j * 4 + 1] = g;
+                    dst[j * 4 + 2] = g;
+                }
+                dst[j * 4 + 3] = 255;
             }
-            
-            if (is_crosshair) {
-                // Red crosshairs
-                rgba_data[idx * 4 + 0] = 255;  // R
-                rgba_data[idx * 4 + 1] = gray / 2;  // G
-                rgba_data[idx * 4 + 2] = gray / 2;  // B
-            } else {
-                rgba_data[idx * 4 + 0] = gray;  // R
-                rgba_data[idx * 4 + 1] = gray;  // G
-                rgba_data[idx * 4 + 2] = gray;  // B
+        }
+    } else if (tile_lo[0] <= tile_hi[0] && tile_lo[1] <= tile_hi[1]) {
+        int nty = tile_hi[0] - tile_lo[0] + 1;
+        int ntx = tile_hi[1] - tile_lo[1] + 1;
+        const u8** visible = malloc(sizeof(u8*) * nty * ntx);
+        tilekey* missing_keys = malloc(sizeof(tilekey) * nty * ntx);
+        u8** missing_pixels = malloc(sizeof(u8*) * nty * ntx);
+        int num_missing = 0;
+        
+        tilecache_begin_frame(app_state.tiles);
+        for (int ty = 0; ty < nty; ty++) {
+            for (int tx = 0; tx < ntx; tx++) {
+                tilekey key = {
+                    .plane = app_state.current_slice[view_idx] + origin[view_idx],
+                    .tx = tile_lo[1] + tx,
+                    .ty = tile_lo[0] + ty,
+                    .axis = (u8)view_idx,
+                    .lod = (u8)lod,
+                    .level = app_state.level,
+                    .window = app_state.window,
+                };
+                const u8* px = tilecache_get(app_state.tiles, &key);
+                if (!px) {
+                    s32 deps_lo[3], deps_hi[3];
+                    slice_tile_footprint(&key, deps_lo, deps_hi);
+                    u8* fresh = tilecache_put(app_state.tiles, &key, deps_lo, deps_hi);
+                    missing_keys[num_missing] = key;
+                    missing_pixels[num_missing++] = fresh;
+                    px = fresh;
+                }
+                visible[ty * ntx + tx] = px;
             }
-            rgba_data[idx * 4 + 3] = 255;   // A (fully opaque)
         }
+        
+        u8 lut[256];
+        window_level_lut(app_state.level, app_state.window, lut);
+        tile_job job = {vol, origin, lut, missing_keys, missing_pixels};
+        parallel_for(num_missing, render_tile_fn, &job);
+        
+        for (int i = 0; i < h; i++) {
+            if (row_tile[i] < 0) continue;
+            const u8** tile_row = &visible[(row_tile[i] - tile_lo[0]) * ntx];
+            int texel_row = row_texel[i] * TILE_LEN;
+            u8* dst = &rgba_data[(size_t)i * w * 4];
+            for (int j = 0; j < w; j++) {
+                if (col_tile[j] >= 0) {
+                    u8 g = tile_row[col_tile[j] - tile_lo[1]][texel_row + col_texel[j]];
+                    dst[j * 4 + 0] = g;
+                    dst[j * 4 + 1] = g;
+                    dst[j * 4 + 2] = g;
+                }
+                dst[j * 4 + 3] = 255;
+            }
+        }
+        
+        free(visible);
+        free(missing_keys);
+        free(missing_pixels);
     }
+    free(map);
     
-    // Destroy existing image if any
-    if (app_state.slice_images_created[view_idx]) {
-        snk_destroy_image(app_state.snk_imgs[view_idx]);
-        sg_destroy_image(app_state.slice_images[view_idx]);
+    // Red crosshairs on top of the composite
+    int cross_row = (int)floorf((app_state.current_slice[row_axis] + 0.5f - first[0]) / step);
+    int cross_col = (int)floorf((app_state.current_slice[col_axis] + 0.5f - first[1]) / step);
+    for (int i = 0; i < h; i++) {
+        for (int j = 0; j < w; j++) {
+            if (i != cross_row && j != cross_col) continue;
+            u8* px = &rgba_data[((size_t)i * w + j) * 4];
+            px[0] = 255;
+            px[1] = px[1] / 2;
+            px[2] = px[2] / 2;
+            px[3] = 255;
+        }
     }
     
-    // Create new image
-    app_state.slice_images[view_idx] = sg_make_image(&(sg_image_desc){
-        .width = tex_size,
-        .height = tex_size,
-        .pixel_format = SG_PIXELFORMAT_RGBA8,
-        .data.subimage[0][0] = {
-            .ptr = rgba_data,
-            .size = tex_size * tex_size * 4
-        }
-    });
+    upload_view_image(&app_state.slice_images[view_idx], &app_state.snk_imgs[view_idx],
+                      &app_state.slice_images_created[view_idx], rgba_data, w, h);
     
-    // Create sokol-nuklear image wrapper
-    app_state.snk_imgs[view_idx] = snk_make_image(&(snk_image_desc_t){
-        .image = app_state.slice_images[view_idx],
-        // sampler is optional, will use default
-    });
+    free(rgba_data);
+}
+
+// Resample the oblique plane centred on the crosshair
+static void update_oblique_texture(void) {
+    volume single;
+    const volume* vol = current_volume(&single, nullptr);
+    if (!vol) return;
+    
+    const int size = 256;
+    float yaw = sgl_rad(app_state.oblique_yaw);
+    float pitch = sgl_rad(app_state.oblique_pitch);
     
-    app_state.slice_images_created[view_idx] = true;
+    // u rotates within the XY plane, v tilts from Z towards it; both unit length and orthogonal
+    plane p = {
+        .u = {0.0f, -sinf(yaw), cosf(yaw)},
+        .v = {cosf(pitch), sinf(pitch) * cosf(yaw), sinf(pitch) * sinf(yaw)},
+    };
+    for (int a = 0; a < 3; a++) {
+        p.origin[a] = app_state.current_slice[a] - (size / 2) * (p.u[a] + p.v[a]);
+    }
+    
+    u8* gray = malloc(size * size);
+    reslice_plane(vol, &p, size, size,
+                  app_state.oblique_trilinear ? INTERP_TRILINEAR : INTERP_NEAREST, gray);
+    
+    u8* rgba_data = malloc(size * size * 4);
+    for (int i = 0; i < size * size; i++) {
+        bool is_crosshair = (i / size == size / 2) || (i % size == size / 2);
+        rgba_data[i * 4 + 0] = is_crosshair ? 255 : gray[i];
+        rgba_data[i * 4 + 1] = is_crosshair ? gray[i] / 2 : gray[i];
+        rgba_data[i * 4 + 2] = is_crosshair ? gray[i] / 2 : gray[i];
+        rgba_data[i * 4 + 3] = 255;
+    }
+    
+    upload_view_image(&app_state.oblique_image, &app_state.snk_oblique,
+                      &app_state.oblique_created, rgba_data, size, size);
     
     free(rgba_data);
+    free(gray);
 }
 
-// Update all slice textures
+// Update all slice textures, and the slice planes of the 3D view
 static void update_all_slice_textures(void) {
     for (int i = 0; i < 3; i++) {
         update_slice_texture(i);
     }
+    update_oblique_texture();
+    app_state.dirty_3d |= VIEW3D_SLICES;
+}
+
+static void free_chunk_lods(void) {
+    for (int i = 0; i < app_state.num_chunk_lods; i++) {
+        chunklods_free(&app_state.chunk_lods[i]);
+    }
+    free(app_state.chunk_lods);
+    app_state.chunk_lods = NULL;
+    app_state.num_chunk_lods = 0;
+}
+
+static void build_lods_fn(void* ctx, s32 i) {
+    const volume* vol = ctx;
+    if (!app_state.chunk_lods[i].bricks[0]) {
+        chunklods_build(&app_state.chunk_lods[i], &vol->chunks[i]);
+    }
+}
+
+// Downsample every loaded chunk once so meshing at a coarser LOD reads a
+// ready-made level instead of filtering the chunk again; this also builds the
+// span-space brick index that lets a threshold change skip inactive bricks
+static void build_chunk_lods(void) {
+    free_chunk_lods();
+    volume single;
+    s32 origin[3];
+    const volume* vol = current_volume(&single, origin);
+    if (!vol) return;
+    app_state.num_chunk_lods = vol->z * vol->y * vol->x;
+    app_state.chunk_lods = calloc(app_state.num_chunk_lods, sizeof(chunklods));
+    parallel_for(app_state.num_chunk_lods, build_lods_fn, (void*)vol);
+}
+
+typedef struct cached_meshes_job {
+    const volume* vol;
+    const s32* origin;      // chunk coordinates of the volume's first chunk
+    const s32* selected;    // volume slots to mesh
+    const u8* isos;
+    int num_isos;
+    mesh* parts;            // num_isos per selected slot
+    bool* hit;
+    const s32* missing;     // parts extracted this time
+} cached_meshes_job;
+
+// The isovalues the viewer extracts: the threshold, then the second surface's if shown
+static int mesh_isos(u8 isos[MESH_MAX_ISOS]) {
+    int count = 0;
+    isos[count++] = app_state.iso_threshold;
+    if (app_state.second_surface) isos[count++] = app_state.second_iso_threshold;
+    return count;
+}
+
+// The key of a chunk's mesh at iso under the current settings, when the
+// chunks below limit (exclusive, z, y, x) are there to be read as its halo
+static meshkey chunk_mesh_key(const s32 chunk[3], const s32 limit[3], u8 iso) {
+    meshkey key = {
+        .array = app_state.array_id, .chunk = {chunk[0], chunk[1], chunk[2]},
+        .lod = app_state.mesh_lod, .iso = iso, .algorithm = app_state.mesh_algorithm,
+    };
+    for (int d = 1; d < 8; d++) {
+        int dz = d >> 2 & 1, dy = d >> 1 & 1, dx = d & 1;
+        if (chunk[0] + dz < limit[0] && chunk[1] + dy < limit[1] && chunk[2] + dx < limit[2]) {
+            key.halo |= 1u << ((dz + 1) * 9 + (dy + 1) * 3 + dx + 1);
+        }
+    }
+    return key;
+}
+
+// The key of the mesh of volume slot i, meshed with the rest of the volume as halo
+static meshkey volume_mesh_key(const volume* vol, const s32 origin[3], int i, u8 iso) {
+    s32 chunk[3] = {origin[0] + i / (vol->y * vol->x), origin[1] + i / vol->x % vol->y, origin[2] + i % vol->x};
+    s32 limit[3] = {origin[0] + vol->z, origin[1] + vol->y, origin[2] + vol->x};
+    return chunk_mesh_key(chunk, limit, iso);
+}
+
+static void load_cached_mesh_fn(void* ctx, s32 j) {
+    cached_meshes_job* job = ctx;
+    int i = job->selected[j / job->num_isos];
+    meshkey key = volume_mesh_key(job->vol, job->origin, i, job->isos[j % job->num_isos]);
+    job->hit[j] = meshcache_load(app_state.mesh_cache_dir, &key, &job->parts[j]);
+    if (job->hit[j]) {
+        job->parts[j].origin[0] = i % job->vol->x * CHUNK_LEN;
+        job->parts[j].origin[1] = i / job->vol->x % job->vol->y * CHUNK_LEN;
+        job->parts[j].origin[2] = i / (job->vol->x * job->vol->y) * CHUNK_LEN;
+    }
+}
+
+static void store_cached_mesh_fn(void* ctx, s32 k) {
+    cached_meshes_job* job = ctx;
+    int j = job->missing[k];
+    meshkey key = volume_mesh_key(job->vol, job->origin, job->selected[j / job->num_isos], job->isos[j % job->num_isos]);
+    meshcache_store(app_state.mesh_cache_dir, &key, &job->parts[j]);
+}
+
+// The meshes of the selected chunks of vol at each isovalue, as
+// generate_selected_chunk_meshes gives them: parts[j * num_isos + k] is
+// selected[j] at isos[k]. Meshes extracted before with the same settings are
+// read back from the on-disk cache; a chunk missing any of its surfaces has
+// all of them extracted in one pass, and the missing ones are stored for
+// next time.
+static void mesh_chunks_cached(const volume* vol, const s32 origin[3], const s32* selected, int count,
+                               const u8* isos, int num_isos, const chunklods* lods, mesh* parts) {
+    int num_parts = count * num_isos;
+    bool* hit = calloc(num_parts, sizeof(bool));
+    s32* missing = malloc(num_parts * sizeof(s32));
+    cached_meshes_job job = {
+        .vol = vol, .origin = origin, .selected = selected, .isos = isos, .num_isos = num_isos,
+        .parts = parts, .hit = hit, .missing = missing,
+    };
+    bool caching = app_state.mesh_cache_dir[0] != '\0';
+    if (caching) {
+        parallel_for(num_parts, load_cached_mesh_fn, &job);
+    }
+    
+    s32* slots = malloc(count * sizeof(s32));
+    s32* extracted = malloc(count * sizeof(s32));
+    int num_extracted = 0, num_missing = 0;
+    for (int j = 0; j < count; j++) {
+        bool complete = true;
+        for (int k = 0; k < num_isos; k++) {
+            complete &= hit[j * num_isos + k];
+        }
+        if (complete) continue;
+        slots[num_extracted] = selected[j];
+        extracted[num_extracted++] = j;
+        for (int k = 0; k < num_isos; k++) {
+            int p = j * num_isos + k;
+            if (hit[p]) mesh_free(&parts[p]);
+            else missing[num_missing++] = p;
+        }
+    }
+    if (num_extracted > 0) {
+        mesh* fresh = malloc((size_t)num_extracted * num_isos * sizeof(mesh));
+        generate_selected_chunk_meshes(vol, slots, num_extracted, isos, num_isos, app_state.mesh_lod,
+                                       app_state.mesh_algorithm, lods, fresh);
+        for (int e = 0; e < num_extracted; e++) {
+            for (int k = 0; k < num_isos; k++) {
+                parts[extracted[e] * num_isos + k] = fresh[e * num_isos + k];
+            }
+        }
+        free(fresh);
+        if (caching) {
+            parallel_for(num_missing, store_cached_mesh_fn, &job);
+        }
+    }
+    if (caching) {
+        LOG_INFO("%d of %d chunk meshes read from the mesh cache\n", num_parts - num_missing, num_parts);
+    }
+    free(slots);
+    free(extracted);
+    free(hit);
+    free(missing);
+}
+
+static bool meshkey_equal(const meshkey* a, const meshkey* b) {
+    return a->array == b->array && a->chunk[0] == b->chunk[0] && a->chunk[1] == b->chunk[1] &&
+           a->chunk[2] == b->chunk[2] && a->lod == b->lod && a->iso == b->iso && a->algorithm == b->algorithm &&
+           a->halo == b->halo;
+}
+
+typedef struct mesh_update_job {
+    meshentry** entries;    // registry entries being replaced
+    mesh* parts;            // their new meshes, num_isos per entry
+    int num_isos;
+} mesh_update_job;
+
+static void build_mesh_lods_fn(void* ctx, s32 j) {
+    mesh_update_job* job = ctx;
+    meshlods* lods = &job->entries[j / job->num_isos]->lods[j % job->num_isos];
+    if (job->parts[j].num_triangles > 0) {
+        meshlods_build(lods, job->parts[j], (float)(1 << app_state.mesh_lod));
+    } else {
+        mesh_free(&job->parts[j]);
+        *lods = (meshlods){0};
+    }
+}
+
+typedef struct halo_acquire_job {
+    volume* vol;
+    const s32* origin;
+} halo_acquire_job;
+
+static void acquire_halo_fn(void* ctx, s32 i) {
+    halo_acquire_job* job = ctx;
+    const volume* vol = job->vol;
+    if (!vol->refs[i]) {
+        vol->refs[i] = chunkcache_acquire(app_state.halo_cache, job->origin[0] + i / (vol->y * vol->x),
+                                          job->origin[1] + i / vol->x % vol->y, job->origin[2] + i % vol->x);
+    }
+}
+
+// Bring the mesh registry in line with the loaded volume. Meshes of chunks
+// that left the window are freed, and a chunk is only meshed when its entry
+// is missing or was made under other settings. A chunk's mesh depends on its
+// + side neighbours, so those are read past the window's + faces from the
+// halo cache: a chunk's key then stays the same wherever it sits in the
+// window, and panning only meshes the chunks that come into view.
+static void update_chunk_meshes(void) {
+    const volume* win = app_state.loaded_volume;
+    const s32* origin = app_state.volume_origin;
+    s32 dims[3] = {win->z, win->y, win->x};
+    meshregistry* reg = app_state.chunk_meshes;
+    for (s32 i = meshregistry_count(reg) - 1; i >= 0; i--) {
+        s32 c[3];
+        memcpy(c, meshregistry_entries(reg)[i].chunk, sizeof(c));
+        if (c[0] < origin[0] || c[1] < origin[1] || c[2] < origin[2] ||
+            c[0] >= origin[0] + dims[0] || c[1] >= origin[1] + dims[1] || c[2] >= origin[2] + dims[2]) {
+            meshregistry_remove(reg, c[0], c[1], c[2]);
+        }
+    }
+    
+    s32 grid[3];
+    chunkcache_grid(app_state.halo_cache, grid);
+    int total = win->z * win->y * win->x;
+    u8 isos[MESH_MAX_ISOS];
+    int num_isos = mesh_isos(isos);
+    s32* stale = malloc(total * sizeof(s32));
+    meshkey* keys = malloc((size_t)total * num_isos * sizeof(meshkey));
+    s32 lo[3] = {INT32_MAX, INT32_MAX, INT32_MAX}, hi[3] = {0, 0, 0};
+    int count = 0;
+    for (int i = 0; i < total; i++) {
+        s32 c[3] = {i / (win->y * win->x), i / win->x % win->y, i % win->x};
+        s32 chunk[3] = {origin[0] + c[0], origin[1] + c[1], origin[2] + c[2]};
+        meshkey* key = &keys[count * num_isos];
+        const meshentry* e = meshregistry_find(reg, chunk[0], chunk[1], chunk[2]);
+        bool current = e && e->num_surfaces == num_isos;
+        for (int k = 0; k < num_isos; k++) {
+            key[k] = chunk_mesh_key(chunk, grid, isos[k]);
+            current = current && meshkey_equal(&e->keys[k], &key[k]);
+        }
+        if (current) continue;
+        stale[count++] = i;
+        for (int a = 0; a < 3; a++) {
+            s32 end = c[a] + (origin[a] + c[a] + 1 < grid[a] ? 2 : 1);
+            if (c[a] < lo[a]) lo[a] = c[a];
+            if (end > hi[a]) hi[a] = end;
+        }
+    }
+    
+    if (count > 0) {
+        // Mesh the stale chunks inside the box around them and their + side
+        // neighbours; window chunks are borrowed, the others come from the cache
+        s32 box[3] = {origin[0] + lo[0], origin[1] + lo[1], origin[2] + lo[2]};
+        volume vol = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], nullptr, nullptr};
+        int box_total = vol.z * vol.y * vol.x;
+        vol.refs = calloc(box_total, sizeof(chunk*));
+        chunklods* lods = calloc(box_total, sizeof(chunklods));
+        for (int i = 0; i < box_total; i++) {
+            s32 c[3] = {lo[0] + i / (vol.y * vol.x), lo[1] + i / vol.x % vol.y, lo[2] + i % vol.x};
+            if (c[0] < dims[0] && c[1] < dims[1] && c[2] < dims[2]) {
+                int j = (c[0] * win->y + c[1]) * win->x + c[2];
+                vol.refs[i] = &win->chunks[j];
+                if (app_state.num_chunk_lods == total) lods[i] = app_state.chunk_lods[j];
+            }
+        }
+        halo_acquire_job acquire = {.vol = &vol, .origin = box};
+        parallel_for(box_total, acquire_halo_fn, &acquire);
+        // Past the array's edge, as for the window's own chunks there, reads the fill value
+        chunk* fill = nullptr;
+        for (int i = 0; i < box_total; i++) {
+            if (vol.refs[i]) continue;
+            if (!fill) {
+                fill = chunk_new();
+                memset(fill, app_state.zarr_info.fill_value, sizeof(chunk));
+            }
+            vol.refs[i] = fill;
+        }
+        
+        s32* selected = malloc(count * sizeof(s32));
+        for (int j = 0; j < count; j++) {
+            s32 c[3] = {stale[j] / (win->y * win->x), stale[j] / win->x % win->y, stale[j] % win->x};
+            selected[j] = ((c[0] - lo[0]) * vol.y + c[1] - lo[1]) * vol.x + c[2] - lo[2];
+        }
+        mesh* parts = malloc((size_t)count * num_isos * sizeof(mesh));
+        mesh_chunks_cached(&vol, box, selected, count, isos, num_isos, lods, parts);
+        
+        for (int i = 0; i < box_total; i++) {
+            s32 c[3] = {lo[0] + i / (vol.y * vol.x), lo[1] + i / vol.x % vol.y, lo[2] + i % vol.x};
+            if ((c[0] >= dims[0] || c[1] >= dims[1] || c[2] >= dims[2]) && vol.refs[i] != fill) {
+                chunkcache_release(app_state.halo_cache, box[0] + i / (vol.y * vol.x), box[1] + i / vol.x % vol.y,
+                                   box[2] + i % vol.x);
+            }
+        }
+        if (fill) chunk_free(fill);
+        free(vol.refs);
+        free(lods);
+        free(selected);
+        
+        for (int j = 0; j < count; j++) {
+            const s32* chunk = keys[j * num_isos].chunk;
+            meshentry* e = meshregistry_insert(reg, chunk[0], chunk[1], chunk[2]);
+            meshentry_clear(e);
+            e->num_surfaces = num_isos;
+            for (int k = 0; k < num_isos; k++) {
+                e->keys[k] = keys[j * num_isos + k];
+                // Box-relative origins (x, y, z) to global voxels, so kept meshes stay put as the window moves
+                for (int a = 0; a < 3; a++) {
+                    parts[j * num_isos + k].origin[a] += box[2 - a] * CHUNK_LEN;
+                }
+            }
+        }
+        // Entries stay put once every insert is done
+        meshentry** entries = malloc(count * sizeof(meshentry*));
+        for (int j = 0; j < count; j++) {
+            const s32* chunk = keys[j * num_isos].chunk;
+            entries[j] = meshregistry_find(reg, chunk[0], chunk[1], chunk[2]);
+        }
+        
+        // Simplified copies for chunks that cover only a few pixels on screen
+        mesh_update_job job = {.entries = entries, .parts = parts, .num_isos = num_isos};
+        parallel_for(count * num_isos, build_mesh_lods_fn, &job);
+        free(entries);
+        free(parts);
+    }
+    LOG_INFO("Meshed %d of the %d chunks in the window\n", count, total);
+    free(stale);
+    free(keys);
+}
+
+// Bring the isosurface of the loaded volume (or single chunk) up to date with
+// the current threshold and level of detail
+static void regenerate_meshes(void) {
+    if (app_state.loaded_volume) {
+        update_chunk_meshes();
+    } else if (app_state.loaded_chunk) {
+        const chunklods* lods = app_state.num_chunk_lods == 1 ? &app_state.chunk_lods[0] : NULL;
+        for (int k = 0; k < app_state.num_current_meshes; k++) {
+            mesh_free(&app_state.current_meshes[k]);
+            gpumesh_free(app_state.current_gpu[k]);
+            app_state.current_gpu[k] = nullptr;
+        }
+        u8 isos[MESH_MAX_ISOS];
+        app_state.num_current_meshes = mesh_isos(isos);
+        volume single = {1, 1, 1, app_state.loaded_chunk, nullptr};
+        const s32 slot = 0;
+        mesh_chunks_cached(&single, app_state.chunk_origin, &slot, 1, isos, app_state.num_current_meshes, lods,
+                           app_state.current_meshes);
+    }
+    
+    // One colormap scale for every chunk, so colours match across chunk borders
+    app_state.mesh_value_min = 255;
+    app_state.mesh_value_max = 0;
+    const meshentry* entries = meshregistry_entries(app_state.chunk_meshes);
+    for (s32 i = 0; i < meshregistry_count(app_state.chunk_meshes); i++) {
+        for (int k = 0; k < entries[i].num_surfaces; k++) {
+            mesh_value_range(&entries[i].lods[k].levels[0], &app_state.mesh_value_min, &app_state.mesh_value_max);
+        }
+    }
+    for (int k = 0; k < app_state.num_current_meshes; k++) {
+        mesh_value_range(&app_state.current_meshes[k], &app_state.mesh_value_min, &app_state.mesh_value_max);
+    }
+    app_state.dirty_3d |= VIEW3D_MESHES;
 }
 
 // Load chunk from zarr
@@ -238,47 +818,72 @@ static void load_chunk(void) {
     
     // Free previous chunk if any
     if (app_state.loaded_chunk) {
+        invalidate_tiles(&(volume){1, 1, 1, app_state.loaded_chunk, nullptr}, app_state.chunk_origin);
         chunk_free(app_state.loaded_chunk);
         app_state.loaded_chunk = NULL;
+        if (!app_state.loaded_volume) free_chunk_lods();
     }
+    if (!app_state.loaded_volume) raybricks_free(&app_state.ray_bricks);
     
     // Construct chunk path using dimension separator
     char chunk_path[1024];
-    char sep = app_state.zarr_info.dimension_separator;
-    
-    // Default to '.' if separator is not set
-    if (sep == '\0') {
-        sep = '.';
-    }
-    
-    snprintf(chunk_path, sizeof(chunk_path), "%s/%d%c%d%c%d", 
-             app_state.zarr_path,
-             app_state.chunk_offset[0] / CHUNK_LEN,
-             sep,
-             app_state.chunk_offset[1] / CHUNK_LEN,
-             sep,
-             app_state.chunk_offset[2] / CHUNK_LEN);
+    zarr_chunk_path(chunk_path, sizeof(chunk_path), app_state.zarr_path, app_state.zarr_info,
+                    app_state.chunk_offset[0] / CHUNK_LEN,
+                    app_state.chunk_offset[1] / CHUNK_LEN,
+                    app_state.chunk_offset[2] / CHUNK_LEN);
     
     // Load the chunk
     app_state.loaded_chunk = zarr_read_chunk(chunk_path, app_state.zarr_info);
     
     if (app_state.loaded_chunk) {
         sprintf(app_state.info_text, "Successfully loaded chunk from: %s", chunk_path);
+        for (int i = 0; i < 3; i++) {
+            app_state.chunk_origin[i] = app_state.chunk_offset[i] / CHUNK_LEN;
+        }
+        invalidate_tiles(&(volume){1, 1, 1, app_state.loaded_chunk, nullptr}, app_state.chunk_origin);
         // Initialize to center of chunk
         app_state.current_slice[0] = CHUNK_LEN / 2; // Z
         app_state.current_slice[1] = CHUNK_LEN / 2; // Y
         app_state.current_slice[2] = CHUNK_LEN / 2; // X
         app_state.active_view = 0; // Start with XY view
+        for (int i = 0; i < 3; i++) {
+            reset_slice_view(i);
+        }
         update_all_slice_textures();
         
         // Generate 3D mesh
-        mesh_free(&app_state.current_mesh);
-        app_state.current_mesh = generate_mesh_from_chunk(app_state.loaded_chunk, app_state.iso_threshold);
+        build_chunk_lods();
+        regenerate_meshes();
     } else {
         sprintf(app_state.info_text, "Failed to load chunk from: %s", chunk_path);
     }
 }
 
+typedef struct window_load_job {
+    volume* vol;
+    s32 origin[3];          // chunk coordinates of the window's first chunk
+    const s32* fresh;       // slots read from the array
+} window_load_job;
+
+static void read_window_chunk_fn(void* ctx, s32 j) {
+    window_load_job* job = ctx;
+    volume* vol = job->vol;
+    s32 i = job->fresh[j];
+    s32 cz = job->origin[0] + i / (vol->y * vol->x);
+    s32 cy = job->origin[1] + i / vol->x % vol->y;
+    s32 cx = job->origin[2] + i % vol->x;
+    char chunk_path[1024];
+    zarr_chunk_path(chunk_path, sizeof(chunk_path), app_state.zarr_path, app_state.zarr_info, cz, cy, cx);
+    chunk* ch = zarr_read_chunk(chunk_path, app_state.zarr_info);
+    if (ch) {
+        memcpy(&vol->chunks[i], ch, sizeof(chunk));
+        chunk_free(ch);
+    } else {
+        LOG_WARN("Failed to load chunk [%d,%d,%d] from %s\n", cz, cy, cx, chunk_path);
+        memset(&vol->chunks[i], app_state.zarr_info.fill_value, sizeof(chunk));
+    }
+}
+
 // Function to load volume from zarr array
 static void load_volume(void) {
     if (!app_state.zarr_info.chunks[0]) {
@@ -288,72 +893,92 @@ static void load_volume(void) {
     
     // For now, load a 2x2x2 volume of chunks
     s32 volume_size[3] = {2, 2, 2};  // z, y, x chunks
+    s32 origin[3];
+    for (int i = 0; i < 3; i++) {
+        origin[i] = app_state.chunk_offset[i] / CHUNK_LEN;
+    }
+    volume* vol = volume_new(volume_size[0], volume_size[1], volume_size[2]);
+    if (!vol) {
+        sprintf(app_state.info_text, "Failed to load volume");
+        return;
+    }
     
-    // Free previous volume if any
-    if (app_state.loaded_volume) {
-        volume_free(app_state.loaded_volume);
-        app_state.loaded_volume = NULL;
+    // Chunks the previous window shares with this one keep their data and
+    // downsampled levels; only the chunks entering the window are read
+    volume* old = app_state.loaded_volume;
+    const s32* old_origin = app_state.volume_origin;
+    int old_total = old ? old->z * old->y * old->x : 0;
+    chunklods* old_lods = old && app_state.num_chunk_lods == old_total ? app_state.chunk_lods : NULL;
+    int total = vol->z * vol->y * vol->x;
+    chunklods* lods = calloc(total, sizeof(chunklods));
+    s32* fresh = malloc(total * sizeof(s32));
+    bool* kept = calloc(old_total > 0 ? old_total : 1, sizeof(bool));
+    int num_fresh = 0;
+    for (int i = 0; i < total; i++) {
+        s32 c[3] = {i / (vol->y * vol->x), i / vol->x % vol->y, i % vol->x};
+        s32 o[3];
+        bool inside = old != NULL;
+        for (int a = 0; a < 3 && inside; a++) {
+            o[a] = origin[a] + c[a] - old_origin[a];
+            inside = o[a] >= 0 && o[a] < (a == 0 ? old->z : a == 1 ? old->y : old->x);
+        }
+        if (!inside) {
+            fresh[num_fresh++] = i;
+            continue;
+        }
+        int j = (o[0] * old->y + o[1]) * old->x + o[2];
+        memcpy(&vol->chunks[i], &old->chunks[j], sizeof(chunk));
+        if (old_lods) {
+            lods[i] = old_lods[j];
+            old_lods[j] = (chunklods){0};
+        }
+        kept[j] = true;
     }
     
-    // Free previous meshes
-    if (app_state.chunk_meshes) {
-        for (int i = 0; i < app_state.num_chunk_meshes; i++) {
-            mesh_free(&app_state.chunk_meshes[i]);
+    // Tiles sampled from chunks leaving the window
+    for (int j = 0; j < old_total; j++) {
+        if (!kept[j]) {
+            tilecache_invalidate_chunk(app_state.tiles, old_origin[0] + j / (old->y * old->x),
+                                       old_origin[1] + j / old->x % old->y, old_origin[2] + j % old->x);
         }
-        free(app_state.chunk_meshes);
-        app_state.chunk_meshes = NULL;
+    }
+    window_load_job job = {.vol = vol, .origin = {origin[0], origin[1], origin[2]}, .fresh = fresh};
+    parallel_for(num_fresh, read_window_chunk_fn, &job);
+    for (int k = 0; k < num_fresh; k++) {
+        int i = fresh[k];
+        tilecache_invalidate_chunk(app_state.tiles, origin[0] + i / (vol->y * vol->x),
+                                   origin[1] + i / vol->x % vol->y, origin[2] + i % vol->x);
     }
     
-    // Load the volume
-    app_state.loaded_volume = zarr_read_volume(app_state.zarr_path, app_state.zarr_info,
-                                               app_state.chunk_offset[0] / CHUNK_LEN, 
-                                               app_state.chunk_offset[1] / CHUNK_LEN, 
-                                               app_state.chunk_offset[2] / CHUNK_LEN,
-                                               volume_size[0], volume_size[1], volume_size[2]);
+    if (old) volume_free(old);
+    free_chunk_lods();
+    raybricks_free(&app_state.ray_bricks);
+    app_state.loaded_volume = vol;
+    app_state.chunk_lods = lods;
+    app_state.num_chunk_lods = total;
+    for (int i = 0; i < 3; i++) {
+        app_state.volume_origin[i] = origin[i];
+    }
+    parallel_for(total, build_lods_fn, vol);
+    LOG_INFO("Read %d chunks, kept %d from the previous window\n", num_fresh, total - num_fresh);
+    free(fresh);
+    free(kept);
     
-    if (app_state.loaded_volume) {
-        sprintf(app_state.info_text, "Successfully loaded %dx%dx%d volume from offset [%d,%d,%d]", 
-                volume_size[0], volume_size[1], volume_size[2],
-                app_state.chunk_offset[0], app_state.chunk_offset[1], app_state.chunk_offset[2]);
-        
-        // Generate meshes for each chunk
-        int total_chunks = volume_size[0] * volume_size[1] * volume_size[2];
-        app_state.chunk_meshes = malloc(total_chunks * sizeof(mesh));
-        app_state.num_chunk_meshes = 0;
-        
-        for (int z = 0; z < volume_size[0]; z++) {
-            for (int y = 0; y < volume_size[1]; y++) {
-                for (int x = 0; x < volume_size[2]; x++) {
-                    int idx = z * volume_size[1] * volume_size[2] + y * volume_size[2] + x;
-                    app_state.chunk_meshes[app_state.num_chunk_meshes] = 
-                        generate_mesh_from_chunk(&app_state.loaded_volume->chunks[idx], app_state.iso_threshold);
-                    
-                    // Offset the mesh vertices to position the chunk correctly
-                    mesh* m = &app_state.chunk_meshes[app_state.num_chunk_meshes];
-                    if (m->vertices && m->num_triangles > 0) {
-                        for (int i = 0; i < m->num_triangles * 3; i++) {
-                            m->vertices[i * 3 + 0] += x * CHUNK_LEN;  // X offset
-                            m->vertices[i * 3 + 1] += y * CHUNK_LEN;  // Y offset
-                            m->vertices[i * 3 + 2] += z * CHUNK_LEN;  // Z offset
-                        }
-                        app_state.num_chunk_meshes++;
-                    }
-                }
-            }
-        }
-        
-        LOG_INFO("Generated %d meshes from volume\n", app_state.num_chunk_meshes);
-        
-        // Initialize slice position to center of volume
-        app_state.current_slice[0] = (volume_size[0] * CHUNK_LEN) / 2;
-        app_state.current_slice[1] = (volume_size[1] * CHUNK_LEN) / 2;
-        app_state.current_slice[2] = (volume_size[2] * CHUNK_LEN) / 2;
-        
-        // Update slice textures
-        update_all_slice_textures();
-    } else {
-        sprintf(app_state.info_text, "Failed to load volume");
+    sprintf(app_state.info_text, "Successfully loaded %dx%dx%d volume from offset [%d,%d,%d]",
+            volume_size[0], volume_size[1], volume_size[2],
+            app_state.chunk_offset[0], app_state.chunk_offset[1], app_state.chunk_offset[2]);
+    regenerate_meshes();
+    
+    // Initialize slice position to center of volume
+    app_state.current_slice[0] = (volume_size[0] * CHUNK_LEN) / 2;
+    app_state.current_slice[1] = (volume_size[1] * CHUNK_LEN) / 2;
+    app_state.current_slice[2] = (volume_size[2] * CHUNK_LEN) / 2;
+    
+    // Update slice textures
+    for (int i = 0; i < 3; i++) {
+        reset_slice_view(i);
     }
+    update_all_slice_textures();
 }
 
 // Function to load and parse .zarray file from a zarr volume path
@@ -364,6 +989,9 @@ static void load_zarr_array(const char* zarr_path) {
     char* json_content = read_file(zarray_path);
     if (json_content) {
         app_state.zarr_info = zarr_parse_zarray(json_content);
+        app_state.array_id = meshkey_array(zarr_path);
+        chunkcache_free(app_state.halo_cache);
+        app_state.halo_cache = chunkcache_new(zarr_path, app_state.zarr_info, 256 * 1024 * 1024);
         snprintf(app_state.info_text, sizeof(app_state.info_text),
                  "Successfully loaded .zarray from: %s", zarray_path);
         free(json_content);
@@ -386,11 +1014,27 @@ static void init(void) {
         app_state.chunk_size[i] = CHUNK_LEN;
         app_state.current_slice[i] = 0;
         app_state.slice_images_created[i] = false;
+        app_state.slab_thickness[i] = 16;
     }
     app_state.active_view = 0;
     app_state.iso_threshold = 128;  // Default threshold
+    app_state.second_iso_threshold = 192;
+    app_state.mesh_lod = 1;         // Half resolution, as before LODs were selectable
+    app_state.level = 128;          // Identity window/level
+    app_state.window = 256;
+    app_state.tiles = tilecache_new(64 * 1024 * 1024);
+    app_state.chunk_meshes = meshregistry_new();
+    if (!meshcache_default_dir(app_state.mesh_cache_dir, sizeof(app_state.mesh_cache_dir))) {
+        app_state.mesh_cache_dir[0] = '\0';
+    }
     app_state.rotation_x = 0.0f;
     app_state.rotation_y = 0.0f;
+    app_state.tf_lo = 96;
+    app_state.tf_hi = 255;
+    app_state.tf_opacity = 0.05f;
+    app_state.dirty_3d = VIEW3D_ALL;
+    stm_setup();
+    app_state.stats.window_start = stm_now();
     
     // Setup sokol-gfx
     sg_setup(&(sg_desc){
@@ -412,7 +1056,7 @@ static void init(void) {
     });
     
     // Create render target for 3D view
-    const int rt_size = 512;
+    const int rt_size = RENDER_3D_SIZE;
     app_state.render_target_3d = sg_make_image(&(sg_image_desc){
         .usage.render_attachment = true,
         .width = rt_size,
@@ -474,62 +1118,143 @@ static void init(void) {
             .mag_filter = SG_FILTER_LINEAR,
         })
     });
+    app_state.mesh_renderer = meshrenderer_new();
     app_state.render_3d_created = true;
 }
 
-// Helper function to render a mesh with lighting
-static void render_mesh_with_lighting(mesh* m, float light_dir[3]) {
+// Column-major 4x4 matrices, laid out and composed like sokol-gl's, so the
+// retained mesh pipeline and the immediate-mode overlays share one camera
+
+// out = a * b; out may alias either
+static void mat4_mul(float out[16], const float a[16], const float b[16]) {
+    float m[16];
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            m[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+        }
+    }
+    memcpy(out, m, sizeof(m));
+}
+
+static void mat4_perspective(float m[16], float fovy, float aspect, float znear, float zfar) {
+    float f = 1.0f / tanf(fovy / 2.0f);
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = f / aspect;
+    m[5] = f;
+    m[10] = (zfar + znear) / (znear - zfar);
+    m[11] = -1.0f;
+    m[14] = 2.0f * zfar * znear / (znear - zfar);
+}
+
+static void mat4_lookat(float m[16], const float eye[3], const float center[3], const float up[3]) {
+    float f[3] = {center[0] - eye[0], center[1] - eye[1], center[2] - eye[2]};
+    float fl = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    for (int i = 0; i < 3; i++) f[i] /= fl;
+    float s[3] = {f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0]};
+    float sl = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+    for (int i = 0; i < 3; i++) s[i] /= sl;
+    float u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0]};
+    for (int i = 0; i < 3; i++) {
+        m[i * 4] = s[i];
+        m[i * 4 + 1] = u[i];
+        m[i * 4 + 2] = -f[i];
+        m[i * 4 + 3] = 0.0f;
+    }
+    m[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+    m[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+    m[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+    m[15] = 1.0f;
+}
+
+// m = m * translation
+static void mat4_translate(float m[16], float x, float y, float z) {
+    const float t[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, x, y, z, 1};
+    mat4_mul(m, m, t);
+}
+
+// m = m * rotation by angle radians about the unit axis (x, y, z)
+static void mat4_rotate(float m[16], float angle, float x, float y, float z) {
+    float c = cosf(angle), s = sinf(angle), t = 1.0f - c;
+    const float r[16] = {
+        x * x * t + c,     y * x * t + z * s, x * z * t - y * s, 0,
+        x * y * t - z * s, y * y * t + c,     y * z * t + x * s, 0,
+        x * z * t + y * s, y * z * t - x * s, z * z * t + c,     0,
+        0,                 0,                 0,                 1,
+    };
+    mat4_mul(m, m, r);
+}
+
+// Queue a retained mesh for the 3D pass, uploading it on first use
+static void queue_mesh_draw(gpumesh** gpu, const mesh* m) {
+    if (m->num_triangles <= 0) return;
+    if (!*gpu) *gpu = gpumesh_upload(m);
+    if (app_state.num_mesh_draws == app_state.mesh_draws_capacity) {
+        app_state.mesh_draws_capacity = app_state.mesh_draws_capacity ? app_state.mesh_draws_capacity * 2 : 256;
+        app_state.mesh_draws = realloc(app_state.mesh_draws, app_state.mesh_draws_capacity * sizeof(gpumesh*));
+    }
+    app_state.mesh_draws[app_state.num_mesh_draws++] = *gpu;
+    app_state.triangles_drawn += m->num_triangles;
+}
+
+// Issue the queued meshes; called inside the 3D pass, before the sokol-gl overlays
+static void draw_queued_meshes(void) {
+    if (!app_state.mesh_renderer || app_state.num_mesh_draws == 0) return;
+    meshrenderer_begin(app_state.mesh_renderer, app_state.view_mvp, app_state.view_offset, app_state.light_dir);
+    for (int i = 0; i < app_state.num_mesh_draws; i++) {
+        meshrenderer_draw(app_state.mesh_renderer, app_state.mesh_draws[i]);
+    }
+}
+
+// Helper function to render a mesh with lighting, for backends the mesh pipeline has no shader for
+static void render_mesh_with_lighting(mesh* m, float light_dir[3], const float colors[256][3]) {
     if (!m || !m->vertices || m->num_triangles <= 0) return;
+    app_state.triangles_drawn += m->num_triangles;
+    
+    float ambient = 0.5f;  // Increased from 0.3f for brighter scene
+    float diffuse = 0.6f;  // Slightly reduced to compensate for higher ambient
     
     sgl_begin_triangles();
     
-    for (int i = 0; i < m->num_triangles; i++) {
-        float* v = &m->vertices[i * 9];
-        float* c = &m->colors[i * 9];
-        
-        // Calculate face normal using cross product
-        float v1[3] = {v[3] - v[0], v[4] - v[1], v[5] - v[2]};
-        float v2[3] = {v[6] - v[0], v[7] - v[1], v[8] - v[2]};
-        
-        float normal[3];
-        normal[0] = v1[1] * v2[2] - v1[2] * v2[1];
-        normal[1] = v1[2] * v2[0] - v1[0] * v2[2];
-        normal[2] = v1[0] * v2[1] - v1[1] * v2[0];
-        
-        // Normalize the normal
-        float normal_len = sqrtf(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
-        if (normal_len > 0.0001f) {
-            normal[0] /= normal_len;
-            normal[1] /= normal_len;
-            normal[2] /= normal_len;
-        }
+    for (int i = 0; i < m->num_triangles * 3; i++) {
+        const mesh_vertex* v = &m->vertices[m->indices[i]];
+        float p[3], normal[3];
+        mesh_vertex_position(m, v, p);
+        mesh_vertex_normal(v, normal);
         
         // Calculate lighting (dot product between normal and light direction)
         float dot = -(normal[0] * light_dir[0] + normal[1] * light_dir[1] + normal[2] * light_dir[2]);
         dot = fmaxf(0.0f, dot); // Clamp to positive values
-        
-        // Apply lighting with ambient component
-        float ambient = 0.5f;  // Increased from 0.3f for brighter scene
-        float diffuse = 0.6f;  // Slightly reduced to compensate for higher ambient
         float lighting = ambient + diffuse * dot;
         
-        // Apply lighting to vertex colors
-        // First vertex
+        const float* c = colors[v->value];
         sgl_c3f(c[0] * lighting, c[1] * lighting, c[2] * lighting);
-        sgl_v3f(v[0], v[1], v[2]);
-        
-        // Second vertex
-        sgl_c3f(c[3] * lighting, c[4] * lighting, c[5] * lighting);
-        sgl_v3f(v[3], v[4], v[5]);
-        
-        // Third vertex
-        sgl_c3f(c[6] * lighting, c[7] * lighting, c[8] * lighting);
-        sgl_v3f(v[6], v[7], v[8]);
+        sgl_v3f(p[0], p[1], p[2]);
     }
     
     sgl_end();
 }
 
+// Raycast the loaded volume or chunk into the 3D view's image, through the meshes' camera
+static void raycast_3d_view(const float view[16], float fovy) {
+    volume single;
+    const volume* vol = current_volume(&single, nullptr);
+    if (!app_state.ray_bricks.range) raybricks_build(&app_state.ray_bricks, vol);
+    raycamera cam;
+    raycamera_from_view(&cam, view, fovy);
+    transferfn tf;
+    transferfn_ramp(&tf, app_state.tf_lo, app_state.tf_hi, app_state.tf_opacity);
+    
+    const u8 background[3] = {51, 51, 51};  // the render target's clear colour
+    u8* pixels = malloc((size_t)RAYCAST_3D_SIZE * RAYCAST_3D_SIZE * 4);
+    u64 start = stm_now();
+    raycast_render(vol, &app_state.ray_bricks, &tf, &cam, 1.0f, background, RAYCAST_3D_SIZE, RAYCAST_3D_SIZE, pixels,
+                   &app_state.ray_stats);
+    app_state.raycast_ms = stm_ms(stm_since(start));
+    upload_view_image(&app_state.raycast_image, &app_state.snk_raycast, &app_state.raycast_created, pixels,
+                      RAYCAST_3D_SIZE, RAYCAST_3D_SIZE);
+    free(pixels);
+}
+
 // Render 3D view to texture
 static void render_3d_view(void) {
     if ((!app_state.loaded_chunk && !app_state.loaded_volume) || !app_state.render_3d_created) return;
@@ -540,12 +1265,13 @@ static void render_3d_view(void) {
     sgl_load_pipeline(app_state.sgl_pip_3d);
     
     // Setup 3D projection
+    const float fov = 45.0f;
+    float proj[16], view[16];
+    mat4_perspective(proj, sgl_rad(fov), 1.0f, 0.1f, 1000.0f);
     sgl_matrix_mode_projection();
-    sgl_perspective(sgl_rad(45.0f), 1.0f, 0.1f, 1000.0f);
+    sgl_load_matrix(proj);
     
     // Setup camera - adjust for volume vs single chunk
-    sgl_matrix_mode_modelview();
-    
     float center_x = 64.0f, center_y = 64.0f, center_z = 64.0f;
     float eye_dist = 200.0f;
     
@@ -557,33 +1283,131 @@ static void render_3d_view(void) {
         eye_dist = fmaxf(app_state.loaded_volume->x, fmaxf(app_state.loaded_volume->y, app_state.loaded_volume->z)) * CHUNK_LEN * 1.5f;
     }
     
-    sgl_lookat(center_x + eye_dist, center_y + eye_dist, center_z + eye_dist,  // eye
-               center_x, center_y, center_z,      // center
-               0.0f, 1.0f, 0.0f);                 // up
+    const float eye[3] = {center_x + eye_dist, center_y + eye_dist, center_z + eye_dist};
+    const float center[3] = {center_x, center_y, center_z};
+    const float up[3] = {0.0f, 1.0f, 0.0f};
+    mat4_lookat(view, eye, center, up);
     
     // Apply rotation
-    sgl_translate(center_x, center_y, center_z);
-    sgl_rotate(sgl_rad(app_state.rotation_x), 1.0f, 0.0f, 0.0f);
-    sgl_rotate(sgl_rad(app_state.rotation_y), 0.0f, 1.0f, 0.0f);
-    sgl_translate(-center_x, -center_y, -center_z);
+    mat4_translate(view, center_x, center_y, center_z);
+    mat4_rotate(view, sgl_rad(app_state.rotation_x), 1.0f, 0.0f, 0.0f);
+    mat4_rotate(view, sgl_rad(app_state.rotation_y), 0.0f, 1.0f, 0.0f);
+    mat4_translate(view, -center_x, -center_y, -center_z);
+    sgl_matrix_mode_modelview();
+    sgl_load_matrix(view);
+    mat4_mul(app_state.view_mvp, proj, view);
+    if (app_state.volume_rendering) {
+        raycast_3d_view(view, sgl_rad(fov));
+        return;
+    }
     
     // Fixed light direction (pointing down and slightly forward)
-    float light_dir[3] = {0.0f, -0.8f, -0.6f};
+    float* light_dir = app_state.light_dir;
+    light_dir[0] = 0.0f;
+    light_dir[1] = -0.8f;
+    light_dir[2] = -0.6f;
     // Normalize light direction
     float light_len = sqrtf(light_dir[0]*light_dir[0] + light_dir[1]*light_dir[1] + light_dir[2]*light_dir[2]);
     light_dir[0] /= light_len;
     light_dir[1] /= light_len;
     light_dir[2] /= light_len;
     
-    // Draw meshes - either volume meshes or single chunk mesh
-    if (app_state.chunk_meshes && app_state.num_chunk_meshes > 0) {
-        // Render all chunk meshes in the volume
-        for (int i = 0; i < app_state.num_chunk_meshes; i++) {
-            render_mesh_with_lighting(&app_state.chunk_meshes[i], light_dir);
+    // Vertex value -> colour, with the meshes' value range stretched over viridis
+    float colors[256][3];
+    u8 colors_rgb[256][3];
+    int lo = app_state.mesh_value_min, hi = app_state.mesh_value_max;
+    for (int i = 0; i < 256; i++) {
+        int idx = hi > lo ? (int)lrintf((i - lo) * 255.0f / (hi - lo)) : i;
+        rgb c = apply_viridis_colormap((u8)(idx < 0 ? 0 : idx > 255 ? 255 : idx));
+        colors[i][0] = c.r / 255.0f;
+        colors[i][1] = c.g / 255.0f;
+        colors[i][2] = c.b / 255.0f;
+        colors_rgb[i][0] = c.r;
+        colors_rgb[i][1] = c.g;
+        colors_rgb[i][2] = c.b;
+    }
+    meshrenderer* renderer = app_state.mesh_renderer;
+    if (renderer) meshrenderer_colormap(renderer, colors_rgb);
+    
+    // Draw meshes - either volume meshes or single chunk mesh. With the mesh
+    // pipeline they are only queued here and drawn from their GPU buffers in the 3D pass
+    app_state.triangles_drawn = 0;
+    app_state.chunks_drawn = app_state.chunks_outside = 0;
+    app_state.num_mesh_draws = 0;
+    app_state.view_offset[0] = app_state.view_offset[1] = app_state.view_offset[2] = 0.0f;
+    if (app_state.loaded_volume && meshregistry_count(app_state.chunk_meshes) > 0) {
+        // Render all chunk meshes in the volume, each at the coarsest level whose
+        // error stays under a pixel at the chunk's distance from the eye
+        float pixels_per_unit = RENDER_3D_SIZE / (2.0f * tanf(sgl_rad(fov) / 2.0f));
+        float sx = sinf(sgl_rad(app_state.rotation_x)), cx = cosf(sgl_rad(app_state.rotation_x));
+        float sy = sinf(sgl_rad(app_state.rotation_y)), cy = cosf(sgl_rad(app_state.rotation_y));
+        // Mesh origins are global; the view is laid out around the volume's first chunk
+        float window[3] = {
+            (float)app_state.volume_origin[2] * CHUNK_LEN,
+            (float)app_state.volume_origin[1] * CHUNK_LEN,
+            (float)app_state.volume_origin[0] * CHUNK_LEN,
+        };
+        memcpy(app_state.view_offset, window, sizeof(window));
+        sgl_push_matrix();
+        sgl_translate(-window[0], -window[1], -window[2]);
+        
+        // Chunks whose meshes' boxes miss the view are skipped
+        frustum view_frustum;
+        frustum_from_matrix(&view_frustum, app_state.view_mvp);
+        
+        meshentry* entries = meshregistry_entries(app_state.chunk_meshes);
+        for (s32 i = 0; i < meshregistry_count(app_state.chunk_meshes); i++) {
+            // Box around the chunk's surfaces, relative to the window like the modelview
+            f32 lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            for (int k = 0; k < entries[i].num_surfaces; k++) {
+                const mesh* m = &entries[i].lods[k].levels[0];
+                if (m->num_triangles == 0) continue;
+                f32 mlo[3], mhi[3];
+                mesh_box(m, mlo, mhi);
+                for (int a = 0; a < 3; a++) {
+                    lo[a] = fminf(lo[a], mlo[a] - window[a]);
+                    hi[a] = fmaxf(hi[a], mhi[a] - window[a]);
+                }
+            }
+            if (lo[0] > hi[0]) continue;
+            if (!frustum_test_box(&view_frustum, lo, hi)) {
+                app_state.chunks_outside++;
+                continue;
+            }
+            app_state.chunks_drawn++;
+            
+            // Chunk centre relative to the rotation centre, rotated like the modelview does
+            const s32* c = entries[i].chunk;
+            float x = c[2] * CHUNK_LEN - window[0] + CHUNK_LEN / 2.0f - center_x;
+            float y = c[1] * CHUNK_LEN - window[1] + CHUNK_LEN / 2.0f - center_y;
+            float z = c[0] * CHUNK_LEN - window[2] + CHUNK_LEN / 2.0f - center_z;
+            float rx = cy * x + sy * z, rz = -sy * x + cy * z;
+            float ry = cx * y - sx * rz;
+            rz = sx * y + cx * rz;
+            float dx = center_x + rx - eye[0], dy = center_y + ry - eye[1], dz = center_z + rz - eye[2];
+            float pixels_per_voxel = pixels_per_unit / fmaxf(sqrtf(dx * dx + dy * dy + dz * dz), 1.0f);
+            for (int k = 0; k < entries[i].num_surfaces; k++) {
+                meshlods* lods = &entries[i].lods[k];
+                if (lods->levels[0].num_triangles == 0) continue;
+                int level = 0;
+                while (level + 1 < MESH_DETAIL_LEVELS && lods->error[level + 1] * pixels_per_voxel <= 1.0f) level++;
+                if (renderer) {
+                    queue_mesh_draw(&entries[i].gpu[k][level], &lods->levels[level]);
+                } else {
+                    render_mesh_with_lighting(&lods->levels[level], light_dir, colors);
+                }
+            }
+        }
+        sgl_pop_matrix();
+    } else {
+        // Render single chunk meshes
+        for (int k = 0; k < app_state.num_current_meshes; k++) {
+            if (renderer) {
+                queue_mesh_draw(&app_state.current_gpu[k], &app_state.current_meshes[k]);
+            } else {
+                render_mesh_with_lighting(&app_state.current_meshes[k], light_dir, colors);
+            }
         }
-    } else if (app_state.current_mesh.vertices && app_state.current_mesh.num_triangles > 0) {
-        // Render single chunk mesh
-        render_mesh_with_lighting(&app_state.current_mesh, light_dir);
     }
     
     // Draw slice planes as semi-transparent quads
@@ -707,7 +1531,7 @@ void draw_slice_viewer(struct nk_context *ctx, const char* title, int view_idx,
 
     if (nk_begin(ctx, title, nk_rect(x, y, 300, 350),
                  NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE |
-                 NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE)) {
+                 NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE | NK_WINDOW_NO_SCROLLBAR)) {
 
         // Highlight active window
         if (app_state.active_view == view_idx) {
@@ -725,49 +1549,145 @@ void draw_slice_viewer(struct nk_context *ctx, const char* title, int view_idx,
                 case 2: max_val = app_state.loaded_volume->x * CHUNK_LEN - 1; break;
             }
         }
-        sprintf(buffer, "%s View - %s: %d / %d",
+        sprintf(buffer, "%s View - %s: %d / %d  (%.2fx)",
                 view_names[view_idx],
                 axis_names[view_idx],
                 app_state.current_slice[view_idx],
-                max_val);
+                max_val,
+                app_state.view_zoom[view_idx]);
         nk_layout_row_dynamic(ctx, 20, 1);
         nk_label(ctx, buffer, NK_TEXT_CENTERED);
 
+        // Thick-slab projection along the view's axis
+        static const char* slab_modes[] = {"Slice", "MIP", "Mean", "MinIP"};
+        nk_layout_row_dynamic(ctx, 25, 2);
+        int mode = nk_combo(ctx, slab_modes, 4, app_state.slab_mode[view_idx], 20, nk_vec2(120, 120));
+        int thickness = app_state.slab_thickness[view_idx];
+        nk_property_int(ctx, "Slab:", 1, &thickness, max_val + 1, 1, 1);
+        bool slab_changed = mode != app_state.slab_mode[view_idx] ||
+                            (mode > 0 && thickness != app_state.slab_thickness[view_idx]);
+        app_state.slab_mode[view_idx] = mode;
+        app_state.slab_thickness[view_idx] = thickness;
+
         // Make window clickable to set as active
         struct nk_rect bounds = nk_window_get_bounds(ctx);
         if (nk_input_is_mouse_click_in_rect(&ctx->input, NK_BUTTON_LEFT, bounds)) {
             app_state.active_view = view_idx;
         }
 
-        // Display the image with aspect ratio maintained
+        // The image fills the rest of the panel and is rendered at its pixel size
+        struct nk_rect content_bounds = nk_window_get_content_region(ctx);
+        float used = app_state.active_view == view_idx ? 80 : 55; // labels and slab row above
+        float available_height = content_bounds.h - used;
+        if (available_height < 16) available_height = 16;
+        nk_layout_row_dynamic(ctx, available_height, 1);
+        struct nk_rect image_rect = nk_widget_bounds(ctx);
+
+        float dpi = sapp_dpi_scale();
+        int w = (int)(image_rect.w * dpi);
+        int h = (int)(image_rect.h * dpi);
+        bool changed = slab_changed || w != app_state.view_size[view_idx][1] || h != app_state.view_size[view_idx][0];
+        app_state.view_size[view_idx][0] = h;
+        app_state.view_size[view_idx][1] = w;
+
+        // Fit the volume to the panel on first display
+        if (app_state.view_zoom[view_idx] <= 0.0f && w > 0 && h > 0) {
+            float fit_r = h / (2.0f * app_state.view_center[view_idx][0]);
+            float fit_c = w / (2.0f * app_state.view_center[view_idx][1]);
+            app_state.view_zoom[view_idx] = fit_r < fit_c ? fit_r : fit_c;
+            changed = true;
+        }
+
+        // Wheel zooms around the cursor, left drag pans
+        if (nk_input_is_mouse_hovering_rect(&ctx->input, image_rect) && app_state.view_zoom[view_idx] > 0.0f) {
+            float zoom = app_state.view_zoom[view_idx];
+            float* center = app_state.view_center[view_idx];
+            float wheel = ctx->input.mouse.scroll_delta.y;
+            if (wheel != 0.0f) {
+                float mr = (ctx->input.mouse.pos.y - (image_rect.y + image_rect.h / 2)) * dpi;
+                float mc = (ctx->input.mouse.pos.x - (image_rect.x + image_rect.w / 2)) * dpi;
+                float new_zoom = fminf(64.0f, fmaxf(1.0f / 64.0f, zoom * powf(1.15f, wheel)));
+                // keep the voxel under the cursor in place
+                center[0] += mr / zoom - mr / new_zoom;
+                center[1] += mc / zoom - mc / new_zoom;
+                app_state.view_zoom[view_idx] = new_zoom;
+                changed = true;
+            }
+            if (ctx->input.mouse.buttons[NK_BUTTON_LEFT].down &&
+                (ctx->input.mouse.delta.x != 0.0f || ctx->input.mouse.delta.y != 0.0f)) {
+                center[0] -= ctx->input.mouse.delta.y * dpi / zoom;
+                center[1] -= ctx->input.mouse.delta.x * dpi / zoom;
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            update_slice_texture(view_idx);
+        }
+
         if (app_state.slice_images_created[view_idx]) {
-            // Get the available content area
+            nk_image(ctx, nk_image_handle(snk_nkhandle(app_state.snk_imgs[view_idx])));
+        } else {
+            nk_spacing(ctx, 1);
+        }
+    }
+    nk_end(ctx);
+}
+
+// Oblique viewer: the plane through the crosshair at a user-chosen orientation
+static void draw_oblique_viewer(struct nk_context *ctx, float x, float y) {
+    if (nk_begin(ctx, "Oblique Slice Viewer", nk_rect(x, y, 300, 420),
+                 NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE |
+                 NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE)) {
+        
+        float yaw = app_state.oblique_yaw;
+        float pitch = app_state.oblique_pitch;
+        nk_bool trilinear = app_state.oblique_trilinear;
+        
+        nk_layout_row_dynamic(ctx, 25, 2);
+        nk_property_float(ctx, "Yaw", -180.0f, &app_state.oblique_yaw, 180.0f, 1.0f, 0.5f);
+        nk_property_float(ctx, "Pitch", -180.0f, &app_state.oblique_pitch, 180.0f, 1.0f, 0.5f);
+        nk_layout_row_dynamic(ctx, 20, 1);
+        nk_checkbox_label(ctx, "Trilinear", &trilinear);
+        
+        if (yaw != app_state.oblique_yaw || pitch != app_state.oblique_pitch ||
+            (bool)trilinear != app_state.oblique_trilinear) {
+            app_state.oblique_trilinear = trilinear;
+            update_oblique_texture();
+        }
+        
+        if (app_state.oblique_created) {
             struct nk_rect content_bounds = nk_window_get_content_region(ctx);
             float available_width = content_bounds.w;
-            float available_height = content_bounds.h - 60; // Account for the labels above
-
-            // Calculate the size to maintain square aspect ratio
+            float available_height = content_bounds.h - 60; // Account for the controls above
             float size = (available_width < available_height) ? available_width : available_height;
-
-            // Center the image if there's extra space
-            if (available_width > size) {
-                float padding = (available_width - size) / 2.0f;
-                nk_layout_row_begin(ctx, NK_STATIC, size, 3);
-                nk_layout_row_push(ctx, padding);
-                nk_spacing(ctx, 1);
-                nk_layout_row_push(ctx, size);
-                nk_image(ctx, nk_image_handle(snk_nkhandle(app_state.snk_imgs[view_idx])));
-                nk_layout_row_end(ctx);
-            } else {
-                nk_layout_row_dynamic(ctx, size, 1);
-                nk_image(ctx, nk_image_handle(snk_nkhandle(app_state.snk_imgs[view_idx])));
-            }
+            
+            nk_layout_row_dynamic(ctx, size, 1);
+            nk_image(ctx, nk_image_handle(snk_nkhandle(app_state.snk_oblique)));
         }
     }
     nk_end(ctx);
 }
 
+// Close the stats window once it spans a second
+static void account_frame(u64 start) {
+    frame_stats* st = &app_state.stats;
+    st->cpu_ms += stm_ms(stm_since(start));
+    st->frames++;
+    double elapsed = stm_sec(stm_since(st->window_start));
+    if (elapsed < 1.0) return;
+    st->avg_cpu_ms = st->cpu_ms / st->frames;
+    st->fps = st->frames / elapsed;
+    st->last_renders_3d = st->renders_3d;
+    st->last_uploads = st->uploads;
+    st->window_start = stm_now();
+    st->cpu_ms = 0.0;
+    st->frames = st->renders_3d = st->uploads = 0;
+}
+
 static void frame(void) {
+    u64 frame_start = stm_now();
+    
     // Start new Nuklear frame
     struct nk_context *ctx = snk_new_frame();
 
@@ -792,6 +1712,7 @@ static void frame(void) {
                     chunk_free(app_state.loaded_chunk);
                     app_state.loaded_chunk = NULL;
                 }
+                raybricks_free(&app_state.ray_bricks);
                 
                 // Reset chunk parameters
                 for (int i = 0; i < 3; i++) {
@@ -902,7 +1823,31 @@ static void frame(void) {
             if (nk_button_label(ctx, "Load Volume (2x2x2)")) {
                 load_volume();
             }
+            
+            // Window/level applied to the slice views
+            nk_layout_row_dynamic(ctx, 20, 1);
+            nk_label(ctx, "Window / Level:", NK_TEXT_LEFT);
+            nk_layout_row_dynamic(ctx, 25, 2);
+            int window = app_state.window;
+            int level = app_state.level;
+            nk_property_int(ctx, "Window", 1, &window, 256, 1, 1);
+            nk_property_int(ctx, "Level", 0, &level, 255, 1, 1);
+            if (window != app_state.window || level != app_state.level) {
+                app_state.window = (u16)window;
+                app_state.level = (u8)level;
+                for (int i = 0; i < 3; i++) {
+                    update_slice_texture(i);
+                }
+            }
         }
+        
+        // Idle frames should cost next to nothing: no 3D pass, no uploads
+        const frame_stats* st = &app_state.stats;
+        char timing[128];
+        snprintf(timing, sizeof(timing), "Frame: %.2f ms CPU, %.0f fps, %d 3D renders/s, %d uploads/s",
+                 st->avg_cpu_ms, st->fps, st->last_renders_3d, st->last_uploads);
+        nk_layout_row_dynamic(ctx, 20, 1);
+        nk_label(ctx, timing, NK_TEXT_LEFT);
     }
     nk_end(ctx);
 
@@ -912,6 +1857,7 @@ static void frame(void) {
         draw_slice_viewer(ctx, "XY Slice Viewer", 0, 520, 10);
         draw_slice_viewer(ctx, "XZ Slice Viewer", 1, 830, 10);
         draw_slice_viewer(ctx, "YZ Slice Viewer", 2, 520, 370);
+        draw_oblique_viewer(ctx, 1140, 10);
         
         // Draw 3D viewer
         if (nk_begin(ctx, "3D View", nk_rect(830, 370, 300, 400),
@@ -925,53 +1871,74 @@ static void frame(void) {
             nk_layout_row_dynamic(ctx, 25, 1);
             int threshold = (int)app_state.iso_threshold;
             nk_property_int(ctx, "##threshold", 0, &threshold, 255, 1, 5);
-            app_state.iso_threshold = (u8)threshold;
+            if (threshold != app_state.iso_threshold) {
+                app_state.iso_threshold = (u8)threshold;
+                app_state.dirty_3d |= VIEW3D_THRESHOLD;
+                // The span-space index makes remeshing cheap enough to follow the slider
+                if (app_state.num_chunk_lods > 0) regenerate_meshes();
+            }
+            
+            // Second surface, e.g. dense material over the papyrus; extracted in the same pass
+            nk_layout_row_dynamic(ctx, 25, 2);
+            nk_bool second = app_state.second_surface;
+            nk_checkbox_label(ctx, "Second surface", &second);
+            int second_threshold = (int)app_state.second_iso_threshold;
+            nk_property_int(ctx, "##second", 0, &second_threshold, 255, 1, 5);
+            if (second != app_state.second_surface || second_threshold != app_state.second_iso_threshold) {
+                app_state.second_surface = second;
+                app_state.second_iso_threshold = (u8)second_threshold;
+                app_state.dirty_3d |= VIEW3D_THRESHOLD;
+                if (app_state.num_chunk_lods > 0) regenerate_meshes();
+            }
+            
+            // Mesh level of detail and regenerate button
+            static const char* lod_names[] = {"Full resolution", "1/2", "1/4", "1/8"};
+            nk_layout_row_dynamic(ctx, 25, 1);
+            app_state.mesh_lod = nk_combo(ctx, lod_names, MESH_MAX_LOD + 1, app_state.mesh_lod, 20, nk_vec2(150, 120));
+            static const char* algorithm_names[] = {"Marching cubes", "Surface nets"};
+            nk_layout_row_dynamic(ctx, 25, 1);
+            app_state.mesh_algorithm = nk_combo(ctx, algorithm_names, 2, app_state.mesh_algorithm, 20, nk_vec2(150, 80));
             
-            // Regenerate mesh button
             nk_layout_row_dynamic(ctx, 30, 1);
             if (nk_button_label(ctx, "Regenerate Mesh")) {
-                if (app_state.loaded_volume) {
-                    // Regenerate all volume meshes
-                    if (app_state.chunk_meshes) {
-                        for (int i = 0; i < app_state.num_chunk_meshes; i++) {
-                            mesh_free(&app_state.chunk_meshes[i]);
-                        }
-                        free(app_state.chunk_meshes);
-                        app_state.chunk_meshes = NULL;
-                        app_state.num_chunk_meshes = 0;
-                    }
-                    
-                    // Generate new meshes
-                    int total_chunks = app_state.loaded_volume->z * app_state.loaded_volume->y * app_state.loaded_volume->x;
-                    app_state.chunk_meshes = malloc(total_chunks * sizeof(mesh));
-                    app_state.num_chunk_meshes = 0;
-                    
-                    for (int z = 0; z < app_state.loaded_volume->z; z++) {
-                        for (int y = 0; y < app_state.loaded_volume->y; y++) {
-                            for (int x = 0; x < app_state.loaded_volume->x; x++) {
-                                int idx = z * app_state.loaded_volume->y * app_state.loaded_volume->x + 
-                                         y * app_state.loaded_volume->x + x;
-                                app_state.chunk_meshes[app_state.num_chunk_meshes] = 
-                                    generate_mesh_from_chunk(&app_state.loaded_volume->chunks[idx], app_state.iso_threshold);
-                                
-                                // Offset the mesh vertices
-                                mesh* m = &app_state.chunk_meshes[app_state.num_chunk_meshes];
-                                if (m->vertices && m->num_triangles > 0) {
-                                    for (int i = 0; i < m->num_triangles * 3; i++) {
-                                        m->vertices[i * 3 + 0] += x * CHUNK_LEN;
-                                        m->vertices[i * 3 + 1] += y * CHUNK_LEN;
-                                        m->vertices[i * 3 + 2] += z * CHUNK_LEN;
-                                    }
-                                    app_state.num_chunk_meshes++;
-                                }
-                            }
-                        }
-                    }
-                } else if (app_state.loaded_chunk) {
-                    // Regenerate single chunk mesh
-                    mesh_free(&app_state.current_mesh);
-                    app_state.current_mesh = generate_mesh_from_chunk(app_state.loaded_chunk, app_state.iso_threshold);
+                regenerate_meshes();
+            }
+            nk_layout_row_dynamic(ctx, 20, 1);
+            char drawn[128];
+            snprintf(drawn, sizeof(drawn), "Triangles drawn: %d", app_state.triangles_drawn);
+            nk_label(ctx, drawn, NK_TEXT_LEFT);
+            if (app_state.loaded_volume) {
+                snprintf(drawn, sizeof(drawn), "Chunks drawn: %d, %d outside the view", app_state.chunks_drawn,
+                         app_state.chunks_outside);
+                nk_label(ctx, drawn, NK_TEXT_LEFT);
+            }
+            
+            // CPU raycasting of the voxels themselves, in place of the meshes
+            nk_layout_row_dynamic(ctx, 25, 1);
+            nk_bool volume_rendering = app_state.volume_rendering;
+            nk_checkbox_label(ctx, "Volume rendering", &volume_rendering);
+            if ((bool)volume_rendering != app_state.volume_rendering) {
+                app_state.volume_rendering = volume_rendering;
+                app_state.dirty_3d |= VIEW3D_TRANSFER;
+            }
+            if (app_state.volume_rendering) {
+                nk_layout_row_dynamic(ctx, 25, 3);
+                int tf_lo = app_state.tf_lo, tf_hi = app_state.tf_hi;
+                float tf_opacity = app_state.tf_opacity;
+                nk_property_int(ctx, "#From", 0, &tf_lo, 255, 1, 5);
+                nk_property_int(ctx, "#To", 0, &tf_hi, 255, 1, 5);
+                nk_property_float(ctx, "#Opacity", 0.0f, &tf_opacity, 1.0f, 0.01f, 0.005f);
+                if (tf_lo != app_state.tf_lo || tf_hi != app_state.tf_hi || tf_opacity != app_state.tf_opacity) {
+                    app_state.tf_lo = (u8)tf_lo;
+                    app_state.tf_hi = (u8)tf_hi;
+                    app_state.tf_opacity = tf_opacity;
+                    app_state.dirty_3d |= VIEW3D_TRANSFER;
                 }
+                nk_layout_row_dynamic(ctx, 20, 1);
+                snprintf(drawn, sizeof(drawn), "Raycast: %.1f ms, %lld samples, %lld empty bricks skipped",
+                         app_state.raycast_ms, (long long)app_state.ray_stats.samples,
+                         (long long)app_state.ray_stats.skipped_bricks);
+                nk_label(ctx, drawn, NK_TEXT_LEFT);
             }
             
             // Rotation controls
@@ -996,12 +1963,17 @@ static void frame(void) {
                 );
                 
                 if (nk_input_is_mouse_hovering_rect(&ctx->input, image_rect)) {
-                    if (ctx->input.mouse.buttons[NK_BUTTON_LEFT].down) {
+                    if (ctx->input.mouse.buttons[NK_BUTTON_LEFT].down &&
+                        (ctx->input.mouse.delta.x != 0.0f || ctx->input.mouse.delta.y != 0.0f)) {
                         app_state.rotation_y += ctx->input.mouse.delta.x * 0.5f;
                         app_state.rotation_x += ctx->input.mouse.delta.y * 0.5f;
+                        app_state.dirty_3d |= VIEW3D_CAMERA;
                     }
                 }
                 
+                // The raycaster's image stands in for the render target
+                bool raycast = app_state.volume_rendering && app_state.raycast_created;
+                snk_image_t shown = raycast ? app_state.snk_raycast : app_state.snk_render_target_3d;
                 // Center the image if there's extra space
                 if (available_width > size) {
                     float padding = (available_width - size) / 2.0f;
@@ -1009,39 +1981,44 @@ static void frame(void) {
                     nk_layout_row_push(ctx, padding);
                     nk_spacing(ctx, 1);
                     nk_layout_row_push(ctx, size);
-                    nk_image(ctx, nk_image_handle(snk_nkhandle(app_state.snk_render_target_3d)));
+                    nk_image(ctx, nk_image_handle(snk_nkhandle(shown)));
                     nk_layout_row_end(ctx);
                 } else {
                     nk_layout_row_dynamic(ctx, size, 1);
-                    nk_image(ctx, nk_image_handle(snk_nkhandle(app_state.snk_render_target_3d)));
+                    nk_image(ctx, nk_image_handle(snk_nkhandle(shown)));
                 }
             }
         }
         nk_end(ctx);
     }
 
-    // Render 3D view to texture first
-    if ((app_state.loaded_chunk || app_state.loaded_volume) && app_state.render_3d_created) {
+    // Render 3D view to texture first, when something it shows changed
+    if ((app_state.loaded_chunk || app_state.loaded_volume) && app_state.render_3d_created && app_state.dirty_3d) {
+        app_state.dirty_3d = 0;
+        app_state.stats.renders_3d++;
         render_3d_view();
         
-        // Render to texture
-        sg_begin_pass(&(sg_pass){
-            .action = {
-                .colors[0] = {
-                    .load_action = SG_LOADACTION_CLEAR,
-                    .clear_value = { 0.2f, 0.2f, 0.2f, 1.0f }  // Brightened background
-                }
-            },
-            .attachments = app_state.attachments_3d
-        });
-        sgl_context_draw(app_state.sgl_ctx_3d);
-        sg_end_pass();
+        // Render to texture; the raycaster uploads its own image instead
+        if (!app_state.volume_rendering) {
+            sg_begin_pass(&(sg_pass){
+                .action = {
+                    .colors[0] = {
+                        .load_action = SG_LOADACTION_CLEAR,
+                        .clear_value = { 0.2f, 0.2f, 0.2f, 1.0f }  // Brightened background
+                    }
+                },
+                .attachments = app_state.attachments_3d
+            });
+            draw_queued_meshes();
+            sgl_context_draw(app_state.sgl_ctx_3d);
+            sg_end_pass();
         
-        // Check for any sokol-gl errors
-        sgl_error_t err = sgl_context_error(app_state.sgl_ctx_3d);
-        if (err.any) {
-            printf("sokol-gl error: vertices_full=%d, commands_full=%d\n", 
-                   err.vertices_full, err.commands_full);
+            // Check for any sokol-gl errors
+            sgl_error_t err = sgl_context_error(app_state.sgl_ctx_3d);
+            if (err.any) {
+                printf("sokol-gl error: vertices_full=%d, commands_full=%d\n", 
+                       err.vertices_full, err.commands_full);
+            }
         }
     }
     
@@ -1058,6 +2035,7 @@ static void frame(void) {
     snk_render(sapp_width(), sapp_height());
     sg_end_pass();
     sg_commit();
+    account_frame(frame_start);
 }
 
 static void cleanup(void) {
@@ -1072,15 +2050,23 @@ static void cleanup(void) {
     }
     
     // Clean up chunk meshes
-    if (app_state.chunk_meshes) {
-        for (int i = 0; i < app_state.num_chunk_meshes; i++) {
-            mesh_free(&app_state.chunk_meshes[i]);
-        }
-        free(app_state.chunk_meshes);
+    meshregistry_free(app_state.chunk_meshes);
+    chunkcache_free(app_state.halo_cache);
+    free_chunk_lods();
+    raybricks_free(&app_state.ray_bricks);
+    
+    // Clean up single chunk meshes
+    for (int k = 0; k < app_state.num_current_meshes; k++) {
+        mesh_free(&app_state.current_meshes[k]);
+        gpumesh_free(app_state.current_gpu[k]);
     }
+    meshrenderer_free(app_state.mesh_renderer);
+    free(app_state.mesh_draws);
     
-    // Clean up single mesh
-    mesh_free(&app_state.current_mesh);
+    tilecache_free(app_state.tiles);
+    for (int i = 0; i < 3; i++) {
+        slabproj_free(&app_state.slabs[i]);
+    }
     
     // Clean up textures
     for (int i = 0; i < 3; i++) {
@@ -1089,6 +2075,14 @@ static void cleanup(void) {
             sg_destroy_image(app_state.slice_images[i]);
         }
     }
+    if (app_state.oblique_created) {
+        snk_destroy_image(app_state.snk_oblique);
+        sg_destroy_image(app_state.oblique_image);
+    }
+    if (app_state.raycast_created) {
+        snk_destroy_image(app_state.snk_raycast);
+        sg_destroy_image(app_state.raycast_image);
+    }
     
     // Clean up 3D rendering resources
     if (app_state.render_3d_created) {
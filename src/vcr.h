@@ -52,6 +52,14 @@ typedef int64_t s64;
 typedef float f32;
 typedef double f64;
 
+// GCC/clang vector extensions; lowered to SSE/AVX or NEON depending on the target
+typedef f32 f32x8 __attribute__((vector_size(32)));
+typedef s32 s32x8 __attribute__((vector_size(32)));
+typedef u32 u32x8 __attribute__((vector_size(32)));
+typedef u8 u8x8 __attribute__((vector_size(8)));
+typedef u8 u8x16 __attribute__((vector_size(16)));
+typedef u8 u8x32 __attribute__((vector_size(32)));
+
 #define overload __attribute__((overloadable))
 #define purefunc __attribute__((pure))
 #define constfunc __attribute__((const))
@@ -69,6 +77,7 @@ typedef u8 slice[CHUNK_LEN][CHUNK_LEN];
 typedef struct volume {
   s32 z, y, x;
   chunk* chunks;
+  const chunk** refs;  // when set, chunks are borrowed (e.g. from a chunkcache), one pointer per slot
 } volume;
 
 typedef struct image {
@@ -102,6 +111,10 @@ void print_assert_details(const char* expr, const char* file, int line, const ch
 void assert_fail_with_backtrace(const char* expr, const char* file, int line, const char* func);
 bool path_exists(const char *path);
 char* read_file(const char* filepath);
+// Monotonic clock in seconds, for timing runs
+f64 now_seconds(void);
+// 8-bit PNG with 1 (grey), 3 (RGB) or 4 (RGBA) interleaved channels, rows top-down
+err write_png(const char* path, const u8* pixels, s32 h, s32 w, s32 channels);
 
 // chunk
 static inline chunk* chunk_new() {return malloc(CHUNK_LEN*CHUNK_LEN*CHUNK_LEN);}
@@ -114,6 +127,7 @@ static inline volume* volume_new(s32 z, s32 y, s32 x) {
     v->y = y;
     v->x = x;
     v->chunks = calloc(z * y * x, sizeof(chunk));
+    v->refs = nullptr;
     return v;
 }
 static inline void volume_free(volume* v) {
@@ -122,6 +136,11 @@ static inline void volume_free(volume* v) {
         free(v);
     }
 }
+static inline const chunk* volume_chunk(const volume* v, s32 z, s32 y, s32 x) {
+    if (z < 0 || y < 0 || x < 0 || z >= v->z || y >= v->y || x >= v->x) return nullptr;
+    if (v->refs) return v->refs[(z * v->y + y) * v->x + x];
+    return &v->chunks[(z * v->y + y) * v->x + x];
+}
 
 // image
 static inline image* image_new(s32 y, s32 x) {
@@ -142,23 +161,350 @@ static inline void image_free(image* img) {
 zarrinfo zarr_parse_zarray(const char* json_string);
 chunk* zarr_read_chunk(char* path, zarrinfo metadata);
 volume* zarr_read_volume(char* path, zarrinfo metadata, s32 z_start, s32 y_start, s32 x_start, s32 z_chunks, s32 y_chunks, s32 x_chunks);
+void zarr_chunk_path(char* out, size_t size, const char* path, zarrinfo metadata, s32 z, s32 y, s32 x);
+// root is an array, or a multiscale group whose array at level is opened. path gets the array's
+// directory and multiscale (may be null) whether root was a group; false with an error logged on failure
+bool zarr_open_array(const char* root, s32 level, char* path, size_t size, zarrinfo* info, bool* multiscale);
+
+// chunk cache
+// Thread-safe LRU of decompressed chunks of one zarr array. Acquired chunks are
+// pinned until released; concurrent misses on the same chunk decode it once.
+typedef struct chunkcache chunkcache;
+chunkcache* chunkcache_new(const char* path, zarrinfo metadata, size_t budget_bytes);
+void chunkcache_free(chunkcache* cc);
+const chunk* chunkcache_acquire(chunkcache* cc, s32 cz, s32 cy, s32 cx);
+void chunkcache_release(chunkcache* cc, s32 cz, s32 cy, s32 cx);
+// Pins the box of vol->z x vol->y x vol->x chunks from lo (z, y, x chunk coordinates) into a newly
+// allocated vol->refs, z, y, x order, decoding on the thread pool; slots outside the grid are null
+void chunkcache_acquire_box(chunkcache* cc, const s32 lo[3], volume* vol);
+// Unpins a box taken with chunkcache_acquire_box and frees vol->refs
+void chunkcache_release_box(chunkcache* cc, const s32 lo[3], volume* vol);
+void chunkcache_grid(const chunkcache* cc, s32 grid[3]);
+void chunkcache_stats(chunkcache* cc, u64* hits, u64* misses);
 
 // mesh structure for marching cubes output
+constexpr s32 MESH_POS_FRAC = 8;  // fractional bits of chunk mesh positions
+
+// Quantized mesh vertex, 10 bytes
+typedef struct mesh_vertex {
+    u16 pos[3];           // x,y,z from the mesh origin, in units of mesh.scale voxels
+    s8 normal[2];         // unit normal, octahedral encoding
+    u8 value;             // scalar at the vertex, colormapped at render time
+    u8 pad;
+} mesh_vertex;
+
 typedef struct mesh {
-    float* vertices;      // x,y,z per vertex (num_triangles * 9 floats)
-    float* colors;        // r,g,b per vertex (num_triangles * 9 floats)
+    mesh_vertex* vertices;
+    u32* indices;         // 3 vertex indices per triangle
+    s32 origin[3];        // x,y,z in voxels of position (0, 0, 0)
+    f32 scale;            // voxels per position unit
+    u8 value_min;         // range of the vertex values, stretched over the colormap when drawn
+    u8 value_max;
+    u16 pos_min[3];       // bounding box of the positions, x,y,z; meaningless without triangles
+    u16 pos_max[3];
+    int num_vertices;
     int num_triangles;
 } mesh;
 
+static inline void mesh_vertex_position(const mesh* m, const mesh_vertex* v, f32 out[3]) {
+    for (s32 i = 0; i < 3; i++) {
+        out[i] = m->origin[i] + v->pos[i] * m->scale;
+    }
+}
+
+// Octahedral decode: the lower hemisphere is folded over the diagonals of the square
+static inline void mesh_vertex_normal(const mesh_vertex* v, f32 out[3]) {
+    f32 x = v->normal[0] / 127.0f, y = v->normal[1] / 127.0f;
+    f32 z = 1.0f - fabsf(x) - fabsf(y);
+    f32 t = fmaxf(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    f32 len = sqrtf(x * x + y * y + z * z);
+    out[0] = x / len;
+    out[1] = y / len;
+    out[2] = z / len;
+}
+
+// threadpool
+s32 parallel_thread_count(void);
+void parallel_for(s32 count, void (*fn)(void* ctx, s32 i), void* ctx);
+
+// slice
+typedef enum interp {
+  INTERP_NEAREST,
+  INTERP_TRILINEAR
+} interp;
+
+// An arbitrary plane through the volume, in z, y, x voxel coordinates.
+// Output pixel (r, c) samples origin + c*u + r*v.
+typedef struct plane {
+  f32 origin[3];
+  f32 u[3];
+  f32 v[3];
+} plane;
+
+// Volume axes (z=0, y=1, x=2) along the rows and columns of the XY, XZ and YZ views
+extern const s32 view_axes[3][2];
+
+err reslice_plane(const volume* vol, const plane* p, s32 h, s32 w, interp mode, u8* out);
+void window_level_lut(u8 level, u16 window, u8 lut[256]);
+
+// Thick-slab projection of an axis-aligned view, updated incrementally as the slab slides
+typedef enum slab_reducer {
+  SLAB_MAX,
+  SLAB_MEAN,
+  SLAB_MIN
+} slab_reducer;
+
+typedef struct slabproj {
+  s32 axis, h, w;
+  f32 row0, col0, step;   // view geometry the state was built for
+  s32 thickness;
+  slab_reducer reducer;
+  s32 first;              // first plane in the slab
+  bool valid;
+  u8* ring;               // thickness planes of h*w; plane p lives at slot p % thickness
+  u32* sum;               // running sum for SLAB_MEAN
+  u8* result;
+} slabproj;
+
+const u8* slabproj_update(slabproj* sp, const volume* vol, s32 axis, s32 center, s32 thickness, slab_reducer reducer,
+                          s32 h, s32 w, f32 row0, f32 col0, f32 step);
+void slabproj_free(slabproj* sp);
+
+// tile cache
+constexpr s32 TILE_LEN = 128;
+
+// A rendered TILE_LEN^2 piece of an axis-aligned slice, in global voxel coordinates
+typedef struct tilekey {
+  s32 plane;     // index along the view's normal axis
+  s32 tx, ty;    // tile column and row within the plane at this lod
+  u8 axis;       // view: 0=XY, 1=XZ, 2=YZ
+  u8 lod;        // one tile pixel covers 2^lod voxels
+  u8 level;      // window/level the pixels were mapped with
+  u16 window;
+} tilekey;
+
+typedef struct tilecache tilecache;
+
+tilecache* tilecache_new(size_t budget_bytes);
+void tilecache_free(tilecache* tc);
+void tilecache_clear(tilecache* tc);
+void tilecache_begin_frame(tilecache* tc);
+const u8* tilecache_get(tilecache* tc, const tilekey* key);
+u8* tilecache_put(tilecache* tc, const tilekey* key, const s32 deps_lo[3], const s32 deps_hi[3]);
+s32 tilecache_invalidate_chunk(tilecache* tc, s32 cz, s32 cy, s32 cx);
+size_t tilecache_bytes(const tilecache* tc);
+void slice_tile_footprint(const tilekey* key, s32 deps_lo[3], s32 deps_hi[3]);
+void slice_render_tile(const volume* vol, const s32 vol_origin[3], const tilekey* key, const u8 lut[256], u8* out);
+
 // marching cubes
-mesh generate_mesh_from_chunk(const chunk* volume_data, u8 iso_threshold);
-mesh generate_mesh_from_volume(const volume* vol, u8 iso_threshold);
+constexpr s32 MESH_MAX_LOD = 3;  // meshing at 1x, 2x, 4x or 8x voxel spacing
+
+constexpr s32 MESH_BRICK = 8;    // cells per side of a span-space brick
+constexpr s32 MESH_MAX_ISOS = 4;  // isovalues the tools extract in one sweep
+
+// Isosurface extraction engines behind the generate_* calls
+typedef enum mesh_algorithm {
+    MESH_MARCHING_CUBES,  // shared-vertex marching cubes, up to 5 triangles per cell
+    MESH_SURFACE_NETS     // naive surface nets: a vertex per cell and a quad per crossing edge, no slivers
+} mesh_algorithm;
+
+// Box-filtered copies of a chunk; levels[l] holds (CHUNK_LEN >> l)^3 voxels, levels[0] is unused.
+// bricks[l] is the span-space index of level l: the (min, max) voxel pair of every
+// MESH_BRICK^3 block of cells in z, y, x order, so a threshold change only visits
+// bricks whose range contains it
+typedef struct chunklods {
+    u8* levels[MESH_MAX_LOD + 1];
+    u8* bricks[MESH_MAX_LOD + 1];
+} chunklods;
+
+void chunklods_build(chunklods* lods, const chunk* c);
+void chunklods_free(chunklods* lods);
+// lods may be null, in which case the requested level is downsampled on the fly
+mesh generate_mesh_from_chunk(const chunk* volume_data, u8 iso_threshold, s32 lod, mesh_algorithm algorithm,
+                              const chunklods* lods);
+// One mesh per chunk of vol (z, y, x order), positions chunk-local with the origin at the chunk's
+// position in vol; lods is null or one per chunk. Each chunk also meshes the cells it shares with
+// its +z/+y/+x neighbours, reading them in place, so adjacent meshes meet with identical vertices;
+// nothing on a chunk's - sides is read
+void generate_chunk_meshes(const volume* vol, u8 iso_threshold, s32 lod, mesh_algorithm algorithm,
+                           const chunklods* lods, mesh* meshes);
+// Like generate_chunk_meshes, but only the chunks in [lo, hi) (z, y, x chunk coordinates of vol) are
+// meshed, in z, y, x order; the chunks of vol around the region only supply the halo. One sweep
+// extracts a surface for each of the num_isos isovalues: meshes[i * num_isos + k] is chunk i at isos[k].
+// A streaming caller pins the region plus one chunk past its + faces and meshes arrays far larger than memory
+void generate_chunk_meshes_region(const volume* vol, const s32 lo[3], const s32 hi[3], const u8* isos, int num_isos,
+                                  s32 lod, mesh_algorithm algorithm, const chunklods* lods, mesh* meshes);
+// The same for any set of chunks: selected holds count slots of vol, (z * vol->y + y) * vol->x + x,
+// and meshes[i * num_isos + k] is the mesh of selected[i] at isos[k]; each mesh matches what
+// generate_chunk_meshes gives it at that isovalue
+void generate_selected_chunk_meshes(const volume* vol, const s32* selected, int count, const u8* isos, int num_isos,
+                                    s32 lod, mesh_algorithm algorithm, const chunklods* lods, mesh* meshes);
+// All chunks merged into one mesh in volume coordinates, requantized coarser if the volume is
+// too large for MESH_POS_FRAC fractional bits
+mesh generate_mesh_from_volume(const volume* vol, u8 iso_threshold, s32 lod, mesh_algorithm algorithm,
+                               const chunklods* lods);
+// Widen [*value_min, *value_max] by the value range of m, so several meshes share one colormap scale
+void mesh_value_range(const mesh* m, u8* value_min, u8* value_max);
+// Recompute pos_min and pos_max from the vertices
+void mesh_bounds(mesh* m);
+// The bounding box in voxels, x,y,z
+static inline void mesh_box(const mesh* m, f32 lo[3], f32 hi[3]) {
+    for (s32 i = 0; i < 3; i++) {
+        lo[i] = m->origin[i] + m->pos_min[i] * m->scale;
+        hi[i] = m->origin[i] + m->pos_max[i] * m->scale;
+    }
+}
 void mesh_free(mesh* m);
 
+// mesh simplification
+constexpr s32 MESH_DETAIL_LEVELS = 4;  // a chunk mesh and three simplified copies
+
+// Progressively simplified copies of one mesh; levels[0] is the mesh itself
+typedef struct meshlods {
+    mesh levels[MESH_DETAIL_LEVELS];
+    f32 error[MESH_DETAIL_LEVELS];  // how far each level may stray from levels[0], in voxels
+} meshlods;
+
+// Quadric-error edge collapse down to target_triangles (0 = no target), never moving the surface
+// by more than max_error voxels; *error (may be null) receives the largest error accepted.
+// Vertices on open edges stay put, so simplified chunk meshes still meet their neighbours
+mesh mesh_simplify(const mesh* m, s32 target_triangles, f32 max_error, f32* error);
+// Takes m as levels[0]; cell is the voxel spacing m was extracted at, which scales the error bounds
+void meshlods_build(meshlods* lods, mesh m, f32 cell);
+void meshlods_free(meshlods* lods);
+
+// culling
+// Inward planes (a, b, c, d) of the view frustum of a column-major, GL-style clip-from-model matrix
+typedef struct frustum {
+    f32 planes[6][4];
+} frustum;
+
+void frustum_from_matrix(frustum* f, const f32 m[16]);
+// false when the box (lo, hi corners, in the matrix's model space) lies entirely outside
+bool frustum_test_box(const frustum* f, const f32 lo[3], const f32 hi[3]);
+
+// mesh cache
+constexpr u32 MESH_ENGINE_VERSION = 2;  // bump whenever the extraction output changes, orphaning cached meshes
+
+// A chunk mesh depends on the chunk, the extraction settings and which of its + side
+// neighbours were loaded to read its seam cells and gradients
+typedef struct meshkey {
+    u64 array;                 // meshkey_array of the zarr array
+    s32 chunk[3];              // z, y, x chunk coordinates in the array
+    s32 lod;
+    u8 iso;
+    mesh_algorithm algorithm;
+    u32 halo;                  // bit (dz + 1) * 9 + (dy + 1) * 3 + dx + 1 per + side neighbour present, d in {0, 1}
+} meshkey;
+
+// Identity of an array: its resolved path and .zarray metadata. Arrays are assumed not to be
+// rewritten in place; a changed array needs a new path or an emptied cache
+u64 meshkey_array(const char* path);
+// $VCR_MESH_CACHE, else $XDG_CACHE_HOME/vcr/meshes or ~/.cache/vcr/meshes; false when caching is off
+bool meshcache_default_dir(char* out, size_t size);
+// Cached meshes come back with origin zero; empty meshes are cached too
+bool meshcache_load(const char* dir, const meshkey* key, mesh* out);
+err meshcache_store(const char* dir, const meshkey* key, const mesh* m);
+
+// gpu meshes
+// A mesh in immutable GPU buffers, uploaded once and drawn without touching its vertices again
+typedef struct gpumesh gpumesh;
+// null for an empty mesh; needs sg_setup, any backend including SOKOL_DUMMY_BACKEND
+gpumesh* gpumesh_upload(const mesh* m);
+void gpumesh_free(gpumesh* g);
+
+// Pipeline drawing gpumeshes lit and colormapped in its shaders, into an RGBA8 + DEPTH target
+// with one sample. null when there is no shader for the backend (Metal, GL core and dummy have one)
+typedef struct meshrenderer meshrenderer;
+meshrenderer* meshrenderer_new(void);
+void meshrenderer_free(meshrenderer* r);
+// Vertex value -> colour; only re-uploaded when it differs from the current table. true when uploaded
+bool meshrenderer_colormap(meshrenderer* r, const u8 rgb[256][3]);
+// Inside a pass: applies the pipeline for the draws that follow. offset (x, y, z voxels) is
+// subtracted from mesh origins before mvp; light_dir is the direction the light travels
+void meshrenderer_begin(meshrenderer* r, const f32 mvp[16], const f32 offset[3], const f32 light_dir[3]);
+// Returns the triangles drawn
+s32 meshrenderer_draw(meshrenderer* r, const gpumesh* g);
+
+// mesh registry
+// The surfaces of one chunk, one per isovalue, and the keys they were extracted under
+typedef struct meshentry {
+    s32 chunk[3];                      // z, y, x chunk coordinates, identifies the entry
+    s32 num_surfaces;
+    meshkey keys[MESH_MAX_ISOS];
+    meshlods lods[MESH_MAX_ISOS];      // empty where the chunk has no surface
+    gpumesh* gpu[MESH_MAX_ISOS][MESH_DETAIL_LEVELS];  // uploaded copies of the levels, null until first drawn
+} meshentry;
+
+// Frees the entry's meshes and their GPU copies, leaving it with no surfaces
+void meshentry_clear(meshentry* e);
+
+// Chunk meshes by chunk coordinate, so a moving window only meshes and frees the chunks that change
+typedef struct meshregistry meshregistry;
+meshregistry* meshregistry_new(void);
+void meshregistry_free(meshregistry* r);
+// null when the chunk has no entry
+meshentry* meshregistry_find(meshregistry* r, s32 cz, s32 cy, s32 cx);
+// The chunk's entry, added with no meshes if missing
+meshentry* meshregistry_insert(meshregistry* r, s32 cz, s32 cy, s32 cx);
+// Frees the chunk's meshes and drops its entry
+void meshregistry_remove(meshregistry* r, s32 cz, s32 cy, s32 cx);
+s32 meshregistry_count(const meshregistry* r);
+// All entries, packed, in no particular order; valid until the next insert or remove
+meshentry* meshregistry_entries(meshregistry* r);
+
 // color types
 typedef struct rgb {
     u8 r, g, b;
 } rgb;
 
 // colormap
-rgb apply_viridis_colormap(u8 value);
\ No newline at end of file
+rgb apply_viridis_colormap(u8 value);
+
+// volume rendering
+constexpr s32 RAY_BRICK = 8;   // voxels per side of an empty-space skipping brick
+constexpr s32 RAY_TILE = 16;   // pixels per side of a raycasting work item
+
+// Colour and opacity per voxel value; opacity is per voxel of distance travelled
+typedef struct transferfn {
+    f32 rgba[256][4];
+} transferfn;
+
+// Viridis over [lo, hi], opacity rising linearly from 0 at lo to max_opacity at hi;
+// values at or below lo are fully transparent
+void transferfn_ramp(transferfn* tf, u8 lo, u8 hi, f32 max_opacity);
+
+// (min, max) of every RAY_BRICK^3 block of a volume, x fastest. Each range also covers
+// the voxel one past the block on every + side, in the next chunk if need be, so it
+// bounds every trilinear sample taken inside the block
+typedef struct raybricks {
+    s32 dims[3];   // bricks along z, y, x
+    u8* range;
+} raybricks;
+
+void raybricks_build(raybricks* rb, const volume* vol);
+void raybricks_free(raybricks* rb);
+
+// Pinhole camera in x, y, z voxel coordinates, the space of the chunk meshes
+typedef struct raycamera {
+    f32 eye[3];
+    f32 right[3], up[3], forward[3];   // orthonormal
+    f32 tan_half_fov;                  // vertical
+} raycamera;
+
+// From a column-major, rigid view matrix such as the 3D view's
+void raycamera_from_view(raycamera* cam, const f32 view[16], f32 fovy);
+void raycamera_lookat(raycamera* cam, const f32 eye[3], const f32 center[3], const f32 up[3], f32 fovy);
+
+typedef struct raycast_stats {
+    s64 samples;           // trilinear samples taken
+    s64 skipped_bricks;    // empty bricks stepped over
+    s64 terminated_rays;   // rays stopped early once opaque
+} raycast_stats;
+
+// Render vol (rb built from it) into rgba, h x w RGBA rows top-down, sampling every step voxels
+// and compositing over background; stats may be null
+void raycast_render(const volume* vol, const raybricks* rb, const transferfn* tf, const raycamera* cam, f32 step,
+                    const u8 background[3], s32 h, s32 w, u8* rgba, raycast_stats* stats);
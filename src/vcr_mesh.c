@@ -0,0 +1,507 @@
+#include "vcr.h"
+
+// vcr-mesh: headless out-of-core isosurface extraction.
+// Streams a whole zarr array through the chunk cache in tiles of chunks. Each
+// tile is pinned together with the chunks past its + faces that supply the halo, meshed
+// in parallel, then written out in chunk order before the next tile is read, so
+// the working set is the cache budget plus one pinned window whatever the size
+// of the array. Adjacent chunk meshes repeat the vertices of the cells they
+// share; those are welded by global position through a table that only holds
+// seam vertices and forgets them once every chunk that can reach them is done.
+
+typedef enum out_format {
+    FORMAT_PLY,
+    FORMAT_OBJ
+} out_format;
+
+typedef struct mesh_args {
+    const char* array;
+    const char* output;
+    u8 isos[MESH_MAX_ISOS];
+    s32 num_isos;
+    s32 lod;
+    mesh_algorithm algorithm;
+    out_format format;
+    s32 cache_mib;
+    s32 tile[3];           // chunks per tile, z, y, x
+} mesh_args;
+
+// Seam vertex table: open addressing on global quantized positions (x, y, z)
+typedef struct weld_entry {
+    u32 pos[3];
+    u32 index;             // output vertex index, UINT32_MAX when the slot is empty
+} weld_entry;
+
+typedef struct weld_map {
+    weld_entry* slots;
+    size_t capacity;       // power of two
+    size_t used;
+} weld_map;
+
+typedef struct mesh_writer {
+    const mesh_args* args;
+    char path[1100];
+    FILE* out;
+    FILE* faces;           // PLY only: faces are spooled here and appended once the vertices are done
+    FILE* offsets;
+    char faces_path[1200];
+    u64 num_vertices;
+    u64 num_faces;
+    weld_map welds;
+    u32* remap;            // chunk vertex -> output vertex
+    u8* buffer;
+    size_t buffer_size;
+} mesh_writer;
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: vcr-mesh <array> <output> [options]\n"
+            "  <array>                  zarr array, or a multiscale group (level 0/ is meshed)\n"
+            "  <output>                 mesh file; <output>.chunks lists each chunk's vertex and face ranges\n"
+            "  --iso V[,V...]           isovalues, up to %d, extracted in one pass (default 128); with\n"
+            "                           several, each surface goes to <output> with -iso<V> before\n"
+            "                           its extension\n"
+            "  --lod N                  mesh every 2^N voxels, 0..3 (default 0)\n"
+            "  --algorithm mc|nets      marching cubes or surface nets (default mc)\n"
+            "  --format ply|obj         binary little-endian PLY or text OBJ (default ply)\n"
+            "  --tile ZxYxX             chunks meshed per step (default 2x8x8); the tile and a\n"
+            "                           chunks past its + faces stay pinned while it is meshed\n"
+            "  --cache MiB              chunk cache budget (default 4096); a budget that holds one\n"
+            "                           row of tiles along x reads every chunk about once\n"
+            "threads: VCR_THREADS (default: all cores)\n",
+            MESH_MAX_ISOS);
+}
+
+static bool parse_args(int argc, char** argv, mesh_args* a) {
+    *a = (mesh_args){
+        .isos = {128}, .num_isos = 1, .algorithm = MESH_MARCHING_CUBES, .format = FORMAT_PLY, .cache_mib = 4096,
+        .tile = {2, 8, 8},
+    };
+    if (argc < 3) return false;
+    a->array = argv[1];
+    a->output = argv[2];
+
+    for (int i = 3; i < argc; i++) {
+        const char* opt = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!val) {
+            fprintf(stderr, "missing value for %s\n", opt);
+            return false;
+        }
+        i++;
+        if (strcmp(opt, "--iso") == 0) {
+            a->num_isos = 0;
+            for (const char* p = val; *p; p++) {
+                char* end;
+                long iso = strtol(p, &end, 10);
+                if (end == p || iso < 0 || iso > 255 || a->num_isos == MESH_MAX_ISOS) return false;
+                a->isos[a->num_isos++] = (u8)iso;
+                p = end;
+                if (*p != ',') break;
+            }
+            if (a->num_isos == 0) return false;
+        } else if (strcmp(opt, "--lod") == 0) {
+            a->lod = atoi(val);
+            if (a->lod < 0 || a->lod > MESH_MAX_LOD) return false;
+        } else if (strcmp(opt, "--algorithm") == 0) {
+            if (strcmp(val, "mc") == 0) a->algorithm = MESH_MARCHING_CUBES;
+            else if (strcmp(val, "nets") == 0) a->algorithm = MESH_SURFACE_NETS;
+            else return false;
+        } else if (strcmp(opt, "--format") == 0) {
+            if (strcmp(val, "ply") == 0) a->format = FORMAT_PLY;
+            else if (strcmp(val, "obj") == 0) a->format = FORMAT_OBJ;
+            else return false;
+        } else if (strcmp(opt, "--tile") == 0) {
+            if (sscanf(val, "%dx%dx%d", &a->tile[0], &a->tile[1], &a->tile[2]) != 3 ||
+                a->tile[0] < 1 || a->tile[1] < 1 || a->tile[2] < 1) {
+                return false;
+            }
+        } else if (strcmp(opt, "--cache") == 0) {
+            a->cache_mib = atoi(val);
+        } else {
+            fprintf(stderr, "unknown option %s\n", opt);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Welding
+
+static u64 weld_hash(const u32 pos[3]) {
+    u64 h = pos[0] * 0x9e3779b97f4a7c15ull;
+    h ^= pos[1] * 0xc2b2ae3d27d4eb4full;
+    h ^= pos[2] * 0x165667b19e3779f9ull;
+    return h ^ (h >> 29);
+}
+
+static void weld_init(weld_map* w, size_t capacity) {
+    w->capacity = capacity;
+    w->used = 0;
+    w->slots = malloc(capacity * sizeof(weld_entry));
+    for (size_t i = 0; i < capacity; i++) {
+        w->slots[i].index = UINT32_MAX;
+    }
+}
+
+static void weld_insert(weld_map* w, const u32 pos[3], u32 index) {
+    size_t i = weld_hash(pos) & (w->capacity - 1);
+    while (w->slots[i].index != UINT32_MAX) {
+        i = (i + 1) & (w->capacity - 1);
+    }
+    w->slots[i] = (weld_entry){{pos[0], pos[1], pos[2]}, index};
+    w->used++;
+}
+
+// Rebuilds the table with the entries whose z is at least min_z, at a
+// capacity that leaves room for about as many again
+static void weld_rebuild(weld_map* w, u32 min_z) {
+    weld_map old = *w;
+    size_t keep = 0;
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.slots[i].index != UINT32_MAX && old.slots[i].pos[2] >= min_z) keep++;
+    }
+    size_t capacity = 1 << 16;
+    while (capacity < 4 * keep) capacity *= 2;
+    weld_init(w, capacity);
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.slots[i].index != UINT32_MAX && old.slots[i].pos[2] >= min_z) {
+            weld_insert(w, old.slots[i].pos, old.slots[i].index);
+        }
+    }
+    free(old.slots);
+}
+
+// The index already given to a vertex at pos, or index after recording it
+static u32 weld_find_or_insert(weld_map* w, const u32 pos[3], u32 index) {
+    if (2 * (w->used + 1) > w->capacity) {
+        weld_rebuild(w, 0);
+    }
+    size_t i = weld_hash(pos) & (w->capacity - 1);
+    while (w->slots[i].index != UINT32_MAX) {
+        const weld_entry* e = &w->slots[i];
+        if (e->pos[0] == pos[0] && e->pos[1] == pos[1] && e->pos[2] == pos[2]) return e->index;
+        i = (i + 1) & (w->capacity - 1);
+    }
+    w->slots[i] = (weld_entry){{pos[0], pos[1], pos[2]}, index};
+    w->used++;
+    return index;
+}
+
+// Output
+
+static const char* ply_header_format =
+    "ply\n"
+    "format binary_little_endian 1.0\n"
+    "comment vcr-mesh, positions in level-0 voxels (x, y, z)\n"
+    "element vertex %-10llu\n"
+    "property float x\n"
+    "property float y\n"
+    "property float z\n"
+    "property float nx\n"
+    "property float ny\n"
+    "property float nz\n"
+    "property uchar value\n"
+    "element face %-10llu\n"
+    "property list uchar uint vertex_indices\n"
+    "end_header\n";
+
+constexpr s32 PLY_VERTEX_BYTES = 6 * sizeof(f32) + 1;
+constexpr s32 PLY_FACE_BYTES = 1 + 3 * sizeof(u32);
+
+// The PLY header is written with space-padded counts up front and rewritten
+// in place at the end, so the vertices stream straight into the output
+static void write_ply_header(FILE* fp, u64 num_vertices, u64 num_faces) {
+    fprintf(fp, ply_header_format, (unsigned long long)num_vertices, (unsigned long long)num_faces);
+}
+
+// Output path of the surface at iso: the output itself when there is only
+// one, otherwise the output with -iso<V> before its extension
+static void surface_path(char* out, size_t size, const mesh_args* args, u8 iso) {
+    if (args->num_isos == 1) {
+        snprintf(out, size, "%s", args->output);
+        return;
+    }
+    const char* slash = strrchr(args->output, '/');
+    const char* dot = strrchr(args->output, '.');
+    int stem = dot && (!slash || dot > slash) ? (int)(dot - args->output) : (int)strlen(args->output);
+    snprintf(out, size, "%.*s-iso%d%s", stem, args->output, iso, args->output + stem);
+}
+
+static bool writer_open(mesh_writer* w, const mesh_args* args, u8 iso) {
+    *w = (mesh_writer){.args = args};
+    surface_path(w->path, sizeof(w->path), args, iso);
+    w->out = fopen(w->path, "wb");
+    if (!w->out) {
+        LOG_ERROR("failed to open %s for writing\n", w->path);
+        return false;
+    }
+    char path[1200];
+    snprintf(path, sizeof(path), "%s.chunks", w->path);
+    w->offsets = fopen(path, "w");
+    if (!w->offsets) {
+        LOG_ERROR("failed to open %s for writing\n", path);
+        return false;
+    }
+    fprintf(w->offsets, "# cz cy cx first_vertex num_vertices first_face num_faces\n"
+                        "# faces may reference vertices written by earlier chunks across a shared seam\n");
+    if (args->format == FORMAT_PLY) {
+        write_ply_header(w->out, 0, 0);
+        snprintf(w->faces_path, sizeof(w->faces_path), "%s.faces.tmp", w->path);
+        w->faces = fopen(w->faces_path, "w+b");
+        if (!w->faces) {
+            LOG_ERROR("failed to open %s for writing\n", w->faces_path);
+            return false;
+        }
+    } else {
+        fprintf(w->out, "# vcr-mesh, positions in level-0 voxels (x, y, z)\n");
+    }
+    weld_init(&w->welds, 1 << 16);
+    return true;
+}
+
+static u8* writer_buffer(mesh_writer* w, size_t size) {
+    if (size > w->buffer_size) {
+        free(w->buffer);
+        w->buffer = malloc(size);
+        w->buffer_size = size;
+    }
+    return w->buffer;
+}
+
+// Appends one chunk mesh. origin is the chunk's position in level-0 voxels,
+// x, y, z. Vertices in the chunk's first or last layer of cells on any axis
+// may also come out of a neighbouring chunk, so those are looked up and
+// recorded by position; the rest are unique to this chunk.
+static bool writer_add(mesh_writer* w, const mesh* m, const s32 chunk_pos[3], const s32 origin[3]) {
+    if (m->num_triangles == 0) return true;
+    const u32 far = CHUNK_LEN << MESH_POS_FRAC;
+    const u32 near = w->args->algorithm == MESH_SURFACE_NETS ? (u32)(1 << w->args->lod) << MESH_POS_FRAC : 0;
+
+    u64 first_vertex = w->num_vertices, first_face = w->num_faces;
+    w->remap = realloc(w->remap, (size_t)m->num_vertices * sizeof(u32));
+    u8* dst = writer_buffer(w, (size_t)m->num_vertices * PLY_VERTEX_BYTES);
+    size_t bytes = 0;
+    for (int v = 0; v < m->num_vertices; v++) {
+        const mesh_vertex* mv = &m->vertices[v];
+        if (w->num_vertices >= UINT32_MAX) {
+            LOG_ERROR("more than %u vertices, the output indices would overflow\n", UINT32_MAX - 1);
+            return false;
+        }
+        u32 pos[3];
+        bool seam = false;
+        for (s32 k = 0; k < 3; k++) {
+            pos[k] = ((u32)origin[k] << MESH_POS_FRAC) + mv->pos[k];
+            seam |= mv->pos[k] <= near || mv->pos[k] >= far;
+        }
+        u32 index = (u32)w->num_vertices;
+        if (seam) {
+            index = weld_find_or_insert(&w->welds, pos, index);
+        }
+        w->remap[v] = index;
+        if (index != w->num_vertices) continue;
+        w->num_vertices++;
+
+        f32 p[3], n[3];
+        for (s32 k = 0; k < 3; k++) {
+            p[k] = pos[k] * (1.0f / (1 << MESH_POS_FRAC));
+        }
+        mesh_vertex_normal(mv, n);
+        if (w->args->format == FORMAT_PLY) {
+            memcpy(dst + bytes, p, sizeof(p));
+            memcpy(dst + bytes + sizeof(p), n, sizeof(n));
+            dst[bytes + sizeof(p) + sizeof(n)] = mv->value;
+            bytes += PLY_VERTEX_BYTES;
+        } else {
+            fprintf(w->out, "v %.4f %.4f %.4f\nvn %.3f %.3f %.3f\n", p[0], p[1], p[2], n[0], n[1], n[2]);
+        }
+    }
+    if (bytes) fwrite(dst, 1, bytes, w->out);
+
+    // Welding can collapse a triangle whose corners sat at one position in different chunks
+    dst = writer_buffer(w, (size_t)m->num_triangles * PLY_FACE_BYTES);
+    bytes = 0;
+    for (int t = 0; t < m->num_triangles; t++) {
+        u32 a = w->remap[m->indices[t * 3]];
+        u32 b = w->remap[m->indices[t * 3 + 1]];
+        u32 c = w->remap[m->indices[t * 3 + 2]];
+        if (a == b || b == c || a == c) continue;
+        w->num_faces++;
+        if (w->args->format == FORMAT_PLY) {
+            u32 face[3] = {a, b, c};
+            dst[bytes] = 3;
+            memcpy(dst + bytes + 1, face, sizeof(face));
+            bytes += PLY_FACE_BYTES;
+        } else {
+            fprintf(w->out, "f %u//%u %u//%u %u//%u\n", a + 1, a + 1, b + 1, b + 1, c + 1, c + 1);
+        }
+    }
+    if (bytes) fwrite(dst, 1, bytes, w->faces);
+
+    fprintf(w->offsets, "%d %d %d %llu %llu %llu %llu\n", chunk_pos[0], chunk_pos[1], chunk_pos[2],
+            (unsigned long long)first_vertex, (unsigned long long)(w->num_vertices - first_vertex),
+            (unsigned long long)first_face, (unsigned long long)(w->num_faces - first_face));
+    return !ferror(w->out) && (!w->faces || !ferror(w->faces));
+}
+
+static bool writer_close(mesh_writer* w) {
+    bool ok = w->out && w->offsets;
+    if (w->faces) {
+        // Append the spooled faces and fill in the counts
+        rewind(w->faces);
+        u8* buf = writer_buffer(w, 1 << 20);
+        size_t n;
+        while ((n = fread(buf, 1, 1 << 20, w->faces)) > 0) {
+            ok &= fwrite(buf, 1, n, w->out) == n;
+        }
+        ok &= !ferror(w->faces);
+        fclose(w->faces);
+        remove(w->faces_path);
+        rewind(w->out);
+        write_ply_header(w->out, w->num_vertices, w->num_faces);
+    }
+    if (w->out) {
+        ok &= !ferror(w->out);
+        ok &= fclose(w->out) == 0;
+    }
+    if (w->offsets) {
+        ok &= fclose(w->offsets) == 0;
+    }
+    free(w->welds.slots);
+    free(w->remap);
+    free(w->buffer);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    mesh_args args;
+    if (!parse_args(argc, argv, &args)) {
+        usage();
+        return 1;
+    }
+
+    char path[1024];
+    zarrinfo info;
+    if (!zarr_open_array(args.array, 0, path, sizeof(path), &info, nullptr)) {
+        return 1;
+    }
+    chunkcache* cache = chunkcache_new(path, info, (size_t)args.cache_mib * 1024 * 1024);
+    if (!cache) {
+        return 1;
+    }
+    s32 grid[3];
+    chunkcache_grid(cache, grid);
+    s32 tiles[3];
+    for (s32 a = 0; a < 3; a++) {
+        tiles[a] = (grid[a] + args.tile[a] - 1) / args.tile[a];
+    }
+    s32 num_chunks = grid[0] * grid[1] * grid[2];
+
+    // One writer per surface, each with its own welds and chunk ranges
+    s32 num_isos = args.num_isos;
+    mesh_writer writers[MESH_MAX_ISOS];
+    bool ok = true;
+    for (s32 k = 0; k < num_isos; k++) {
+        ok = writer_open(&writers[k], &args, args.isos[k]) && ok;
+    }
+    if (!ok) {
+        for (s32 k = 0; k < num_isos; k++) {
+            writer_close(&writers[k]);
+        }
+        chunkcache_free(cache);
+        return 1;
+    }
+
+    char iso_list[8 * MESH_MAX_ISOS] = "";
+    for (s32 k = 0; k < num_isos; k++) {
+        snprintf(iso_list + strlen(iso_list), sizeof(iso_list) - strlen(iso_list), "%s%d", k ? "," : "",
+                 args.isos[k]);
+    }
+    printf("vcr-mesh: %dx%dx%d chunks of %s, iso %s, lod %d, %s, %d threads\n", grid[0], grid[1], grid[2], path,
+           iso_list, args.lod, args.algorithm == MESH_SURFACE_NETS ? "surface nets" : "marching cubes",
+           parallel_thread_count());
+
+    f64 start = now_seconds();
+    s32 done = 0;
+    mesh* meshes = malloc((size_t)args.tile[0] * args.tile[1] * args.tile[2] * num_isos * sizeof(mesh));
+    for (s32 tz = 0; tz < tiles[0] && ok; tz++) {
+        // Nothing below this row of tiles can touch a seam vertex under its first plane
+        s32 z0 = tz * args.tile[0];
+        for (s32 k = 0; k < num_isos; k++) {
+            weld_rebuild(&writers[k].welds, (u32)(z0 * CHUNK_LEN) << MESH_POS_FRAC);
+        }
+
+        for (s32 ty = 0; ty < tiles[1] && ok; ty++) {
+            for (s32 tx = 0; tx < tiles[2] && ok; tx++) {
+                s32 t[3] = {tz, ty, tx};
+                s32 lo[3], hi[3], win_lo[3], win_hi[3];
+                for (s32 a = 0; a < 3; a++) {
+                    lo[a] = t[a] * args.tile[a];
+                    hi[a] = lo[a] + args.tile[a] < grid[a] ? lo[a] + args.tile[a] : grid[a];
+                    win_lo[a] = lo[a];
+                    win_hi[a] = hi[a] < grid[a] ? hi[a] + 1 : grid[a];
+                }
+
+                // Pin the tile and its + side halo
+                volume win = {win_hi[0] - win_lo[0], win_hi[1] - win_lo[1], win_hi[2] - win_lo[2], nullptr, nullptr};
+                chunkcache_acquire_box(cache, win_lo, &win);
+
+                s32 region_lo[3], region_hi[3];
+                for (s32 a = 0; a < 3; a++) {
+                    region_lo[a] = lo[a] - win_lo[a];
+                    region_hi[a] = hi[a] - win_lo[a];
+                }
+                generate_chunk_meshes_region(&win, region_lo, region_hi, args.isos, num_isos, args.lod,
+                                             args.algorithm, nullptr, meshes);
+
+                chunkcache_release_box(cache, win_lo, &win);
+
+                s32 count = (hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+                for (s32 j = 0; j < count * num_isos; j++) {
+                    // Window-relative origins, x, y, z, to array chunk and voxel coordinates
+                    s32 origin[3] = {
+                        meshes[j].origin[0] + win_lo[2] * CHUNK_LEN,
+                        meshes[j].origin[1] + win_lo[1] * CHUNK_LEN,
+                        meshes[j].origin[2] + win_lo[0] * CHUNK_LEN,
+                    };
+                    s32 chunk_pos[3] = {origin[2] / CHUNK_LEN, origin[1] / CHUNK_LEN, origin[0] / CHUNK_LEN};
+                    ok = ok && writer_add(&writers[j % num_isos], &meshes[j], chunk_pos, origin);
+                    mesh_free(&meshes[j]);
+                }
+                done += count;
+
+                u64 total_vertices = 0, total_faces = 0;
+                for (s32 k = 0; k < num_isos; k++) {
+                    total_vertices += writers[k].num_vertices;
+                    total_faces += writers[k].num_faces;
+                }
+                f64 elapsed = now_seconds() - start;
+                printf("\r%d / %d chunks, %.1f chunks/s, %llu vertices, %llu faces", done, num_chunks,
+                       done / elapsed, (unsigned long long)total_vertices, (unsigned long long)total_faces);
+                fflush(stdout);
+            }
+        }
+    }
+    free(meshes);
+    printf("\n");
+    for (s32 k = 0; k < num_isos; k++) {
+        u64 num_vertices = writers[k].num_vertices, num_faces = writers[k].num_faces;
+        bool written = writer_close(&writers[k]);
+        if (!written) {
+            LOG_ERROR("failed to write %s\n", writers[k].path);
+        } else {
+            printf("iso %d: %llu vertices, %llu faces in %s\n", args.isos[k], (unsigned long long)num_vertices,
+                   (unsigned long long)num_faces, writers[k].path);
+        }
+        ok = written && ok;
+    }
+    f64 elapsed = now_seconds() - start;
+
+    u64 hits, misses;
+    chunkcache_stats(cache, &hits, &misses);
+    printf("%d chunks in %.2f s: %.1f chunks/s; chunk cache %llu hits, %llu misses\n", num_chunks, elapsed,
+           num_chunks / elapsed, (unsigned long long)hits, (unsigned long long)misses);
+
+    chunkcache_free(cache);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include "vcr.h"
+
+// vcr-render: headless direct volume rendering.
+// Pins a box of chunks from a zarr array in the chunk cache and raycasts it to
+// an RGB PNG from an orbit camera around the box's centre. The whole box has to
+// fit in the cache budget at once, since every ray may cross any of its chunks.
+
+constexpr f32 RADIANS = 0.017453292f;  // per degree
+
+typedef struct render_args {
+    const char* array;
+    const char* output;
+    s32 region[3];         // first chunk, z, y, x
+    s32 region_len[3];     // chunks, 0 = up to the end of the array
+    s32 h, w;
+    f32 yaw, pitch;        // degrees; yaw 0 looks down -z, pitch 0 is level
+    f32 distance;          // voxels from the box centre, 0 = fit the box
+    u8 tf_lo, tf_hi;
+    f32 opacity;
+    f32 step;
+    s32 cache_mib;
+} render_args;
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: vcr-render <array> <out.png> [options]\n"
+            "  <array>                  zarr array, or a multiscale group (level 0/ is rendered)\n"
+            "  --region Z,Y,X:DZ,DY,DX  box of chunks to render, first chunk and chunk counts\n"
+            "                           (default: the whole array)\n"
+            "  --size HxW               image size in pixels (default 1024x1024)\n"
+            "  --yaw D --pitch D        orbit angles in degrees (default 30, 20)\n"
+            "  --distance V             eye distance from the box centre in voxels (default: fit)\n"
+            "  --tf LO:HI:A             transfer function: transparent up to LO, viridis and\n"
+            "                           opacity rising to A per voxel at HI (default 96:255:0.05)\n"
+            "  --step V                 sample spacing in voxels (default 1)\n"
+            "  --cache MiB              chunk cache budget (default 4096); must hold the region\n"
+            "threads: VCR_THREADS (default: all cores)\n");
+}
+
+static bool parse_triple(const char* s, s32 out[3], char** end) {
+    for (s32 i = 0; i < 3; i++) {
+        char* e;
+        out[i] = (s32)strtol(s, &e, 10);
+        if (e == s) return false;
+        s = e;
+        if (i < 2) {
+            if (*s != ',') return false;
+            s++;
+        }
+    }
+    *end = (char*)s;
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, render_args* a) {
+    *a = (render_args){
+        .h = 1024, .w = 1024, .yaw = 30.0f, .pitch = 20.0f, .tf_lo = 96, .tf_hi = 255, .opacity = 0.05f,
+        .step = 1.0f, .cache_mib = 4096,
+    };
+    if (argc < 3) return false;
+    a->array = argv[1];
+    a->output = argv[2];
+
+    for (int i = 3; i < argc; i++) {
+        const char* opt = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!val) {
+            fprintf(stderr, "missing value for %s\n", opt);
+            return false;
+        }
+        i++;
+        if (strcmp(opt, "--region") == 0) {
+            char* end;
+            if (!parse_triple(val, a->region, &end) || *end != ':' || !parse_triple(end + 1, a->region_len, &end) ||
+                *end) {
+                return false;
+            }
+            for (s32 k = 0; k < 3; k++) {
+                if (a->region[k] < 0 || a->region_len[k] < 1) return false;
+            }
+        } else if (strcmp(opt, "--size") == 0) {
+            if (sscanf(val, "%dx%d", &a->h, &a->w) != 2 || a->h < 1 || a->w < 1) return false;
+        } else if (strcmp(opt, "--yaw") == 0) {
+            a->yaw = strtof(val, nullptr);
+        } else if (strcmp(opt, "--pitch") == 0) {
+            a->pitch = strtof(val, nullptr);
+        } else if (strcmp(opt, "--distance") == 0) {
+            a->distance = strtof(val, nullptr);
+        } else if (strcmp(opt, "--tf") == 0) {
+            s32 lo, hi;
+            if (sscanf(val, "%d:%d:%f", &lo, &hi, &a->opacity) != 3 || lo < 0 || lo > 255 || hi < lo || hi > 255 ||
+                a->opacity < 0.0f) {
+                return false;
+            }
+            a->tf_lo = (u8)lo;
+            a->tf_hi = (u8)hi;
+        } else if (strcmp(opt, "--step") == 0) {
+            a->step = strtof(val, nullptr);
+            if (!(a->step > 0.0f)) return false;
+        } else if (strcmp(opt, "--cache") == 0) {
+            a->cache_mib = atoi(val);
+        } else {
+            fprintf(stderr, "unknown option %s\n", opt);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    render_args args;
+    if (!parse_args(argc, argv, &args)) {
+        usage();
+        return 1;
+    }
+
+    char path[1024];
+    zarrinfo info;
+    if (!zarr_open_array(args.array, 0, path, sizeof(path), &info, nullptr)) {
+        return 1;
+    }
+    chunkcache* cache = chunkcache_new(path, info, (size_t)args.cache_mib * 1024 * 1024);
+    if (!cache) {
+        return 1;
+    }
+    s32 grid[3];
+    chunkcache_grid(cache, grid);
+    s32 lo[3], len[3];
+    for (s32 a = 0; a < 3; a++) {
+        lo[a] = args.region[a];
+        len[a] = args.region_len[a] ? args.region_len[a] : grid[a] - lo[a];
+        if (lo[a] + len[a] > grid[a]) len[a] = grid[a] - lo[a];
+        if (len[a] < 1) {
+            LOG_ERROR("region starts outside the %dx%dx%d chunk grid\n", grid[0], grid[1], grid[2]);
+            chunkcache_free(cache);
+            return 1;
+        }
+    }
+    s32 count = len[0] * len[1] * len[2];
+    if ((size_t)count * sizeof(chunk) > (size_t)args.cache_mib * 1024 * 1024) {
+        LOG_ERROR("region of %d chunks (%d MiB) does not fit the %d MiB cache budget\n", count,
+                  (s32)((size_t)count * sizeof(chunk) >> 20), args.cache_mib);
+        chunkcache_free(cache);
+        return 1;
+    }
+
+    printf("vcr-render: %dx%dx%d chunks at %d,%d,%d of %s, %dx%d, %d threads\n", len[0], len[1], len[2], lo[0],
+           lo[1], lo[2], path, args.w, args.h, parallel_thread_count());
+
+    f64 start = now_seconds();
+    volume box = {len[0], len[1], len[2], nullptr, nullptr};
+    chunkcache_acquire_box(cache, lo, &box);
+    raybricks rb;
+    raybricks_build(&rb, &box);
+    f64 loaded = now_seconds();
+
+    // Orbit camera around the box centre, x, y, z voxels
+    f32 center[3] = {len[2] * CHUNK_LEN / 2.0f, len[1] * CHUNK_LEN / 2.0f, len[0] * CHUNK_LEN / 2.0f};
+    f32 radius = sqrtf(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]);
+    f32 fovy = 45.0f * RADIANS;
+    f32 distance = args.distance > 0.0f ? args.distance : radius / sinf(fovy / 2.0f);
+    f32 pitch = fminf(fmaxf(args.pitch, -89.0f), 89.0f) * RADIANS;
+    f32 yaw = args.yaw * RADIANS;
+    f32 eye[3] = {
+        center[0] + distance * cosf(pitch) * sinf(yaw),
+        center[1] + distance * sinf(pitch),
+        center[2] + distance * cosf(pitch) * cosf(yaw),
+    };
+    const f32 up[3] = {0.0f, 1.0f, 0.0f};
+    raycamera cam;
+    raycamera_lookat(&cam, eye, center, up, fovy);
+
+    transferfn tf;
+    transferfn_ramp(&tf, args.tf_lo, args.tf_hi, args.opacity);
+    const u8 background[3] = {0, 0, 0};
+    u8* rgba = malloc((size_t)args.h * args.w * 4);
+    raycast_stats stats;
+    raycast_render(&box, &rb, &tf, &cam, args.step, background, args.h, args.w, rgba, &stats);
+    f64 rendered = now_seconds();
+
+    chunkcache_release_box(cache, lo, &box);
+    raybricks_free(&rb);
+
+    // Drop alpha, which is always opaque over the background
+    size_t pixels = (size_t)args.h * args.w;
+    for (size_t i = 0; i < pixels; i++) {
+        memmove(&rgba[i * 3], &rgba[i * 4], 3);
+    }
+    bool ok = write_png(args.output, rgba, args.h, args.w, 3) == OK;
+    free(rgba);
+
+    printf("load %.2f s, render %.3f s (%.1f Mray/s): %lld samples, %lld empty bricks skipped, %lld rays stopped early\n",
+           loaded - start, rendered - loaded, pixels / (rendered - loaded) / 1e6, (long long)stats.samples,
+           (long long)stats.skipped_bricks, (long long)stats.terminated_rays);
+    if (ok) {
+        printf("wrote %s\n", args.output);
+    } else {
+        LOG_ERROR("failed to write %s\n", args.output);
+    }
+
+    chunkcache_free(cache);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,368 @@
+#include "vcr.h"
+#include <stdatomic.h>
+
+// vcr-slice: headless batch slice renderer.
+// Renders a stack of axis-aligned or oblique planes from a zarr array to PNG or
+// raw u8 frames, without a window. Frames are processed in batches; inside a
+// batch the work items are (band of rows, frame) ordered band-major, so a
+// thread's contiguous share walks the same handful of chunks through
+// consecutive planes and the chunk cache decodes each chunk about once per
+// batch instead of once per frame.
+
+typedef enum out_format {
+    FORMAT_PNG,
+    FORMAT_RAW
+} out_format;
+
+typedef struct slice_args {
+    const char* array;
+    const char* outdir;
+    s32 axis;              // -1 for oblique
+    f32 center[3];         // oblique plane centre, z, y, x in level-0 voxels
+    f32 u[3], v[3];        // oblique in-plane column / row directions
+    s32 first, last, stride;
+    s32 lod;
+    s32 h, w;              // oblique frame size
+    u8 level;
+    u16 window;
+    interp mode;
+    out_format format;
+    s32 cache_mib;
+    s32 batch;
+} slice_args;
+
+typedef struct batch_job {
+    chunkcache* cache;
+    const slice_args* args;
+    const plane* planes;   // one per frame of the batch, in the coordinates of the opened level
+    u8** frames;
+    s32 num_frames;
+    s32 h, w;
+    s32 band_rows;
+    s32 num_bands;
+    const u8* lut;
+    s32 first_index;
+    s32 grid[3];
+    _Atomic s64 bytes_written;
+} batch_job;
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: vcr-slice <array> <outdir> [options]\n"
+            "  <array>                  zarr array, or a multiscale group with levels 0/, 1/, ...\n"
+            "  --axis z|y|x             stack of planes along an array axis (default z)\n"
+            "  --oblique C:U:V          plane centred at C with column direction U and row\n"
+            "                           direction V, each z,y,x; frames step along U x V\n"
+            "  --range A:B[:S]          planes A..B inclusive with stride S, in level-0 voxels\n"
+            "                           (default: the whole axis, or 0:0 for oblique)\n"
+            "  --size HxW               oblique frame size in pixels (default 1024x1024)\n"
+            "  --lod N                  sample every 2^N voxels; uses level N of a multiscale group\n"
+            "  --level L --window W     window/level (default 128 / 256, the identity)\n"
+            "  --trilinear              trilinear instead of nearest sampling\n"
+            "  --format png|raw         output format (default png)\n"
+            "  --cache MiB              chunk cache budget (default 2048)\n"
+            "  --batch N                frames per batch (default 4x threads)\n"
+            "threads: VCR_THREADS (default: all cores)\n");
+}
+
+static bool parse_vec3(const char* s, f32 out[3], char** end) {
+    for (s32 i = 0; i < 3; i++) {
+        char* e;
+        out[i] = strtof(s, &e);
+        if (e == s) return false;
+        s = e;
+        if (i < 2) {
+            if (*s != ',') return false;
+            s++;
+        }
+    }
+    *end = (char*)s;
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, slice_args* a) {
+    *a = (slice_args){
+        .axis = 0, .first = 0, .last = -1, .stride = 1, .h = 1024, .w = 1024,
+        .level = 128, .window = 256, .mode = INTERP_NEAREST, .format = FORMAT_PNG,
+        .cache_mib = 2048,
+    };
+    bool range_given = false;
+    if (argc < 3) return false;
+    a->array = argv[1];
+    a->outdir = argv[2];
+
+    for (int i = 3; i < argc; i++) {
+        const char* opt = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(opt, "--trilinear") == 0) {
+            a->mode = INTERP_TRILINEAR;
+            continue;
+        }
+        if (!val) {
+            fprintf(stderr, "missing value for %s\n", opt);
+            return false;
+        }
+        i++;
+        if (strcmp(opt, "--axis") == 0) {
+            const char* axes = "zyx";
+            const char* hit = val[0] ? strchr(axes, val[0]) : nullptr;
+            if (!hit || val[1]) return false;
+            a->axis = (s32)(hit - axes);
+        } else if (strcmp(opt, "--oblique") == 0) {
+            char* e;
+            if (!parse_vec3(val, a->center, &e) || *e != ':' ||
+                !parse_vec3(e + 1, a->u, &e) || *e != ':' ||
+                !parse_vec3(e + 1, a->v, &e) || *e) {
+                fprintf(stderr, "bad --oblique %s\n", val);
+                return false;
+            }
+            a->axis = -1;
+        } else if (strcmp(opt, "--range") == 0) {
+            int n = sscanf(val, "%d:%d:%d", &a->first, &a->last, &a->stride);
+            if (n < 2 || a->stride < 1) return false;
+            range_given = true;
+        } else if (strcmp(opt, "--size") == 0) {
+            if (sscanf(val, "%dx%d", &a->h, &a->w) != 2 || a->h < 1 || a->w < 1) return false;
+        } else if (strcmp(opt, "--lod") == 0) {
+            a->lod = atoi(val);
+            if (a->lod < 0 || a->lod > 8) return false;
+        } else if (strcmp(opt, "--level") == 0) {
+            a->level = (u8)atoi(val);
+        } else if (strcmp(opt, "--window") == 0) {
+            a->window = (u16)atoi(val);
+        } else if (strcmp(opt, "--format") == 0) {
+            if (strcmp(val, "png") == 0) a->format = FORMAT_PNG;
+            else if (strcmp(val, "raw") == 0) a->format = FORMAT_RAW;
+            else return false;
+        } else if (strcmp(opt, "--cache") == 0) {
+            a->cache_mib = atoi(val);
+        } else if (strcmp(opt, "--batch") == 0) {
+            a->batch = atoi(val);
+        } else {
+            fprintf(stderr, "unknown option %s\n", opt);
+            return false;
+        }
+    }
+    if (a->axis < 0 && !range_given) {
+        a->first = a->last = 0;
+    }
+    return true;
+}
+
+static err write_raw(const char* path, const u8* pixels, s32 h, s32 w) {
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        LOG_ERROR("failed to open %s for writing\n", path);
+        return FAIL;
+    }
+    size_t n = fwrite(pixels, 1, (size_t)h * w, fp);
+    fclose(fp);
+    return n == (size_t)h * w ? OK : FAIL;
+}
+
+// Rendering
+
+// Render rows [r0, r1) of one frame. The chunks under the band (padded by a
+// voxel for trilinear neighbours) are pinned in the cache and handed to
+// reslice_plane as a borrowed volume, so the GUI and this tool share the kernel.
+static void render_band_fn(void* ctx, s32 item) {
+    batch_job* job = ctx;
+    s32 band = item / job->num_frames;
+    s32 f = item % job->num_frames;
+    s32 r0 = band * job->band_rows;
+    s32 r1 = r0 + job->band_rows < job->h ? r0 + job->band_rows : job->h;
+    const plane* p = &job->planes[f];
+
+    plane bp = *p;
+    for (s32 a = 0; a < 3; a++) {
+        bp.origin[a] += r0 * p->v[a];
+    }
+    s32 rows = r1 - r0;
+
+    s32 lo[3], hi[3];
+    for (s32 a = 0; a < 3; a++) {
+        f32 e0 = bp.origin[a];
+        f32 e1 = e0 + (job->w - 1) * bp.u[a];
+        f32 e2 = e0 + (rows - 1) * bp.v[a];
+        f32 e3 = e1 + (rows - 1) * bp.v[a];
+        f32 mn = fminf(fminf(e0, e1), fminf(e2, e3));
+        f32 mx = fmaxf(fmaxf(e0, e1), fmaxf(e2, e3));
+        lo[a] = (s32)floorf((floorf(mn) - 1) / CHUNK_LEN);
+        hi[a] = (s32)floorf((floorf(mx) + 1) / CHUNK_LEN);
+        if (lo[a] < 0) lo[a] = 0;
+        if (hi[a] >= job->grid[a]) hi[a] = job->grid[a] - 1;
+    }
+
+    u8* out = job->frames[f] + (size_t)r0 * job->w;
+    if (lo[0] > hi[0] || lo[1] > hi[1] || lo[2] > hi[2]) {
+        memset(out, job->lut[0], (size_t)rows * job->w);
+        return;
+    }
+
+    volume sub = {hi[0] - lo[0] + 1, hi[1] - lo[1] + 1, hi[2] - lo[2] + 1, nullptr, nullptr};
+    chunkcache_acquire_box(job->cache, lo, &sub);
+    for (s32 a = 0; a < 3; a++) {
+        bp.origin[a] -= lo[a] * CHUNK_LEN;
+    }
+
+    reslice_plane(&sub, &bp, rows, job->w, job->args->mode, out);
+    for (size_t i = 0; i < (size_t)rows * job->w; i++) {
+        out[i] = job->lut[out[i]];
+    }
+
+    chunkcache_release_box(job->cache, lo, &sub);
+}
+
+static void write_frame_fn(void* ctx, s32 f) {
+    batch_job* job = ctx;
+    const slice_args* a = job->args;
+    s32 index = job->first_index + f;
+    s32 plane_pos = a->first + index * a->stride;
+    const char* ext = a->format == FORMAT_PNG ? "png" : "raw";
+    char path[1024];
+    if (a->axis >= 0) {
+        snprintf(path, sizeof(path), "%s/%c_%05d.%s", a->outdir, "zyx"[a->axis], plane_pos, ext);
+    } else {
+        snprintf(path, sizeof(path), "%s/oblique_%05d.%s", a->outdir, index, ext);
+    }
+    err e = a->format == FORMAT_PNG ? write_png(path, job->frames[f], job->h, job->w, 1)
+                                    : write_raw(path, job->frames[f], job->h, job->w);
+    if (e == OK) {
+        atomic_fetch_add(&job->bytes_written, (s64)job->h * job->w);
+    } else {
+        LOG_ERROR("failed to write %s\n", path);
+    }
+}
+
+int main(int argc, char** argv) {
+    slice_args args;
+    if (!parse_args(argc, argv, &args)) {
+        usage();
+        return 1;
+    }
+
+    char path[1024];
+    zarrinfo info;
+    bool multiscale;
+    if (!zarr_open_array(args.array, args.lod, path, sizeof(path), &info, &multiscale)) {
+        return 1;
+    }
+    chunkcache* cache = chunkcache_new(path, info, (size_t)args.cache_mib * 1024 * 1024);
+    if (!cache) {
+        return 1;
+    }
+
+    // A multiscale level already holds the downsampled data, so coordinates are
+    // scaled into it and sampled one to one; a single array is decimated instead.
+    f32 scale = multiscale ? 1.0f / (1 << args.lod) : 1.0f;
+    f32 step = multiscale ? 1.0f : (f32)(1 << args.lod);
+    s32 extent[3];
+    for (s32 a = 0; a < 3; a++) {
+        extent[a] = multiscale ? info.shape[a] << args.lod : info.shape[a];
+    }
+
+    // Frame geometry: origin and steps for frame 0, plus the per-frame offset
+    plane base = {0};
+    f32 normal[3] = {0};
+    s32 h, w;
+    if (args.axis >= 0) {
+        s32 ra = view_axes[args.axis][0], ca = view_axes[args.axis][1];
+        if (args.last < 0) args.last = extent[args.axis] - 1;
+        h = (s32)ceilf(info.shape[ra] / step);
+        w = (s32)ceilf(info.shape[ca] / step);
+        base.v[ra] = step;
+        base.u[ca] = step;
+        normal[args.axis] = 1.0f;
+    } else {
+        f32 lu = sqrtf(args.u[0] * args.u[0] + args.u[1] * args.u[1] + args.u[2] * args.u[2]);
+        f32 lv = sqrtf(args.v[0] * args.v[0] + args.v[1] * args.v[1] + args.v[2] * args.v[2]);
+        if (lu == 0.0f || lv == 0.0f) {
+            LOG_ERROR("oblique directions must be non-zero\n");
+            return 1;
+        }
+        for (s32 a = 0; a < 3; a++) {
+            base.u[a] = args.u[a] / lu * step;
+            base.v[a] = args.v[a] / lv * step;
+        }
+        normal[0] = base.u[1] * base.v[2] - base.u[2] * base.v[1];
+        normal[1] = base.u[2] * base.v[0] - base.u[0] * base.v[2];
+        normal[2] = base.u[0] * base.v[1] - base.u[1] * base.v[0];
+        f32 ln = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (ln == 0.0f) {
+            LOG_ERROR("oblique directions must not be parallel\n");
+            return 1;
+        }
+        h = args.h;
+        w = args.w;
+        for (s32 a = 0; a < 3; a++) {
+            normal[a] /= ln;
+            base.origin[a] = args.center[a] * scale - (w / 2) * base.u[a] - (h / 2) * base.v[a];
+        }
+    }
+    if (args.last < args.first) {
+        LOG_ERROR("empty range %d:%d\n", args.first, args.last);
+        return 1;
+    }
+    s32 num_frames = (args.last - args.first) / args.stride + 1;
+
+    mkdir(args.outdir, 0755);
+    u8 lut[256];
+    window_level_lut(args.level, args.window, lut);
+
+    s32 threads = parallel_thread_count();
+    s32 batch = args.batch > 0 ? args.batch : 4 * threads;
+    // Bands about a chunk tall keep each item's pinned footprint to a chunk layer
+    f32 row_step = sqrtf(base.v[0] * base.v[0] + base.v[1] * base.v[1] + base.v[2] * base.v[2]);
+    s32 band_rows = (s32)(CHUNK_LEN / row_step);
+    if (band_rows < 1) band_rows = 1;
+    if (band_rows > h) band_rows = h;
+
+    printf("vcr-slice: %d frames of %dx%d from %s (%s, lod %d), %d threads\n", num_frames, w, h, path,
+           multiscale ? "multiscale level" : "decimated", args.lod, threads);
+
+    f64 start = now_seconds();
+    s64 total_bytes = 0;
+    for (s32 b0 = 0; b0 < num_frames; b0 += batch) {
+        s32 n = num_frames - b0 < batch ? num_frames - b0 : batch;
+        plane* planes = malloc(sizeof(plane) * n);
+        u8** frames = malloc(sizeof(u8*) * n);
+        for (s32 f = 0; f < n; f++) {
+            f32 offset = (f32)(args.first + (b0 + f) * args.stride) * scale;
+            planes[f] = base;
+            for (s32 a = 0; a < 3; a++) {
+                planes[f].origin[a] += offset * normal[a];
+            }
+            frames[f] = malloc((size_t)h * w);
+        }
+
+        batch_job job = {
+            .cache = cache, .args = &args, .planes = planes, .frames = frames, .num_frames = n,
+            .h = h, .w = w, .band_rows = band_rows, .num_bands = (h + band_rows - 1) / band_rows,
+            .lut = lut, .first_index = b0,
+        };
+        chunkcache_grid(cache, job.grid);
+        parallel_for(job.num_bands * n, render_band_fn, &job);
+        parallel_for(n, write_frame_fn, &job);
+        total_bytes += atomic_load(&job.bytes_written);
+
+        for (s32 f = 0; f < n; f++) {
+            free(frames[f]);
+        }
+        free(frames);
+        free(planes);
+
+        f64 elapsed = now_seconds() - start;
+        printf("\r%d / %d frames, %.1f frames/s", b0 + n, num_frames, (b0 + n) / elapsed);
+        fflush(stdout);
+    }
+    f64 elapsed = now_seconds() - start;
+
+    u64 hits, misses;
+    chunkcache_stats(cache, &hits, &misses);
+    printf("\n%d frames in %.2f s: %.1f frames/s, %.1f Mpixel/s; chunk cache %llu hits, %llu misses\n",
+           num_frames, elapsed, num_frames / elapsed, total_bytes / elapsed / 1e6,
+           (unsigned long long)hits, (unsigned long long)misses);
+
+    chunkcache_free(cache);
+    return total_bytes == (s64)num_frames * h * w ? 0 : 1;
+}
@@ -7,23 +7,20 @@ static chunk* zarr_decompress_chunk(s32 size, void* compressed_data, zarrinfo me
         LOG_ERROR("unsupported zarr format. Only u8 is supported\n");
     }
 
-    u8* decompressed_data = malloc(CHUNK_LEN*CHUNK_LEN*CHUNK_LEN);
-    int decompressed_size = blosc2_decompress(compressed_data, size, decompressed_data, CHUNK_LEN*CHUNK_LEN*CHUNK_LEN);
+    // A private context per call: the global blosc2_decompress serializes all
+    // callers on one lock, which defeats decoding chunks on several threads.
+    // The chunk layout matches zarr's C order, so decode straight into it.
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+    dparams.nthreads = 1;
+    blosc2_context* dctx = blosc2_create_dctx(dparams);
+    chunk *ret = chunk_new();
+    int decompressed_size = blosc2_decompress_ctx(dctx, compressed_data, size, ret, sizeof(chunk));
+    blosc2_free_ctx(dctx);
     if (decompressed_size < 0) {
         LOG_ERROR("Blosc2 decompression failed: %d\n", decompressed_size);
-        free(decompressed_data);
+        chunk_free(ret);
         return nullptr;
     }
-    chunk *ret = chunk_new();
-
-    for (int z = 0; z < CHUNK_LEN; z++) {
-        for (int y = 0; y < CHUNK_LEN; y++) {
-            for (int x = 0; x < CHUNK_LEN; x++) {
-                (*ret)[z][y][x] = decompressed_data[z * CHUNK_LEN * CHUNK_LEN + y * CHUNK_LEN + x];
-            }
-        }
-    }
-    free(decompressed_data);
     return ret;
 }
 
@@ -182,6 +179,36 @@ zarrinfo zarr_parse_zarray(const char* json_string) {
     return info;
 }
 
+void zarr_chunk_path(char* out, size_t size, const char* path, zarrinfo metadata, s32 z, s32 y, s32 x) {
+    if (metadata.dimension_separator == '/') {
+        snprintf(out, size, "%s/%d/%d/%d", path, z, y, x);
+    } else {
+        char sep = metadata.dimension_separator ? metadata.dimension_separator : '.';
+        snprintf(out, size, "%s/%d%c%d%c%d", path, z, sep, y, sep, x);
+    }
+}
+
+bool zarr_open_array(const char* root, s32 level, char* path, size_t size, zarrinfo* info, bool* multiscale) {
+    char zarray[1200];
+    snprintf(zarray, sizeof(zarray), "%s/.zarray", root);
+    bool group = !path_exists(zarray);
+    if (group) {
+        snprintf(path, size, "%s/%d", root, level);
+    } else {
+        snprintf(path, size, "%s", root);
+    }
+    if (multiscale) *multiscale = group;
+    snprintf(zarray, sizeof(zarray), "%s/.zarray", path);
+    char* json = read_file(zarray);
+    if (!json) {
+        LOG_ERROR("failed to read %s\n", zarray);
+        return false;
+    }
+    *info = zarr_parse_zarray(json);
+    free(json);
+    return info->zarr_format != 0;
+}
+
 volume* zarr_read_volume(char* path, zarrinfo metadata, s32 z_start, s32 y_start, s32 x_start, s32 z_chunks, s32 y_chunks, s32 x_chunks) {
     volume* vol = volume_new(z_chunks, y_chunks, x_chunks);
     if (!vol) {
@@ -199,14 +226,7 @@ volume* zarr_read_volume(char* path, zarrinfo metadata, s32 z_start, s32 y_start
                 s32 chunk_y = y_start + y;
                 s32 chunk_x = x_start + x;
                 
-                if (metadata.dimension_separator == '/') {
-                    snprintf(chunk_path, sizeof(chunk_path), "%s/%d/%d/%d", 
-                            path, chunk_z, chunk_y, chunk_x);
-                } else {
-                    snprintf(chunk_path, sizeof(chunk_path), "%s/%d%c%d%c%d", 
-                            path, chunk_z, metadata.dimension_separator, 
-                            chunk_y, metadata.dimension_separator, chunk_x);
-                }
+                zarr_chunk_path(chunk_path, sizeof(chunk_path), path, metadata, chunk_z, chunk_y, chunk_x);
                 
                 // Load the chunk
                 chunk* ch = zarr_read_chunk(chunk_path, metadata);
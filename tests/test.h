@@ -0,0 +1,75 @@
+#pragma once
+#include "vcr.h"
+#include <ftw.h>
+#include <unistd.h>
+
+// Shared bits of the test programs. A test is a plain executable run by ctest:
+// failed CHECKs are reported and counted, and main returns test_result().
+
+static int test_failures;
+
+#define CHECK(cond, ...)                                                              \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond);  \
+            fprintf(stderr, __VA_ARGS__);                                             \
+            fprintf(stderr, "\n");                                                    \
+            test_failures++;                                                          \
+        }                                                                             \
+    } while (0)
+
+static inline int test_result(void) {
+    if (test_failures) {
+        fprintf(stderr, "%d check(s) failed\n", test_failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
+
+// Synthetic scan: two blobs with a ripple on their surfaces, placed across the
+// chunk borders at 128 and 256 so every test meshes seams, and below 128 at
+// the edges of a 3x3x3 volume so its surfaces are closed
+static inline u8 test_field(s32 z, s32 y, s32 x) {
+    f32 d1 = sqrtf((z - 150.0f) * (z - 150.0f) + (y - 128.0f) * (y - 128.0f) + (x - 200.0f) * (x - 200.0f));
+    f32 d2 = sqrtf((z - 250.0f) * (z - 250.0f) + (y - 140.0f) * (y - 140.0f) + (x - 120.0f) * (x - 120.0f));
+    f32 v = fmaxf(255.0f - d1 * 2.0f, 240.0f - d2 * 2.5f) + 8.0f * sinf(x * 0.11f) * cosf(y * 0.07f + z * 0.05f);
+    return (u8)fmaxf(0.0f, fminf(255.0f, v));
+}
+
+static inline void test_fill_chunk(chunk* c, s32 cz, s32 cy, s32 cx) {
+    for (s32 z = 0; z < CHUNK_LEN; z++) {
+        for (s32 y = 0; y < CHUNK_LEN; y++) {
+            for (s32 x = 0; x < CHUNK_LEN; x++) {
+                (*c)[z][y][x] = test_field(cz * CHUNK_LEN + z, cy * CHUNK_LEN + y, cx * CHUNK_LEN + x);
+            }
+        }
+    }
+}
+
+// The field over z x y x x chunks from the origin
+static inline volume* test_volume(s32 z, s32 y, s32 x) {
+    volume* vol = volume_new(z, y, x);
+    for (s32 i = 0; i < z * y * x; i++) {
+        test_fill_chunk(&vol->chunks[i], i / (y * x), i / x % y, i % x);
+    }
+    return vol;
+}
+
+// Scratch directory under $TMPDIR, removed with test_remove_tree
+static inline bool test_tempdir(char* out, size_t size) {
+    const char* tmp = getenv("TMPDIR");
+    snprintf(out, size, "%s/vcr-test-XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+    return mkdtemp(out) != nullptr;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static inline void test_remove_tree(const char* dir) {
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
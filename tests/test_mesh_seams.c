@@ -0,0 +1,118 @@
+#include "test.h"
+
+// Chunk meshes must stitch exactly: a chunk meshed on its own, reading its
+// neighbours only as a halo, gives the mesh it gets inside a whole-volume pass,
+// and on every plane two neighbouring chunks share, both meshes hold the same
+// vertices with the same normals and values.
+
+constexpr s32 VOXEL = 1 << MESH_POS_FRAC;  // position units per voxel at lod 0
+
+// A vertex in volume coordinates, fixed point, with its attributes; sorts by all of them
+typedef struct seam_vertex {
+    s32 pos[3];  // x,y,z
+    s8 normal[2];
+    u8 value;
+} seam_vertex;
+
+static int compare_vertex(const void* a, const void* b) {
+    const seam_vertex* va = a;
+    const seam_vertex* vb = b;
+    for (s32 i = 0; i < 3; i++) {
+        if (va->pos[i] != vb->pos[i]) return va->pos[i] < vb->pos[i] ? -1 : 1;
+    }
+    for (s32 i = 0; i < 2; i++) {
+        if (va->normal[i] != vb->normal[i]) return va->normal[i] < vb->normal[i] ? -1 : 1;
+    }
+    return (int)va->value - (int)vb->value;
+}
+
+// The vertices of m that the chunk shares with its + neighbour along axis, whose
+// first voxel layer is at the fixed-point coordinate at, in volume coordinates,
+// sorted. Marching cubes shares the vertices on the edges in the plane: those on
+// a grid point are left out, since an edge leaving the plane rounds onto one
+// too. Surface nets shares the cell layer past the plane: vertices on its
+// bounding planes are left out, since a cell on either side may reach them.
+static s32 seam_vertices(const mesh* m, mesh_algorithm algorithm, s32 axis, s32 at, seam_vertex* out) {
+    s32 n = 0;
+    for (int i = 0; i < m->num_vertices; i++) {
+        const mesh_vertex* v = &m->vertices[i];
+        seam_vertex s = {.normal = {v->normal[0], v->normal[1]}, .value = v->value};
+        for (s32 k = 0; k < 3; k++) {
+            s.pos[k] = m->origin[k] * VOXEL + v->pos[k];
+        }
+        bool shared;
+        if (algorithm == MESH_MARCHING_CUBES) {
+            bool grid = s.pos[0] % VOXEL == 0 && s.pos[1] % VOXEL == 0 && s.pos[2] % VOXEL == 0;
+            shared = s.pos[axis] == at && !grid;
+        } else {
+            shared = s.pos[axis] > at && s.pos[axis] < at + VOXEL;
+        }
+        if (shared) out[n++] = s;
+    }
+    qsort(out, n, sizeof(seam_vertex), compare_vertex);
+    return n;
+}
+
+static bool same_mesh(const mesh* a, const mesh* b) {
+    return a->num_vertices == b->num_vertices && a->num_triangles == b->num_triangles &&
+           memcmp(a->origin, b->origin, sizeof(a->origin)) == 0 && a->scale == b->scale &&
+           memcmp(a->indices, b->indices, (size_t)a->num_triangles * 3 * sizeof(u32)) == 0 &&
+           memcmp(a->vertices, b->vertices, (size_t)a->num_vertices * sizeof(mesh_vertex)) == 0;
+}
+
+static void check_algorithm(const volume* vol, mesh_algorithm algorithm) {
+    s32 count = vol->z * vol->y * vol->x;
+    mesh* meshes = calloc(count, sizeof(mesh));
+    generate_chunk_meshes(vol, 128, 0, algorithm, nullptr, meshes);
+
+    // The centre chunk alone, with the rest of the volume only as its halo
+    const s32 lo[3] = {1, 1, 1}, hi[3] = {2, 2, 2};
+    const u8 iso = 128;
+    mesh alone;
+    generate_chunk_meshes_region(vol, lo, hi, &iso, 1, 0, algorithm, nullptr, &alone);
+    CHECK(alone.num_triangles > 0, "algorithm %d: the centre chunk has no surface", algorithm);
+    CHECK(same_mesh(&alone, &meshes[13]), "algorithm %d: centre chunk meshed alone differs: %d/%d triangles",
+          algorithm, alone.num_triangles, meshes[13].num_triangles);
+    mesh_free(&alone);
+
+    // Every seam plane between face neighbours; mesh axes are x,y,z, chunk steps z,y,x
+    s32 capacity = 0;
+    for (s32 i = 0; i < count; i++) {
+        if (meshes[i].num_vertices > capacity) capacity = meshes[i].num_vertices;
+    }
+    seam_vertex* a = malloc((size_t)capacity * sizeof(seam_vertex));
+    seam_vertex* b = malloc((size_t)capacity * sizeof(seam_vertex));
+    s32 seams = 0, shared = 0;
+    for (s32 i = 0; i < count; i++) {
+        s32 c[3] = {i / (vol->y * vol->x), i / vol->x % vol->y, i % vol->x};
+        for (s32 axis = 0; axis < 3; axis++) {
+            s32 step = 2 - axis;
+            if (c[step] + 1 >= (step == 0 ? vol->z : step == 1 ? vol->y : vol->x)) continue;
+            s32 j = i + (step == 0 ? vol->y * vol->x : step == 1 ? vol->x : 1);
+            s32 at = (c[step] + 1) * CHUNK_LEN * VOXEL;
+            s32 na = seam_vertices(&meshes[i], algorithm, axis, at, a);
+            s32 nb = seam_vertices(&meshes[j], algorithm, axis, at, b);
+            CHECK(na == nb && memcmp(a, b, (size_t)na * sizeof(seam_vertex)) == 0,
+                  "algorithm %d: seam between chunks %d and %d: %d and %d vertices differ", algorithm, i, j, na, nb);
+            seams++;
+            shared += na;
+        }
+    }
+    CHECK(seams == 54, "algorithm %d: %d seams", algorithm, seams);
+    CHECK(shared > 0, "algorithm %d: no vertex is shared across a seam", algorithm);
+    free(a);
+    free(b);
+
+    for (s32 i = 0; i < count; i++) {
+        mesh_free(&meshes[i]);
+    }
+    free(meshes);
+}
+
+int main(void) {
+    volume* vol = test_volume(3, 3, 3);
+    check_algorithm(vol, MESH_MARCHING_CUBES);
+    check_algorithm(vol, MESH_SURFACE_NETS);
+    volume_free(vol);
+    return test_result();
+}
@@ -0,0 +1,142 @@
+#include "test.h"
+
+// Meshing output must not depend on the thread count. The pool's size is fixed
+// per process, so the test runs itself with --digest under several VCR_THREADS
+// and compares the digests of everything the volume and chunk meshers produce.
+// It also checks the value range a mesh reports against its vertices.
+
+static u64 digest_bytes(u64 h, const void* data, size_t size) {
+    const u8* p = data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static u64 digest_mesh(u64 h, const mesh* m) {
+    h = digest_bytes(h, &m->num_vertices, sizeof(m->num_vertices));
+    h = digest_bytes(h, &m->num_triangles, sizeof(m->num_triangles));
+    h = digest_bytes(h, m->origin, sizeof(m->origin));
+    h = digest_bytes(h, &m->scale, sizeof(m->scale));
+    h = digest_bytes(h, &m->value_min, 1);
+    h = digest_bytes(h, &m->value_max, 1);
+    for (int i = 0; i < m->num_vertices; i++) {
+        // Field by field: the padding byte is not part of the output
+        const mesh_vertex* v = &m->vertices[i];
+        h = digest_bytes(h, v->pos, sizeof(v->pos));
+        h = digest_bytes(h, v->normal, sizeof(v->normal));
+        h = digest_bytes(h, &v->value, 1);
+    }
+    return digest_bytes(h, m->indices, (size_t)m->num_triangles * 3 * sizeof(u32));
+}
+
+static u64 mesh_digest(void) {
+    volume* vol = test_volume(2, 2, 2);
+    s32 count = vol->z * vol->y * vol->x;
+    chunklods* lods = calloc(count, sizeof(chunklods));
+    for (s32 i = 0; i < count; i++) {
+        chunklods_build(&lods[i], &vol->chunks[i]);
+    }
+    u64 h = 14695981039104346037ull;
+
+    // One chunk on its own, split into layers across the pool; chunk (1, 0, 1) holds most of a blob
+    mesh m = generate_mesh_from_chunk(&vol->chunks[5], 128, 0, MESH_MARCHING_CUBES, nullptr);
+    h = digest_mesh(h, &m);
+    mesh_free(&m);
+
+    // Chunk meshes of the volume, both engines, with and without the span-space index
+    mesh* meshes = calloc((size_t)count * MESH_MAX_ISOS, sizeof(mesh));
+    for (s32 algorithm = MESH_MARCHING_CUBES; algorithm <= MESH_SURFACE_NETS; algorithm++) {
+        for (s32 lod = 0; lod <= 1; lod++) {
+            generate_chunk_meshes(vol, 128, lod, algorithm, lod ? lods : nullptr, meshes);
+            for (s32 i = 0; i < count; i++) {
+                h = digest_mesh(h, &meshes[i]);
+                mesh_free(&meshes[i]);
+            }
+        }
+    }
+
+    // Several surfaces in one sweep over a region
+    const u8 isos[3] = {100, 160, 200};
+    const s32 lo[3] = {0, 0, 0}, hi[3] = {2, 2, 1};
+    generate_chunk_meshes_region(vol, lo, hi, isos, 3, 0, MESH_MARCHING_CUBES, lods, meshes);
+    for (s32 i = 0; i < 4 * 3; i++) {
+        h = digest_mesh(h, &meshes[i]);
+        mesh_free(&meshes[i]);
+    }
+    free(meshes);
+
+    // The merged volume mesh
+    m = generate_mesh_from_volume(vol, 128, 1, MESH_MARCHING_CUBES, lods);
+    h = digest_mesh(h, &m);
+    mesh_free(&m);
+
+    for (s32 i = 0; i < count; i++) {
+        chunklods_free(&lods[i]);
+    }
+    free(lods);
+    volume_free(vol);
+    return h;
+}
+
+// A narrow field, 126..129, with a plane of surface halfway up: most layers of
+// the chunk hold no vertex, and the mesh's value range must still be that of
+// the vertices it has
+static void check_value_range(mesh_algorithm algorithm) {
+    chunk* c = malloc(sizeof(chunk));
+    for (s32 z = 0; z < CHUNK_LEN; z++) {
+        for (s32 y = 0; y < CHUNK_LEN; y++) {
+            for (s32 x = 0; x < CHUNK_LEN; x++) {
+                (*c)[z][y][x] = (u8)(z < CHUNK_LEN / 2 ? 126 + (x & 1) : 128 + (y & 1));
+            }
+        }
+    }
+    mesh m = generate_mesh_from_chunk(c, 128, 0, algorithm, nullptr);
+    CHECK(m.num_triangles > 0, "algorithm %d: no surface", algorithm);
+    u8 lo = 255, hi = 0;
+    for (int i = 0; i < m.num_vertices; i++) {
+        if (m.vertices[i].value < lo) lo = m.vertices[i].value;
+        if (m.vertices[i].value > hi) hi = m.vertices[i].value;
+    }
+    CHECK(m.value_min == lo && m.value_max == hi, "algorithm %d: value range %d..%d, vertices %d..%d", algorithm,
+          m.value_min, m.value_max, lo, hi);
+    mesh_free(&m);
+    free(c);
+}
+
+static bool run_digest(const char* self, s32 threads, u64* out) {
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd), "VCR_THREADS=%d '%s' --digest", threads, self);
+    FILE* p = popen(cmd, "r");
+    if (!p) return false;
+    unsigned long long h = 0;
+    bool ok = fscanf(p, "%llx", &h) == 1;
+    ok = pclose(p) == 0 && ok;
+    *out = h;
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--digest") == 0) {
+        printf("%016llx\n", (unsigned long long)mesh_digest());
+        return 0;
+    }
+
+    static const s32 threads[] = {1, 2, 3, 8};
+    u64 reference = 0;
+    for (s32 i = 0; i < (s32)(sizeof(threads) / sizeof(threads[0])); i++) {
+        u64 h;
+        bool ran = run_digest(argv[0], threads[i], &h);
+        CHECK(ran, "meshing with %d threads did not finish", threads[i]);
+        if (!ran) continue;
+        if (i == 0) {
+            reference = h;
+        } else {
+            CHECK(h == reference, "%d threads: digest %016llx, 1 thread: %016llx", threads[i],
+                  (unsigned long long)h, (unsigned long long)reference);
+        }
+    }
+    check_value_range(MESH_MARCHING_CUBES);
+    check_value_range(MESH_SURFACE_NETS);
+    return test_result();
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+#include <dirent.h>
+
+// Cached chunk meshes round-trip exactly, a key that was never stored misses,
+// and a file cut short is rejected rather than decoded.
+
+static bool same_mesh(const mesh* a, const mesh* b) {
+    if (a->num_vertices != b->num_vertices || a->num_triangles != b->num_triangles || a->scale != b->scale ||
+        a->value_min != b->value_min || a->value_max != b->value_max) {
+        return false;
+    }
+    if (a->num_triangles == 0) return true;
+    for (int i = 0; i < a->num_vertices; i++) {
+        const mesh_vertex* va = &a->vertices[i];
+        const mesh_vertex* vb = &b->vertices[i];
+        if (memcmp(va->pos, vb->pos, sizeof(va->pos)) != 0 ||
+            memcmp(va->normal, vb->normal, sizeof(va->normal)) != 0 || va->value != vb->value) {
+            return false;
+        }
+    }
+    return memcmp(a->indices, b->indices, (size_t)a->num_triangles * 3 * sizeof(u32)) == 0 &&
+           memcmp(a->pos_min, b->pos_min, sizeof(a->pos_min)) == 0 &&
+           memcmp(a->pos_max, b->pos_max, sizeof(a->pos_max)) == 0;
+}
+
+// Path of the one mesh file under dir/<array id>/
+static bool find_mesh_file(const char* dir, u64 array, char* out, size_t size) {
+    char sub[1100];
+    snprintf(sub, sizeof(sub), "%s/%016llx", dir, (unsigned long long)array);
+    DIR* d = opendir(sub);
+    if (!d) return false;
+    bool found = false;
+    for (struct dirent* e; !found && (e = readdir(d));) {
+        if (e->d_name[0] == '.') continue;
+        snprintf(out, size, "%s/%s", sub, e->d_name);
+        found = true;
+    }
+    closedir(d);
+    return found;
+}
+
+int main(void) {
+    char dir[1024];
+    if (!test_tempdir(dir, sizeof(dir))) {
+        fprintf(stderr, "failed to create a scratch directory\n");
+        return 1;
+    }
+
+    chunk* c = malloc(sizeof(chunk));
+    test_fill_chunk(c, 1, 0, 1);
+    mesh m = generate_mesh_from_chunk(c, 128, 0, MESH_MARCHING_CUBES, nullptr);
+    CHECK(m.num_triangles > 0, "the test chunk has no surface");
+
+    meshkey key = {.array = 0x1234, .chunk = {1, 0, 1}, .lod = 0, .iso = 128, .algorithm = MESH_MARCHING_CUBES};
+    CHECK(meshcache_store(dir, &key, &m) == OK, "store failed");
+    mesh loaded;
+    bool hit = meshcache_load(dir, &key, &loaded);
+    CHECK(hit, "stored mesh did not load");
+    if (hit) {
+        CHECK(same_mesh(&m, &loaded), "loaded mesh differs: %d/%d vertices, %d/%d triangles", loaded.num_vertices,
+              m.num_vertices, loaded.num_triangles, m.num_triangles);
+        CHECK(loaded.origin[0] == 0 && loaded.origin[1] == 0 && loaded.origin[2] == 0, "origin not zero");
+        mesh_free(&loaded);
+    }
+
+    // Any other field of the key is another mesh
+    meshkey other = key;
+    other.iso = 129;
+    CHECK(!meshcache_load(dir, &other, &loaded), "another iso hit the stored mesh");
+    other = key;
+    other.halo = 1;
+    CHECK(!meshcache_load(dir, &other, &loaded), "another halo hit the stored mesh");
+
+    // A chunk without a surface is cached as well
+    meshkey empty_key = key;
+    empty_key.chunk[0] = 2;
+    mesh empty = {.scale = m.scale};
+    CHECK(meshcache_store(dir, &empty_key, &empty) == OK, "store of an empty mesh failed");
+    hit = meshcache_load(dir, &empty_key, &loaded);
+    CHECK(hit && loaded.num_triangles == 0, "empty mesh did not round-trip");
+    if (hit) mesh_free(&loaded);
+
+    // A truncated file: one byte short of the stored mesh
+    meshkey cut_key = key;
+    cut_key.array = 0x5678;
+    CHECK(meshcache_store(dir, &cut_key, &m) == OK, "store failed");
+    char path[1400];
+    struct stat st;
+    bool found = find_mesh_file(dir, cut_key.array, path, sizeof(path)) && stat(path, &st) == 0;
+    CHECK(found, "stored mesh file not found");
+    if (found) {
+        CHECK(truncate(path, st.st_size - 1) == 0, "failed to truncate %s", path);
+        CHECK(!meshcache_load(dir, &cut_key, &loaded), "truncated mesh loaded");
+    }
+
+    mesh_free(&m);
+    free(c);
+    test_remove_tree(dir);
+    return test_result();
+}
@@ -0,0 +1,114 @@
+#include "test.h"
+#define SOKOL_IMPL
+#define SOKOL_DUMMY_BACKEND
+#define SOKOL_DEBUG  // validate in release builds too
+#include "sokol_gfx.h"
+#include "sokol_log.h"
+#include "meshgpu.c"
+
+// The mesh pipeline headless: under the dummy backend the shader, pipeline,
+// colormap and mesh buffers must all be created valid, a pass must draw
+// through them without sokol reporting an error, and the colormap must only
+// be re-uploaded when its table changes. Built with meshgpu.c included, to see
+// the renderer's resources.
+
+// sokol's validation only logs, so errors are counted on the way to the log
+static s32 sokol_errors;
+
+static void count_errors(const char* tag, u32 level, u32 item, const char* message, u32 line, const char* file,
+                         void* user_data) {
+    if (level <= 1) sokol_errors++;  // panic or error
+    slog_func(tag, level, item, message, line, file, user_data);
+}
+
+// A unit quad as two triangles at z = 0
+static mesh test_quad(void) {
+    mesh m = {.scale = 1.0f / (1 << MESH_POS_FRAC), .num_vertices = 4, .num_triangles = 2};
+    static const u16 corners[4][2] = {{0, 0}, {256, 0}, {256, 256}, {0, 256}};
+    static const u32 indices[6] = {0, 1, 2, 0, 2, 3};
+    m.vertices = calloc(4, sizeof(mesh_vertex));
+    m.indices = malloc(sizeof(indices));
+    for (s32 i = 0; i < 4; i++) {
+        m.vertices[i] = (mesh_vertex){.pos = {corners[i][0], corners[i][1], 0}, .value = (u8)(i * 80)};
+    }
+    memcpy(m.indices, indices, sizeof(indices));
+    mesh_bounds(&m);
+    return m;
+}
+
+// One offscreen frame: set the colormap and draw g; returns whether the colormap was uploaded
+static bool draw_frame(meshrenderer* r, const gpumesh* g, sg_attachments target, const u8 rgb[256][3]) {
+    static const f32 identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    static const f32 offset[3] = {0.5f, 0.5f, 0.0f};
+    static const f32 light[3] = {0.0f, 0.0f, -1.0f};
+    bool uploaded = meshrenderer_colormap(r, rgb);
+    sg_begin_pass(&(sg_pass){
+        .action.colors[0] = {.load_action = SG_LOADACTION_CLEAR, .clear_value = {0.0f, 0.0f, 0.0f, 1.0f}},
+        .attachments = target,
+    });
+    meshrenderer_begin(r, identity, offset, light);
+    s32 drawn = meshrenderer_draw(r, g);
+    CHECK(drawn == 2, "drew %d triangles", drawn);
+    sg_end_pass();
+    sg_commit();
+    return uploaded;
+}
+
+int main(void) {
+    sg_setup(&(sg_desc){.logger.func = count_errors});
+    CHECK(sg_query_backend() == SG_BACKEND_DUMMY, "backend %d", (int)sg_query_backend());
+
+    meshrenderer* r = meshrenderer_new();
+    CHECK(r != nullptr, "no renderer under the dummy backend");
+    mesh m = test_quad();
+    gpumesh* g = gpumesh_upload(&m);
+    CHECK(g != nullptr, "quad not uploaded");
+    mesh empty = {0};
+    CHECK(gpumesh_upload(&empty) == nullptr, "empty mesh uploaded");
+    if (!r || !g) {
+        sg_shutdown();
+        return test_result();
+    }
+
+    CHECK(sg_query_shader_state(r->shader) == SG_RESOURCESTATE_VALID, "shader not valid");
+    CHECK(sg_query_pipeline_state(r->pipeline) == SG_RESOURCESTATE_VALID, "pipeline not valid");
+    CHECK(sg_query_image_state(r->colormap) == SG_RESOURCESTATE_VALID, "colormap not valid");
+    CHECK(sg_query_sampler_state(r->sampler) == SG_RESOURCESTATE_VALID, "sampler not valid");
+    CHECK(sg_query_buffer_state(g->vertices) == SG_RESOURCESTATE_VALID, "vertex buffer not valid");
+    CHECK(sg_query_buffer_state(g->indices) == SG_RESOURCESTATE_VALID, "index buffer not valid");
+
+    // The pipeline's target: RGBA8 and depth, one sample
+    sg_image color = sg_make_image(&(sg_image_desc){
+        .usage.render_attachment = true, .width = 64, .height = 64, .pixel_format = SG_PIXELFORMAT_RGBA8,
+    });
+    sg_image depth = sg_make_image(&(sg_image_desc){
+        .usage.render_attachment = true, .width = 64, .height = 64, .pixel_format = SG_PIXELFORMAT_DEPTH,
+    });
+    sg_attachments target = sg_make_attachments(&(sg_attachments_desc){
+        .colors[0].image = color,
+        .depth_stencil.image = depth,
+    });
+    CHECK(sg_query_attachments_state(target) == SG_RESOURCESTATE_VALID, "render target not valid");
+
+    u8 table[256][3];
+    for (s32 i = 0; i < 256; i++) {
+        table[i][0] = (u8)i;
+        table[i][1] = (u8)(255 - i);
+        table[i][2] = 128;
+    }
+    CHECK(draw_frame(r, g, target, table), "first frame: colormap not uploaded");
+    CHECK(!draw_frame(r, g, target, table), "same table: colormap uploaded again");
+    table[7][2] = 0;
+    CHECK(draw_frame(r, g, target, table), "changed table: colormap not uploaded");
+    CHECK(sg_query_image_state(r->colormap) == SG_RESOURCESTATE_VALID, "colormap not valid after updates");
+
+    sg_destroy_attachments(target);
+    sg_destroy_image(depth);
+    sg_destroy_image(color);
+    gpumesh_free(g);
+    meshrenderer_free(r);
+    mesh_free(&m);
+    sg_shutdown();
+    CHECK(sokol_errors == 0, "sokol reported %d errors", sokol_errors);
+    return test_result();
+}
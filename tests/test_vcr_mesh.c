@@ -0,0 +1,221 @@
+#include "test.h"
+
+// vcr-mesh end to end: a 3x3x3-chunk array meshed with tiles of 1, 8 and all
+// 27 chunks gives a closed manifold surface, and the same triangles whatever
+// the tiling. Tiles change which seams are welded within a window and which
+// through the seam table after it, and which table entries are pruned as the
+// sweep moves on, so this guards both.
+// usage: test-vcr-mesh <vcr-mesh binary>
+
+typedef struct ply {
+    u64 num_vertices, num_faces;
+    f32* positions;  // x, y, z per vertex
+    u32* faces;      // 3 per face
+} ply;
+
+static void ply_free(ply* p) {
+    free(p->positions);
+    free(p->faces);
+}
+
+// Binary PLY as vcr-mesh writes it: vertices of x, y, z, nx, ny, nz and a value, triangle faces
+static bool ply_read(const char* path, ply* out) {
+    *out = (ply){0};
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+    char line[256];
+    unsigned long long nv = 0, nf = 0;
+    bool header = false;
+    while (fgets(line, sizeof(line), fp)) {
+        sscanf(line, "element vertex %llu", &nv);
+        sscanf(line, "element face %llu", &nf);
+        if (strcmp(line, "end_header\n") == 0) {
+            header = true;
+            break;
+        }
+    }
+    out->num_vertices = nv;
+    out->num_faces = nf;
+    out->positions = malloc(nv * 3 * sizeof(f32) + 1);
+    out->faces = malloc(nf * 3 * sizeof(u32) + 1);
+    bool ok = header;
+    for (u64 i = 0; i < nv && ok; i++) {
+        u8 v[6 * sizeof(f32) + 1];
+        ok = fread(v, sizeof(v), 1, fp) == 1;
+        memcpy(&out->positions[i * 3], v, 3 * sizeof(f32));
+    }
+    for (u64 i = 0; i < nf && ok; i++) {
+        u8 f[1 + 3 * sizeof(u32)];
+        ok = fread(f, sizeof(f), 1, fp) == 1 && f[0] == 3;
+        memcpy(&out->faces[i * 3], f + 1, 3 * sizeof(u32));
+    }
+    ok = ok && fgetc(fp) == EOF;
+    fclose(fp);
+    if (!ok) ply_free(out);
+    return ok;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    u64 x = *(const u64*)a, y = *(const u64*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_position(const f32* a, const f32* b) {
+    for (s32 i = 0; i < 3; i++) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compare_triangle(const void* a, const void* b) {
+    const f32* ta = a;
+    const f32* tb = b;
+    for (s32 i = 0; i < 9; i++) {
+        if (ta[i] != tb[i]) return ta[i] < tb[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// Closed and manifold: every edge is shared by exactly two faces, which run
+// it in opposite directions, and every vertex is used
+static void check_closed(const char* name, const ply* p) {
+    u64* edges = malloc(p->num_faces * 3 * sizeof(u64) + 1);
+    u8* used = calloc(p->num_vertices + 1, 1);
+    u64 bad_indices = 0;
+    for (u64 f = 0; f < p->num_faces; f++) {
+        for (s32 k = 0; k < 3; k++) {
+            u32 a = p->faces[f * 3 + k], b = p->faces[f * 3 + (k + 1) % 3];
+            if (a >= p->num_vertices || b >= p->num_vertices) bad_indices++;
+            else used[a] = 1;
+            edges[f * 3 + k] = (u64)a << 32 | b;
+        }
+    }
+    CHECK(bad_indices == 0, "%s: %llu indices past the vertices", name, (unsigned long long)bad_indices);
+
+    // Directed edges: each once, and its reverse present
+    u64 count = p->num_faces * 3, repeated = 0, open = 0, unused = 0;
+    qsort(edges, count, sizeof(u64), compare_u64);
+    for (u64 i = 0; i < count; i++) {
+        if (i > 0 && edges[i] == edges[i - 1]) repeated++;
+        u64 reverse = edges[i] << 32 | edges[i] >> 32;
+        if (!bsearch(&reverse, edges, count, sizeof(u64), compare_u64)) open++;
+    }
+    for (u64 v = 0; v < p->num_vertices; v++) {
+        unused += !used[v];
+    }
+    CHECK(repeated == 0, "%s: %llu edges used twice in one direction", name, (unsigned long long)repeated);
+    CHECK(open == 0, "%s: %llu boundary edges", name, (unsigned long long)open);
+    CHECK(unused == 0, "%s: %llu unused vertices", name, (unsigned long long)unused);
+    free(edges);
+    free(used);
+}
+
+// The faces as position triples, each rotated to start at its least vertex, sorted
+static f32* triangles(const ply* p) {
+    f32* t = malloc(p->num_faces * 9 * sizeof(f32) + 1);
+    for (u64 f = 0; f < p->num_faces; f++) {
+        const f32* v[3];
+        s32 first = 0;
+        for (s32 k = 0; k < 3; k++) {
+            u32 i = p->faces[f * 3 + k];
+            v[k] = &p->positions[(i < p->num_vertices ? i : 0) * 3];
+            if (compare_position(v[k], v[first]) < 0) first = k;
+        }
+        for (s32 k = 0; k < 3; k++) {
+            memcpy(&t[f * 9 + k * 3], v[(first + k) % 3], 3 * sizeof(f32));
+        }
+    }
+    qsort(t, p->num_faces, 9 * sizeof(f32), compare_triangle);
+    return t;
+}
+
+// 3x3x3 chunks of the test field. Values are made odd so none equals the
+// isovalue: a crossing at a voxel puts vertices of several edges at one
+// position, which the seam weld would merge
+static bool write_array(const char* dir) {
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/.zarray", dir);
+    FILE* fp = fopen(path, "w");
+    if (!fp) return false;
+    fprintf(fp, "{\"chunks\": [128, 128, 128], \"compressor\": {\"blocksize\": 0, \"clevel\": 1, \"cname\": \"lz4\", "
+                "\"id\": \"blosc\", \"shuffle\": 0}, \"dimension_separator\": \".\", \"dtype\": \"|u1\", "
+                "\"fill_value\": 0, \"filters\": null, \"order\": \"C\", \"shape\": [384, 384, 384], "
+                "\"zarr_format\": 2}\n");
+    fclose(fp);
+
+    chunk* c = malloc(sizeof(chunk));
+    u8* compressed = malloc(sizeof(chunk) + BLOSC2_MAX_OVERHEAD);
+    bool ok = true;
+    for (s32 i = 0; i < 27 && ok; i++) {
+        test_fill_chunk(c, i / 9, i / 3 % 3, i % 3);
+        u8* v = &(*c)[0][0][0];
+        for (size_t k = 0; k < sizeof(chunk); k++) {
+            v[k] |= 1;
+        }
+        int size = blosc2_compress(1, 0, 1, c, sizeof(chunk), compressed, sizeof(chunk) + BLOSC2_MAX_OVERHEAD);
+        snprintf(path, sizeof(path), "%s/%d.%d.%d", dir, i / 9, i / 3 % 3, i % 3);
+        fp = size > 0 ? fopen(path, "wb") : nullptr;
+        ok = fp && fwrite(compressed, 1, size, fp) == (size_t)size;
+        if (fp) ok = fclose(fp) == 0 && ok;
+    }
+    free(compressed);
+    free(c);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: test-vcr-mesh <vcr-mesh binary>\n");
+        return 1;
+    }
+    char dir[1024], array[1100];
+    if (!test_tempdir(dir, sizeof(dir))) {
+        fprintf(stderr, "failed to create a scratch directory\n");
+        return 1;
+    }
+    snprintf(array, sizeof(array), "%s/array", dir);
+    mkdir(array, 0755);
+    blosc2_init();
+    bool written = write_array(array);
+    blosc2_destroy();
+    CHECK(written, "failed to write the test array");
+
+    static const s32 tiles[] = {1, 2, 3};
+    ply reference = {0};
+    f32* reference_triangles = nullptr;
+    for (s32 i = 0; i < 3 && written; i++) {
+        char output[1200], name[32], cmd[4096];
+        snprintf(name, sizeof(name), "tile %dx%dx%d", tiles[i], tiles[i], tiles[i]);
+        snprintf(output, sizeof(output), "%s/tile%d.ply", dir, tiles[i]);
+        snprintf(cmd, sizeof(cmd), "'%s' '%s' '%s' --tile %dx%dx%d --cache 64 > /dev/null", argv[1], array, output,
+                 tiles[i], tiles[i], tiles[i]);
+        CHECK(system(cmd) == 0, "%s: vcr-mesh failed", name);
+        ply p;
+        bool read = ply_read(output, &p);
+        CHECK(read, "%s: failed to read %s", name, output);
+        if (!read) continue;
+        CHECK(p.num_faces > 0, "%s: no faces", name);
+        check_closed(name, &p);
+
+        f32* t = triangles(&p);
+        if (!reference_triangles) {
+            reference = p;
+            reference_triangles = t;
+            continue;
+        }
+        CHECK(p.num_vertices == reference.num_vertices && p.num_faces == reference.num_faces,
+              "%s: %llu vertices, %llu faces; tile 1x1x1: %llu, %llu", name, (unsigned long long)p.num_vertices,
+              (unsigned long long)p.num_faces, (unsigned long long)reference.num_vertices,
+              (unsigned long long)reference.num_faces);
+        CHECK(p.num_faces == reference.num_faces &&
+                  memcmp(t, reference_triangles, p.num_faces * 9 * sizeof(f32)) == 0,
+              "%s: triangles differ from tile 1x1x1", name);
+        free(t);
+        ply_free(&p);
+    }
+    free(reference_triangles);
+    ply_free(&reference);
+
+    test_remove_tree(dir);
+    return test_result();
+}